@@ -0,0 +1,57 @@
+#pragma once
+
+/*
+ * The on-card format of the attendance log, shared with tools/attendance-query.c, so only plain C here.
+ * Little endian, as written by the esp32.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define ATTENDANCE_LOG_MAGIC 0x4c415352 // "RSAL"
+#define ATTENDANCE_LOG_VERSION 1
+
+    typedef enum
+    {
+        ATTENDANCE_UPLOADED = 0, // the server has the image
+        ATTENDANCE_STORED,       // the image waits in the offline store (sdcard or spill flash)
+        ATTENDANCE_IMAGE_LOST,   // the scan was seen, its image couldn't be kept anywhere
+        ATTENDANCE_OUTCOME_COUNT,
+    } attendance_outcome_t;
+
+    /**
+     * Starts the file. `crc` covers the fields before it.
+     */
+    typedef struct attendance_log_header_t
+    {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t record_size; // sizeof(attendance_record_t)
+        int64_t created_ms;   // wall clock
+        uint32_t reserved;
+        uint32_t crc;
+    } attendance_log_header_t;
+
+    /**
+     * One per scan, fixed width so the log can be searched without parsing it. The image of a scan is named
+     * `<serial_number>_<wall_time_ms>.jpg` wherever it ended up. `crc` covers the fields before it.
+     */
+    typedef struct attendance_record_t
+    {
+        uint64_t serial_number;
+        int64_t wall_time_ms; // ms since the epoch, only meaningful once the clock is set
+        int64_t monotonic_us; // since boot, orders the scans of one boot even without the wall clock
+        uint32_t scan_id;     // see trace.h
+        uint8_t outcome;      // attendance_outcome_t
+        uint8_t reserved[3];
+        uint32_t image_length; // 0 without an image
+        uint32_t crc;
+    } attendance_record_t;
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "attendance-format.h"
+#include "events.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define ATTENDANCE_LOG_PATH "/sdcard/attend.dat"
+#define ATTENDANCE_LOG_BATCH_SIZE 32           // records collected in ram before they are written together
+#define ATTENDANCE_LOG_BUFFER_SIZE 128         // records kept in ram while the card is busy, beyond that they are dropped
+#define ATTENDANCE_LOG_FLUSH_INTERVAL_MS 10000 // the longest a record waits in ram
+
+    /**
+     * Opens the log on the sdcard (creating it with its header) and starts the task writing the batches.
+     * A torn record at the end, from a power cut, is cut off.
+     * Must be called after the sdcard is mounted.
+     */
+    esp_err_t attendance_log_init();
+
+    /**
+     * Adds the scan to the current batch, it is written once the batch is full or
+     * ATTENDANCE_LOG_FLUSH_INTERVAL_MS passed. Doesn't touch the sdcard, safe to call from any task.
+     *
+     * @param image_length: The bytes of the image, 0 if there is none.
+     */
+    esp_err_t attendance_log_record(const rfid_a_s_event_data_t *scan, attendance_outcome_t outcome, uint32_t image_length);
+
+    /**
+     * Writes the batch and syncs the log whenever it is full, or every ATTENDANCE_LOG_FLUSH_INTERVAL_MS.
+     */
+    void attendance_log_task(void *args);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "driver/sdmmc_types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define BENCHMARK_ITERATIONS 200       // for the cheap, cpu bound benchmarks
+#define BENCHMARK_SD_ITERATIONS 20     // every iteration writes a frame sized file
+#define BENCHMARK_FRAME_SIZE (40 * 1024) // typical svga jpeg at quality 12
+#define BENCHMARK_QUEUE_ITEMS 2000
+#define BENCHMARK_SD_WRITER_MAX_BUFFER (64 * 1024) // sd writer buffers from SD_WRITER_ALIGNMENT doubling up to this
+#define BENCHMARK_SD_WRITER_SYNC_INTERVAL 8        // frames between syncs for the batched run
+#define BENCHMARK_ROSTER_SIZE 50000                // enrolled serials, a large school district
+#define BENCHMARK_ROSTER_LOOKUPS 50000
+
+// everything the sdcard benchmarks write goes here, and is removed again
+#ifndef BENCHMARK_SCRATCH_FOLDER
+#define BENCHMARK_SCRATCH_FOLDER "/sdcard/bench"
+#endif
+
+    /**
+     * Measures the capture/upload/storage paths and logs the results.
+     * On the device it is enabled with RUN_BENCHMARKS in globals.h and runs once at boot before the camera feed
+     * starts, tools/benchmark-host.c runs it on the host.
+     *
+     * @param card: The mounted sdcard, the sdcard benchmarks are skipped when NULL.
+     */
+    void run_benchmarks(sdmmc_card_t *card);
+
+#ifdef __cplusplus
+}
+#endif
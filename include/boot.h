@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * A step of bringing the device up, run on its own task as soon as the stages it depends on have run.
+     * A stage that failed still counts as run, whoever depends on it checks what it left behind.
+     */
+    typedef struct boot_stage_t
+    {
+        const char *name;
+        EventBits_t bit;        // set once the stage has run
+        EventBits_t depends_on; // bits of the stages to run first
+        esp_err_t (*run)(void);
+        esp_err_t result;
+        int64_t started_us; // since boot, once the dependencies were done
+        int64_t finished_us;
+    } boot_stage_t;
+
+    /**
+     * Starts every stage, the stages must live until they have all run.
+     */
+    esp_err_t boot_start(boot_stage_t *stages, size_t count);
+
+    /**
+     * Waits until all of `bits` have run, returns the bits of the stages that have.
+     */
+    EventBits_t boot_wait(EventBits_t bits, TickType_t timeout);
+
+    /**
+     * Logs when each stage started and how long it took.
+     */
+    void boot_log_stages(const boot_stage_t *stages, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -31,12 +31,12 @@ extern "C"
 #define CAM_PIN_PCLK 22
 
 #define RFID_PHOTO_QUEUE_SIZE 10
+#define SCAN_REQUEST_QUEUE_SIZE 5        // scans waiting for their burst to be captured
+#define CAMERA_FEED_IDLE_TIMEOUT_MS 30000 // stop filling the pre-trigger ring after this long without scans
 
     extern TaskHandle_t camera_feed_task_handle;
     extern rc522_handle_t scanner;
 
-    esp_err_t initialize_spiffs();
-
     esp_err_t camera_init();
 
     void register_photo_task(void *args);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define CONNECTIVITY_PROBE_INTERVAL_MS 30000 // how often a reachable server is checked, uploads count as checks
+#define CONNECTIVITY_PROBE_TIMEOUT_MS 2000   // tcp connect timeout of a probe
+#define CONNECTIVITY_RETRY_MIN_MS 2000       // first retry after the server became unreachable
+#define CONNECTIVITY_RETRY_MAX_MS 60000      // the retry interval doubles up to this
+
+    /**
+     * Creates the cached state and starts the task probing SERVER_ADDRESS in the background.
+     * Must be called after `wifi_init_sta()`.
+     */
+    esp_err_t connectivity_init();
+
+    /**
+     * Whether the last probe or upload reached the server, and wifi is still connected.
+     * Only reads the cached state, so it can be called on every scan.
+     */
+    bool connectivity_server_reachable();
+
+    /**
+     * Feeds the outcome of a request to the server into the cached state.
+     * A failure marks the server unreachable right away and has it probed again.
+     */
+    void connectivity_report(bool reached);
+
+    /**
+     * Probes the server whenever the cached state is stale or unreachable.
+     */
+    void connectivity_monitor_task(void *args);
+
+#ifdef __cplusplus
+}
+#endif
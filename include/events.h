@@ -1,9 +1,13 @@
 #pragma once
 
+#include <stdbool.h>
+
 #include "rc522.h"
 #include "driver/sdmmc_types.h"
 #include "esp_camera.h"
 
+#include "frame-pool.h"
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -25,16 +29,24 @@ extern "C"
 
 
     /**
-     * rfid_a_s_event_data_t consists up of the scanned rfid tag, if rfid was scanned
+     * rfid_a_s_event_data_t consists up of the scanned rfid tag (copied, as the scanner reuses its tag), if rfid was scanned
+     * the time of the scan in microseconds since boot, stamped when the scan reaches the camera
+     * the wall clock time of the scan in ms since the epoch, stamped along with it (only meaningful once the clock is set)
+     * the id under which the scan's stages are traced (see trace.h), 0 if untraced
      * the sdcard if it has already been initialized
-     * and the frame buffer of the captured image if the image has already been captured
+     * and the pooled frame of the captured image if the image has already been captured
+     * whether the capture was replayed from the offline store, so it isn't stored again if its upload fails
+     * (whoever keeps the frame beyond the event must hold a reference to it, see frame-pool.h)
      */
     typedef struct rfid_a_s_event_data_t
     {
-        rc522_tag_t *tag;
-        camera_fb_t *fb;
+        rc522_tag_t tag;
+        int64_t scan_time_us;
+        int64_t scan_wall_time_ms;
+        uint32_t scan_id;
+        frame_slot_t *frame;
         sdmmc_card_t *card;
-
+        bool stored;
     } rfid_a_s_event_data_t;
 
 #ifdef __cplusplus
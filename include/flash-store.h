@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "offline-store.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define FLASH_STORE_PARTITION_LABEL "spill"
+#define FLASH_STORE_PARTITION_SUBTYPE 0x40 // a custom data subtype, see partitions_custom.csv
+#define FLASH_STORE_SECTOR_SIZE 4096       // the erase unit of the flash
+#define FLASH_SECTOR_MAGIC 0x53534652      // "RFSS"
+#define FLASH_RECORD_MAGIC 0x52534652      // "RFSR"
+
+/**
+ * The share of the ring unsent records may take up before new captures are kept without their image, so the
+ * attendance of every scan still fits.
+ */
+#define FLASH_STORE_IMAGE_QUOTA_PERCENT 75
+
+    /**
+     * Starts every sector. `sequence` counts the sectors ever written, the sector's place in the ring is
+     * `sequence % sector count`, so the newest sector is found again after a reboot.
+     */
+    typedef struct flash_sector_header_t
+    {
+        uint32_t magic;
+        uint32_t sequence;
+        uint16_t first_record; // offset of the first record starting in this sector, 0xffff if none does
+        uint16_t reserved;
+        uint32_t crc; // of the fields above
+    } flash_sector_header_t;
+
+    /**
+     * Every record starts with this header followed by the jpeg (none for an attendance only record) and padding up
+     * to 4 bytes. Records run on across sectors, skipping the sector headers.
+     * `crc` covers the header (with `crc` 0 and `state` erased) and the jpeg.
+     */
+    typedef struct flash_record_header_t
+    {
+        uint32_t magic;
+        uint32_t length; // of the jpeg, 0 keeps only the attendance
+        uint32_t crc;
+        uint32_t state; // 0xffffffff until consumed, then programmed to 0 without erasing the sector
+        uint64_t serial_number;
+        int64_t scan_time_ms;
+    } flash_record_header_t;
+
+    /**
+     * Finds the spill partition and the newest record in it. Doesn't need the sdcard.
+     */
+    esp_err_t flash_store_init();
+
+    /**
+     * Appends one capture to the ring, erasing the oldest sector when it runs into it. Past
+     * FLASH_STORE_IMAGE_QUOTA_PERCENT only the attendance is kept.
+     * Safe to call from any task.
+     */
+    esp_err_t flash_store_append(uint64_t serial_number, int64_t scan_time_ms, const uint8_t *jpeg, size_t length);
+
+    /**
+     * Like `offline_store_read_oldest()`, fills `length`, `serial_number` and `scan_time_ms` of the header.
+     */
+    esp_err_t flash_store_read_oldest(offline_record_header_t *out_header, uint8_t *jpeg, size_t capacity);
+
+    esp_err_t flash_store_consume_oldest();
+
+    /**
+     * The number of records not yet consumed.
+     */
+    uint32_t flash_store_backlog();
+
+    void flash_store_log_stats();
+
+#ifdef __cplusplus
+}
+#endif
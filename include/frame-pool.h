@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_camera.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define FRAME_POOL_SLOT_COUNT 14           // the pre-trigger ring (6) plus the frames in flight (queue, upload, sdcard)
+#define FRAME_POOL_SLOT_SIZE (96 * 1024)   // svga jpeg at quality 12 stays well below this
+
+    /**
+     * A captured frame kept in psram until every stage using it has released it.
+     * `fb` is a copy of the driver's frame header whose `buf` points into the slot's own storage,
+     * so it can be passed to anything expecting a `camera_fb_t` (but never to `esp_camera_fb_return()`).
+     */
+    typedef struct frame_slot_t
+    {
+        camera_fb_t fb;
+        size_t capacity;
+        uint8_t refcount;
+    } frame_slot_t;
+
+    esp_err_t frame_pool_init();
+
+    /**
+     * Takes a free slot with a reference count of 1 and an empty frame, for frames which don't come from the driver.
+     * The caller fills `fb` (up to `capacity` bytes) keeping `fb.buf` as it is.
+     *
+     * Returns NULL if every slot is in use.
+     */
+    frame_slot_t *frame_pool_claim();
+
+    /**
+     * Copies the driver frame buffer into a free slot with a reference count of 1.
+     * The caller can return `src` to the driver right after this call.
+     *
+     * Returns NULL if every slot is in use or the frame doesn't fit in a slot.
+     */
+    frame_slot_t *frame_pool_fill(const camera_fb_t *src);
+
+    /**
+     * Takes one more reference, to be used by stages which outlive the caller (the uploader).
+     */
+    void frame_pool_ref(frame_slot_t *frame);
+
+    /**
+     * Drops one reference, the slot is reused once the count reaches zero.
+     */
+    void frame_pool_release(frame_slot_t *frame);
+
+    size_t frame_pool_free_slots();
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * Quality measures of a jpeg frame, taken from its quantized coefficients.
+     * - sharpness: root mean square of the dequantized luma AC coefficients, motion blur pulls this down
+     * - mean_luma: average brightness (0-255) from the luma DC coefficients
+     * - score: sharpness weighted down for under/over exposed frames, higher is better
+     */
+    typedef struct frame_quality_t
+    {
+        float sharpness;
+        float mean_luma;
+        float score;
+        uint32_t luma_blocks;
+    } frame_quality_t;
+
+    /**
+     * Scores a baseline jpeg by walking its entropy coded data, without dequantizing the chroma or doing any idct.
+     * Not reentrant, it decodes into a static scratch decoder, only one task may score at a time. On the device that
+     * is the camera feed task, `run_benchmarks()` scores before the feed task is started.
+     *
+     * Returns ESP_ERR_NOT_SUPPORTED for progressive/arithmetic coded images
+     * and ESP_ERR_INVALID_ARG / ESP_ERR_INVALID_SIZE for malformed or truncated ones.
+     */
+    esp_err_t frame_quality_score(const uint8_t *jpeg, size_t jpeg_length, frame_quality_t *out);
+
+#ifdef __cplusplus
+}
+#endif
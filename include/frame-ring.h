@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame-pool.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define FRAME_RING_PRE_FRAMES 3  // frames kept from before the scan instant
+#define FRAME_RING_POST_FRAMES 3 // frames captured after the scan instant
+#define FRAME_RING_SIZE (FRAME_RING_PRE_FRAMES + FRAME_RING_POST_FRAMES)
+
+    /**
+     * The capture time of the frame in microseconds since boot (same clock as `esp_timer_get_time()`).
+     */
+    int64_t frame_timestamp_us(const frame_slot_t *frame);
+
+    /**
+     * Adds the most recent frame to the ring, taking over the caller's reference.
+     * The oldest frame is released when the ring is full.
+     */
+    void frame_ring_push(frame_slot_t *frame);
+
+    /**
+     * Releases the oldest frame in the ring, used to make room in the frame pool.
+     * Returns false if the ring is empty.
+     */
+    bool frame_ring_drop_oldest();
+
+    /**
+     * Number of frames in the ring captured at or after `timestamp_us`.
+     */
+    size_t frame_ring_count_since(int64_t timestamp_us);
+
+    /**
+     * Collects up to `before` frames captured before `timestamp_us` and up to `after` frames captured at or after it,
+     * oldest first. Every frame written to `out` carries a reference which the caller must release.
+     *
+     * Returns the number of frames written to `out`.
+     */
+    size_t frame_ring_get_around(int64_t timestamp_us, size_t before, size_t after, frame_slot_t **out, size_t out_length);
+
+#ifdef __cplusplus
+}
+#endif
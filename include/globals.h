@@ -11,13 +11,25 @@ extern "C"
 #define USE_ESP32CAM 1
 #define USE_RC522 0
 
+/**
+ * Measures the capture/upload/storage paths once at boot, see benchmark.h
+ */
+#define RUN_BENCHMARKS 0
+
     static const char *TAG = "RFID Based Attendance System";
 
 // priorities of various tasks
 // main task has priority 1
 #define CAMERA_FEED_TASK_PRIORITY (UBaseType_t)2    // less priority than the main task
 #define REGISTER_PHOTO_TASK_PRIORITY (UBaseType_t)3 // less priority than pushing the video to screen
-#define UPLOAD_JPEG_TASK_PRIORITY (UBaseType_t)4    // least priority of them all
+#define UPLOADER_TASK_PRIORITY (UBaseType_t)1       // below the camera feed, capture never waits on the uplink
+#define TRACE_EXPORT_TASK_PRIORITY (UBaseType_t)1   // only reporting, same as the main task
+#define CONNECTIVITY_TASK_PRIORITY (UBaseType_t)1   // probes only while nothing else is running
+#define OFFLINE_DRAIN_TASK_PRIORITY (UBaseType_t)0  // with the idle task, the backlog only moves when nothing else does
+#define ATTENDANCE_LOG_TASK_PRIORITY (UBaseType_t)1 // batches are small, it never holds up the camera
+#define ROSTER_SYNC_TASK_PRIORITY (UBaseType_t)1    // a few requests every few minutes
+#define BOOT_STAGE_TASK_PRIORITY (UBaseType_t)1     // same as the main task that used to run them
+#define WIFI_SUPERVISOR_TASK_PRIORITY (UBaseType_t)2 // reconnecting comes before the uploads waiting for it
 
 // for http client
 #define MAX_HTTP_RECV_BUFFER 512
@@ -26,20 +38,25 @@ extern "C"
 // stack sizes of tasks
 #define TASK_CAMERA_FEED_STACK_SIZE 2048
 #define TASK_REGISTER_PHOTO_STACK_SIZE 2048
-#define TASK_UPLOAD_JPEG_STACK_SIZE 2048 + MAX_HTTP_OUTPUT_BUFFER + MAX_HTTP_RECV_BUFFER
+#define TASK_UPLOADER_STACK_SIZE (8 * 1024) // connects, tls and sha256, on failure jpeg encoding and the sdcard writes
+#define TASK_TRACE_EXPORT_STACK_SIZE 4096
+#define TASK_CONNECTIVITY_STACK_SIZE 3072
+#define TASK_OFFLINE_DRAIN_STACK_SIZE 3072
+#define TASK_ATTENDANCE_LOG_STACK_SIZE 3072
+#define TASK_ROSTER_SYNC_STACK_SIZE 4096 // the http client and cjson
+#define TASK_BOOT_STAGE_STACK_SIZE 4096 // the main task ran them before, the benchmarks need about as much
+#define TASK_WIFI_SUPERVISOR_STACK_SIZE 3072
 
 // pinning these tasks to separate cores as camera feed task needs to run all the time
 #define CAMERA_FEED_TASK_CORE_AFFINITY (UBaseType_t)1 // only this on separate core
 #define REGISTER_PHOTO_TASK_CORE_AFFINITY (UBaseType_t)0
-#define UPLOAD_JPEG_TASK_CORE_AFFINITY (UBaseType_t)0
+#define UPLOADER_TASK_CORE_AFFINITY (UBaseType_t)0
 
 // upload related
-#define PING_COUNT 4
-#define PING_TARGET "www.espressif.com"
 #define SERVER_ADDRESS "192.168.1.107:8000" //testing locally 
 
 // full filepath of image
-#define IMAGE_FILEPATH_LENGTH 50
+#define IMAGE_FILEPATH_LENGTH 80
 
 /*
  * SPI for sdcard of esp32-cam and rc522
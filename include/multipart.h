@@ -0,0 +1,78 @@
+#pragma once
+
+/*
+ * The multipart/form-data body of an upload, shared with the tools, so only plain C here.
+ * The body is described as a list of segments pointing at the part headers and the jpegs where they already are, its
+ * length is known before anything is sent, so a request goes out with a Content-Length and without any copies.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define MULTIPART_BOUNDARY "123456789000000000000987654321"
+#define MULTIPART_CONTENT_TYPE "multipart/form-data; boundary=" MULTIPART_BOUNDARY
+#define MULTIPART_MAX_PARTS 8          // files in one body
+#define MULTIPART_PART_HEADER_SIZE 256 // the boundary and the headers of a part
+#define MULTIPART_SEGMENT_COUNT(parts) (2 * (parts) + 1)
+
+    /**
+     * One piece of the body, like a `struct iovec`.
+     */
+    typedef struct multipart_segment_t
+    {
+        const void *data;
+        size_t length;
+    } multipart_segment_t;
+
+    /**
+     * Segment 2i is the header of part i and segment 2i + 1 its jpeg (empty for an attendance only record), the last
+     * segment closes the body. Only the part headers are stored here, the jpegs have to outlive the body.
+     */
+    typedef struct multipart_body_t
+    {
+        char headers[MULTIPART_MAX_PARTS][MULTIPART_PART_HEADER_SIZE];
+        multipart_segment_t segments[MULTIPART_SEGMENT_COUNT(MULTIPART_MAX_PARTS)];
+        size_t part_count;
+        size_t segment_count;  // only complete once `multipart_body_finish()` was called
+        size_t content_length; // of all the segments
+    } multipart_body_t;
+
+    /**
+     * Writes `length` bytes of `data`, returns the number written (which may be fewer) or -1 on an error.
+     */
+    typedef int (*multipart_write_fn)(void *context, const char *data, size_t length);
+
+    /**
+     * Writes the boundary and the headers of a multipart file part into `out`, including the rfid serial and the
+     * scan time (ms since the epoch) of the capture in the part.
+     * Returns the length written, or -1 if `out` is too small.
+     */
+    int build_multipart_part_header(char *out, size_t out_length, const char *filename, uint64_t serial_number, int64_t scan_time_ms);
+
+    void multipart_body_init(multipart_body_t *body);
+
+    /**
+     * Appends a file part for a capture, named `<serial>_<scan time>.jpg`.
+     * Returns -1 if the body already holds MULTIPART_MAX_PARTS parts or was finished.
+     */
+    int multipart_body_add_jpeg(multipart_body_t *body, uint64_t serial_number, int64_t scan_time_ms, const uint8_t *jpeg, size_t length);
+
+    /**
+     * Appends the closing boundary, after which `content_length` is the exact length of the body.
+     */
+    void multipart_body_finish(multipart_body_t *body);
+
+    /**
+     * Writes `count` segments in order with `write`, calling it again after short writes.
+     * Returns 0, or -1 as soon as a write fails.
+     */
+    int multipart_write_segments(const multipart_segment_t *segments, size_t count, multipart_write_fn write, void *context);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include "events.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define OFFLINE_DRAIN_PACE_MS 250                // between two stored captures, so live scans find the uplink free
+#define OFFLINE_DRAIN_IDLE_MS 5000               // how often an empty backlog or an unreachable server is checked again
+#define OFFLINE_DRAIN_RETRY_MS 10000             // after a failed upload
+#define OFFLINE_DRAIN_UPLOAD_TIMEOUT_MS 120000   // the uploader retries on its own, this only guards against a lost result
+#define OFFLINE_DRAIN_MIN_FREE_SLOTS 4           // frame pool slots left to the camera
+#define OFFLINE_DRAIN_REPORT_INTERVAL_MS 60000   // how often the backlog and drain rate are logged while draining
+
+    /**
+     * Starts the task replaying the offline store to the server, must be called after `offline_store_init()`
+     * and `upload_init()`.
+     */
+    esp_err_t offline_drain_init();
+
+    /**
+     * Called by the uploader with the result of every stored capture it was handed.
+     */
+    void offline_drain_on_upload(const rfid_a_s_event_data_t *capture, esp_err_t result);
+
+    /**
+     * Sends the stored captures oldest first, one at a time and only while the uploader has nothing else queued.
+     * Each capture is consumed from the store once the server took it, so a reboot resumes with the next one.
+     */
+    void offline_drain_task(void *args);
+
+#ifdef __cplusplus
+}
+#endif
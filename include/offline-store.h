@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "sd-writer.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * 1 appends the captures to the segment log below, 0 falls back to one jpeg file per capture, sharded by day and on a
+ * busy day by hour, /sdcard/images/<yyyymmdd>[/<hh>] (see `save_image_to_sdcard()` and SD_IMAGES_HOUR_SHARD_THRESHOLD).
+ */
+#define OFFLINE_STORE_USE_SEGMENT_LOG 1
+
+#define OFFLINE_STORE_ROOT "/sdcard/log"
+#define OFFLINE_STORE_ALLOCATION_UNIT (16 * 1024)                  // the allocation_unit_size the card is mounted with
+#define OFFLINE_SEGMENT_SIZE (256 * OFFLINE_STORE_ALLOCATION_UNIT) // 4MB, ~100 captures per segment
+#define OFFLINE_RECORD_MAGIC 0x4c474f52                            // "ROGL"
+#define OFFLINE_CHECKPOINT_PATH OFFLINE_STORE_ROOT "/drain.pos"     // the oldest record not yet consumed
+#define OFFLINE_STORE_PREALLOCATE 1                                // allocate the clusters of a segment when creating it
+#define OFFLINE_STORE_WRITE_BUFFER_SIZE SD_WRITER_BUFFER_SIZE      // 0 writes every record straight to the card
+
+/**
+ * Records appended between two syncs of the segment and its index. 1 has every record on the card before
+ * `offline_store_append()` returns, more trade the last few records of a power cut for fewer stalls.
+ */
+#define OFFLINE_STORE_SYNC_INTERVAL 1
+
+    /**
+     * Every record of a segment starts with this header, followed by the jpeg and padding up to 4 bytes.
+     * `crc` covers the header (with `crc` set to 0) and the jpeg.
+     */
+    typedef struct offline_record_header_t
+    {
+        uint32_t magic;
+        uint32_t segment; // the sequence number of the segment, tells records apart from stale data of reused clusters
+        uint32_t length;  // of the jpeg
+        uint32_t crc;
+        uint64_t serial_number;
+        int64_t scan_time_ms; // wall clock, ms since the epoch
+    } offline_record_header_t;
+
+    /**
+     * One entry per record in the index file next to each segment, so the records can be listed without reading
+     * through the segment. The index can always be rebuilt from the segment.
+     */
+    typedef struct offline_index_entry_t
+    {
+        uint32_t offset; // of the record header in the segment
+        uint32_t length; // of the jpeg
+        uint64_t serial_number;
+        int64_t scan_time_ms;
+        uint32_t crc;       // of the record
+        uint32_t entry_crc; // of this entry (with `entry_crc` set to 0)
+    } offline_index_entry_t;
+
+    /**
+     * Opens the newest segment of the log under OFFLINE_STORE_ROOT, creating the first one if there is none.
+     * Whatever a power cut left behind is recovered: the index is cut back to the last record that checks out,
+     * and records written after the last index entry are indexed again.
+     *
+     * Must be called after the sdcard is mounted.
+     */
+    esp_err_t offline_store_init();
+
+    /**
+     * Appends one capture, the record and its index entry are on the card once this returns ESP_OK
+     * (or once OFFLINE_STORE_SYNC_INTERVAL records are appended).
+     * Without a usable sdcard the capture goes to the spill flash instead, see `flash_store_append()`.
+     * Safe to call from any task.
+     */
+    esp_err_t offline_store_append(uint64_t serial_number, int64_t scan_time_ms, const uint8_t *jpeg, size_t length);
+
+    /**
+     * Reads the oldest record not yet consumed, see `offline_store_consume_oldest()`.
+     * Records which don't check out anymore are skipped (and consumed).
+     *
+     * Returns ESP_ERR_NOT_FOUND if every record has been consumed, ESP_ERR_INVALID_SIZE if the jpeg doesn't fit in
+     * `capacity`.
+     */
+    esp_err_t offline_store_read_oldest(offline_record_header_t *out_header, uint8_t *jpeg, size_t capacity);
+
+    /**
+     * Moves the checkpoint past the oldest record, which is kept on the card so a reboot resumes from there.
+     * Segments are deleted once all of their records are consumed.
+     */
+    esp_err_t offline_store_consume_oldest();
+
+    /**
+     * The number of records not yet consumed.
+     */
+    uint32_t offline_store_backlog();
+
+    /**
+     * Logs the number of segments and records stored.
+     */
+    void offline_store_log_stats();
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+
+/*
+ * The format of the roster partition, shared with tools/roster-image.c, so only plain C here.
+ * Little endian, as read by the esp32.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define ROSTER_MAGIC 0x54535252 // "RRST"
+#define ROSTER_FORMAT_VERSION 1
+#define ROSTER_SLOT_SIZE 0x80000 // the partition holds two rosters, a new one is written over the older one
+#define ROSTER_SLOT_CAPACITY ((ROSTER_SLOT_SIZE - sizeof(roster_image_header_t)) / sizeof(uint64_t))
+
+    /**
+     * Starts each slot of the partition, followed by `count` serial numbers in ascending order without duplicates.
+     * `serials_crc` covers the serial numbers, `crc` the fields before it.
+     */
+    typedef struct roster_image_header_t
+    {
+        uint32_t magic;
+        uint16_t format_version;
+        uint16_t sequence; // counted up by every write of a slot, the later written slot is the one loaded
+        uint32_t version;  // of the roster, counted up by whoever enrolls the students, a full resync can lower it
+        uint32_t count;
+        uint32_t serials_crc;
+        uint32_t crc;
+    } roster_image_header_t;
+
+#ifdef __cplusplus
+}
+#endif
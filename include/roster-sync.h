@@ -0,0 +1,31 @@
+#pragma once
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define ROSTER_SYNC_INTERVAL_MS 300000          // enrollments are rare, a new card works within a few minutes
+#define ROSTER_SYNC_RETRY_MS 30000              // after a failed sync or while the server is unreachable
+#define ROSTER_SYNC_PAGE_SIZE 500               // changes per request, keeps the response and its json tree small
+#define ROSTER_SYNC_RESPONSE_SIZE (16 * 1024)   // a page of serials sent as strings, with room to spare
+
+    /**
+     * Starts the task keeping the roster in step with the server, must be called after `roster_init()` and
+     * `connectivity_init()`.
+     */
+    esp_err_t roster_sync_init();
+
+    /**
+     * Pulls the cards added and removed on the server since the version in use (`GET /roster?since=`), a page at
+     * a time, and applies them all at once with `roster_apply()`. A failed page leaves the roster as it was.
+     */
+    esp_err_t roster_sync();
+
+    void roster_sync_task(void *args);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "roster-format.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define ROSTER_PARTITION_LABEL "roster"
+#define ROSTER_PARTITION_SUBTYPE 0x41 // a custom data subtype, see partitions_custom.csv
+#define ROSTER_NVS_NAMESPACE "roster"
+#define ROSTER_NVS_VERSION_KEY "version" // the last version synced from the server
+
+    typedef enum
+    {
+        ROSTER_UNAVAILABLE = 0, // no roster was loaded, every card is let through
+        ROSTER_ENROLLED,
+        ROSTER_UNKNOWN,
+    } roster_status_t;
+
+    /**
+     * Loads the enrolled serial numbers from the newest of the two slots of the roster partition into PSRAM.
+     * Must be called after `initialize_nvs()`.
+     * Without a valid roster it returns ESP_ERR_NOT_FOUND and lookups give ROSTER_UNAVAILABLE until one is synced.
+     */
+    esp_err_t roster_init();
+
+    /**
+     * The version of the roster in use, 0 without one.
+     */
+    uint32_t roster_version();
+
+    /**
+     * Builds the roster of `to_version` next to the one in use and swaps it in, lookups only wait for the swap.
+     * The new roster is then written over the older slot and its version stored in nvs.
+     * Unless `full` replaces the whole roster, the changes must be relative to `from_version`, the version in use.
+     * Sorts `adds` and `removes` in place. Only called from the roster sync task.
+     */
+    esp_err_t roster_apply(uint32_t from_version, uint32_t to_version, bool full,
+                           uint64_t *adds, uint32_t add_count, uint64_t *removes, uint32_t remove_count);
+
+    /**
+     * Whether the card belongs to anyone, a binary search of the loaded roster. Safe to call from any task.
+     */
+    roster_status_t roster_lookup(uint64_t serial_number);
+
+    /**
+     * The search behind `roster_lookup()`, on any ascending array of serial numbers.
+     */
+    bool roster_contains(const uint64_t *serials, uint32_t count, uint64_t serial_number);
+
+    void roster_log_stats();
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define SCAN_DEBOUNCE_WINDOW_MS 3000 // reads of the same tag closer than this to its previous read are dropped
+#define SCAN_DEBOUNCE_TABLE_SIZE 64  // power of two, well above the tags read within one window
+
+    /**
+     * Whether a read of the tag is a new scan. A tag held on the reader is read over and over, every read restarts
+     * its window, so it only counts once until it has been away for SCAN_DEBOUNCE_WINDOW_MS.
+     * Only called from the scanner's task.
+     */
+    bool scan_debounce_accept(uint64_t serial_number, int64_t now_us);
+
+    /**
+     * Logs the number of reads accepted and suppressed.
+     */
+    void scan_debounce_log_stats();
+
+#ifdef __cplusplus
+}
+#endif
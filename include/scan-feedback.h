@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+#include "globals.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#if USE_ESP32CAM == 1
+#define SCAN_FEEDBACK_LED_PIN 33   // the red led on the back of the esp32-cam
+#define SCAN_FEEDBACK_LED_ON_LEVEL 0 // inverted logic
+#else
+#define SCAN_FEEDBACK_LED_PIN 2 // the builtin led of the devkit
+#define SCAN_FEEDBACK_LED_ON_LEVEL 1
+#endif
+
+#define SCAN_FEEDBACK_ENROLLED_MS 400 // one long blink for a card on the roster
+#define SCAN_FEEDBACK_UNKNOWN_MS 80   // quick blinks for a card that isn't
+#define SCAN_FEEDBACK_UNKNOWN_BLINKS 3
+
+    esp_err_t scan_feedback_init();
+
+    /**
+     * Blinks the led for a scanned card without waiting for it, so the scanner isn't held up.
+     */
+    void scan_feedback_show(bool enrolled);
+
+#ifdef __cplusplus
+}
+#endif
@@ -5,6 +5,12 @@ extern "C"
 {
 #endif
 
+/**
+ * Images are saved in one directory per day, /sdcard/images/<yyyymmdd>, FAT looks up names by going through the
+ * directory so it is kept small. A day with more images than this is split further by hour, <yyyymmdd>/<hh>.
+ */
+#define SD_IMAGES_HOUR_SHARD_THRESHOLD 1000
+
     struct esp_err_t;
 
     esp_err_t init_sd_card(sdmmc_card_t **out);
@@ -13,9 +19,20 @@ extern "C"
 
     esp_err_t get_new_image_filepath(uint64_t img_identifier, char *extension, char *out_filepath, size_t out_filepath_length);
 
+    /**
+     * The root of the images directories, created on the first call.
+     */
     char *get_images_folder();
 
-    esp_err_t save_image_to_sdcard(uint8_t *image_buffer, int64_t rfid_serial_number);
+    /**
+     * Creates (or truncates) the file at `path` and writes `length` bytes of `data` to it.
+     */
+    esp_err_t write_to_file_path(const char *path, const uint8_t *data, size_t length);
+
+    /**
+     * Writes the image as its own file in the images folder, see `get_new_image_filepath()`.
+     */
+    esp_err_t save_image_to_sdcard(const uint8_t *image_buffer, size_t length, int64_t rfid_serial_number);
 
 #ifdef __cplusplus
 }
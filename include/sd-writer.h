@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define SD_WRITER_ALIGNMENT (16 * 1024)   // the allocation unit the card is mounted with, writes end on multiples of it
+#define SD_WRITER_BUFFER_SIZE (32 * 1024) // in psram, a multiple of SD_WRITER_ALIGNMENT
+
+    typedef struct sd_writer_stats_t
+    {
+        uint64_t bytes;
+        uint32_t writes; // calls into the filesystem
+        uint32_t syncs;
+        int64_t write_us;
+        int64_t worst_write_us; // the longest a single write stalled the caller
+        int64_t sync_us;
+        int64_t worst_sync_us;
+    } sd_writer_stats_t;
+
+    /**
+     * Collects small writes in a psram buffer and hands them to the filesystem in cluster aligned chunks.
+     * Data which spans whole chunks is written straight from the caller's buffer (e.g. a frame), without a copy.
+     */
+    typedef struct sd_writer_t
+    {
+        FILE *f;
+        uint8_t *buffer;
+        size_t capacity; // 0 writes everything straight through
+        size_t used;
+        uint32_t offset; // of `buffer[0]` in the file
+        sd_writer_stats_t stats;
+    } sd_writer_t;
+
+    /**
+     * Starts writing `f` at its current position. The stdio buffer of `f` is turned off, this one replaces it.
+     *
+     * @param buffer_size: SD_WRITER_BUFFER_SIZE normally, 0 for no buffering at all.
+     */
+    esp_err_t sd_writer_open(sd_writer_t *writer, FILE *f, size_t buffer_size);
+
+    /**
+     * Moves the position of the next write, flushing what is buffered if the position changes.
+     */
+    esp_err_t sd_writer_seek(sd_writer_t *writer, uint32_t offset);
+
+    esp_err_t sd_writer_write(sd_writer_t *writer, const void *data, size_t length);
+
+    /**
+     * Writes out what is buffered, and with `sync` waits until it is on the card.
+     */
+    esp_err_t sd_writer_flush(sd_writer_t *writer, bool sync);
+
+    /**
+     * Flushes and syncs, then frees the buffer. `f` stays open.
+     */
+    esp_err_t sd_writer_close(sd_writer_t *writer);
+
+    /**
+     * Grows `f` to `size` bytes, having the filesystem allocate all of its clusters up front.
+     */
+    esp_err_t sd_writer_preallocate(FILE *f, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
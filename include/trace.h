@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define TRACE_RING_SIZE 512                 // stage timestamps kept, older ones are overwritten
+#define TRACE_EXPORT_INTERVAL_MS (5 * 60000) // how often the statistics are dumped and posted
+#define TRACE_JSON_BUFFER_SIZE 2048
+
+    /**
+     * The stages a scan goes through, in the order they normally happen.
+     */
+    typedef enum
+    {
+        TRACE_STAGE_RFID_SCANNED = 0, // rc522_handler (or the mocked scan)
+        TRACE_STAGE_SCAN_HANDLED,     // handle_tag_scanned
+        TRACE_STAGE_FRAME_SELECTED,   // start_camera_feed, the burst frame was queued
+        TRACE_STAGE_UPLOAD_QUEUED,    // camera_capture, handed to the uploader
+        TRACE_STAGE_HTTP_OPENED,      // esp_http_client_open
+        TRACE_STAGE_HTTP_PREAMBLE,    // multipart headers written
+        TRACE_STAGE_HTTP_IMAGE,       // jpeg written
+        TRACE_STAGE_HTTP_DONE,        // request finished
+        TRACE_STAGE_SD_SAVED,         // save_image_to_sdcard
+        TRACE_STAGE_COUNT,
+    } trace_stage_t;
+
+    /**
+     * Starts tracing a new scan, stamping TRACE_STAGE_RFID_SCANNED.
+     * Returns the id to be carried along with the scan (never 0).
+     */
+    uint32_t trace_begin_scan();
+
+    /**
+     * Records the time a scan reached `stage`. Scans with id 0 aren't traced. Safe to call from any task.
+     */
+    void trace_stamp(uint32_t scan_id, trace_stage_t stage);
+
+    const char *trace_stage_name(trace_stage_t stage);
+
+    /**
+     * Logs p50/p95/p99 per stage, both since the scan and since the previous stage of the same scan.
+     */
+    void trace_dump();
+
+    /**
+     * Writes the same statistics as `trace_dump()` as json.
+     * Returns the length written (excluding the terminator), or -1 if `out` is too small.
+     */
+    int trace_to_json(char *out, size_t out_length);
+
+    /**
+     * Posts the json statistics to SERVER_ADDRESS/trace.
+     */
+    esp_err_t trace_post_json();
+
+    /**
+     * Periodically dumps the statistics on serial and posts them to the server when connected.
+     */
+    void trace_export_task(void *args);
+
+#ifdef __cplusplus
+}
+#endif
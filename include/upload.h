@@ -1,21 +1,68 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
     struct esp_err_t;
-    struct camera_fb_t;
     struct rc522_tag_t;
+    struct rfid_a_s_event_data_t;
+
+/**
+ * How captures are sent. Multipart batches the captures queued up behind a request into one body, raw sends every jpeg
+ * as the whole body of its own request, with the serial, the scan time, the device id and a sha256 of the jpeg in the
+ * headers, which spares the server looking for boundaries.
+ */
+#define UPLOAD_MODE_MULTIPART 0
+#define UPLOAD_MODE_RAW_JPEG 1
+#define UPLOAD_MODE UPLOAD_MODE_MULTIPART
 
 #define UPLOAD_RETRY_COUNT 2 // retries on failure
+#define UPLOAD_QUEUE_SIZE 8  // captures waiting for the uploader, bounds the memory held by uploads
+#define UPLOAD_BATCH_MAX_COUNT UPLOAD_QUEUE_SIZE // captures sent in one request
+#define UPLOAD_BATCH_MAX_BYTES (256 * 1024)      // jpeg bytes sent in one request, a failed request resends all of them
+#define UPLOAD_BATCH_RTT_FACTOR 2                // a batch grows until sending it takes this many round trips
+#define UPLOAD_BATCH_EWMA_WEIGHT 4               // the last request counts for 1/4 of the link estimate
+#define UPLOADER_STACK_LOW_WATER 1024            // bytes of the uploader stack never used, warned about below this
 
 #ifndef ESP_EVENT_ANY_ID
 #define ESP_EVENT_ANY_ID -1
 #endif
 
-    void upload_jpeg_task(void *args);
+    /**
+     * Creates the upload queue and starts the uploader task, must be called before any upload.
+     */
+    esp_err_t upload_init();
+
+    /**
+     * Queues a capture for the uploader task, copying `capture`.
+     * On success the uploader takes over the caller's reference to `capture->frame`, otherwise the caller keeps it.
+     *
+     * Returns ESP_ERR_TIMEOUT without blocking if the queue is full.
+     */
+    esp_err_t upload_enqueue(const struct rfid_a_s_event_data_t *capture);
+
+    /**
+     * The number of captures waiting for the uploader.
+     */
+    size_t upload_queue_depth();
+
+    /**
+     * Logs how often the persistent connection was reused and the connect time that saved.
+     */
+    void upload_log_connection_stats();
+
+    /**
+     * The single long lived task draining the upload queue over the persistent connection.
+     * Captures which queued up while a request was in flight are sent together in one multipart request.
+     */
+    void uploader_task(void *args);
 
 #ifdef __cplusplus
 }
@@ -9,9 +9,14 @@ extern "C"
 
 #define EXAMPLE_ESP_WIFI_SSID "internet"
 #define EXAMPLE_ESP_WIFI_PASS "prospectus502715"
-#define EXAMPLE_ESP_MAXIMUM_RETRY 2 // repeated trial without delay is pointless
-// todo: setup a task to check wifi connection in some interval
-//       and try to connect if not connected
+#define EXAMPLE_ESP_MAXIMUM_RETRY 2 // failed attempts before WIFI_FAIL_BIT is set, the supervisor keeps trying
+
+#define WIFI_RECONNECT_MIN_MS 500           // backoff after the first failed attempt
+#define WIFI_RECONNECT_MAX_MS 60000         // the backoff doubles up to this
+#define WIFI_FAST_RECONNECT_ATTEMPTS 2      // attempts on the cached bssid and channel before scanning all channels
+#define WIFI_RSSI_SAMPLE_INTERVAL_MS 10000  // how often the link quality is sampled while connected
+#define WIFI_NVS_NAMESPACE "wifi"
+#define WIFI_NVS_AP_KEY "ap" // bssid and channel of the last connection
 
 // just setting one for now
 #define ESP_WIFI_SCAN_AUTH_MODE_THRESHOLD WIFI_AUTH_WPA2_PSK
@@ -20,15 +25,30 @@ extern "C"
 
 /* The event group allows multiple bits for each event, but we only care about two events:
  * - we are connected to the AP with an IP
- * - we failed to connect after the maximum amount of retries */
+ * - we failed to connect after the maximum amount of retries (cleared once connected) */
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT BIT1
 
     /* FreeRTOS event group to signal when we are connected*/
     extern EventGroupHandle_t s_wifi_event_group;
 
+    /**
+     * Starts connecting to the AP without waiting for it, WIFI_CONNECTED_BIT is set once there is an ip.
+     * Needs `esp_netif_init()` and the default event loop.
+     */
     void wifi_init_sta(void);
 
+    /**
+     * Keeps reconnecting whenever the connection is lost, with a randomized exponential backoff. The first attempts
+     * go to the AP and channel of the last connection, skipping the scan. Samples the rssi while connected.
+     */
+    void wifi_supervisor_task(void *args);
+
+    /**
+     * Logs the reconnect and link quality statistics.
+     */
+    void wifi_log_stats();
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
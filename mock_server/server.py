@@ -1,14 +1,30 @@
-from http.server import HTTPServer, BaseHTTPRequestHandler
+from http.server import ThreadingHTTPServer, BaseHTTPRequestHandler
 import socket
-import numpy as np
-import cv2
 import fileinput
 import sys
 from pathlib import Path
 import re
+import hashlib
+import time
 import uuid
+import json
+import threading
+import argparse
+import os
+import sqlite3
+from collections import Counter, deque
+from urllib.parse import urlsplit, parse_qs
+from typing import Optional
 
 LOG_RECEIVED_DATA = False
+ROSTER_PAGE_LIMIT = 1000  # the most changes handed out per roster request, the device asks for less
+READ_SIZE = 64 * 1024  # request bodies are read and written to disk in blocks of this size
+MAX_PART_HEADER_SIZE = 8 * 1024  # the headers of a multipart part, a body going on longer is taken as malformed
+STATS_LATENCY_WINDOW = 4096  # the latest requests the latency percentiles of /stats are taken over
+STATS_RATE_WINDOW_S = 60  # the request rate of /stats is averaged over this long
+HEADLESS = False  # set by --headless, received images are only stored, never shown
+QUIET = False  # set by --quiet, no log line per request
+SCAN_TIME_PATTERN = re.compile(r"[0-9]{1,19}")  # the scan-time header, ms since the epoch
 
 module_path = Path(__file__).resolve()
 include_folder = module_path.parents[1].joinpath(
@@ -36,146 +52,597 @@ def sanitize_filename(filename: str) -> str:
     return filename if name else f"file_{uuid.uuid4().hex}{extension}"
 
 
-class MyHandler(BaseHTTPRequestHandler):
-    def do_GET(self):
-        self.log_request()
-        # send 200 response
-        self.send_response(200)
-        # add our own custom header
-        self.send_header("mock_header_key", "mock_header_value")
-        # send response headers
-        self.end_headers()
-        # send the body of the response
-        self.wfile.write(bytes("Hello to Esp32 from server.", "utf-8"))
+class Roster:
+    """
+    The enrolled rfid serial numbers as a log of changes, every enrollment bumps the version by one.
+    Devices ask for the net changes since the version they have, see `delta()`.
+    The log is kept in `roster.json` next to this file.
+    """
 
-    def do_POST(self):
-        self.log_request()
+    def __init__(self, path: Path):
+        self.path = path
+        self.lock = threading.Lock()
+        self.changes: list[tuple[int, str, int]] = []  # (version, "add" or "remove", serial)
+        self.version = 0
+        self.deltas: dict[tuple[int, int], tuple[list[int], list[int]]] = {}
+        if path.exists():
+            self.changes = [tuple(change) for change in json.loads(path.read_text())["changes"]]
+            self.version = max((change[0] for change in self.changes), default=0)
+
+    def enroll(self, add: list[int], remove: list[int]) -> int:
+        with self.lock:
+            self.version += 1
+            self.changes += [(self.version, "add", serial) for serial in add]
+            self.changes += [(self.version, "remove", serial) for serial in remove]
+            self.deltas.clear()
+            self.path.write_text(json.dumps({"changes": self.changes}))
+            return self.version
+
+    def delta(self, since: int, to: int) -> tuple[bool, list[int], list[int]]:
+        """
+        The serials added and removed going from version `since` to `to`, both sorted.
+        A device ahead of the server (the log was reset) gets the whole roster, flagged `full`.
+        """
+        with self.lock:
+            full = since > self.version
+            since = 0 if full else since
+            key = (since, to)
+            if key not in self.deltas:
+                before: dict[int, bool] = {}
+                after: dict[int, bool] = {}
+                for version, op, serial in self.changes:
+                    if version <= since:
+                        before[serial] = op == "add"
+                    if version <= to:
+                        after[serial] = op == "add"
+                add = sorted(s for s, enrolled in after.items() if enrolled and not before.get(s, False))
+                remove = sorted(s for s, enrolled in after.items() if not enrolled and before.get(s, False))
+                self.deltas[key] = (add, remove)
+            add, remove = self.deltas[key]
+            return full, add, remove
+
+
+roster = Roster(module_path.parent.joinpath("roster.json"))
+
+
+class ImageStore:
+    """
+    The received images, under `<folder>/<day of the scan>/<filename>`, indexed in `<folder>/index.db` by serial and
+    scan time. A retried upload replaces the record of its first attempt.
+    """
 
-        # common across all paths
+    def __init__(self, folder: Path):
+        folder.mkdir(parents=True, exist_ok=True)
+        self.folder = folder
+        self.lock = threading.Lock()
+        self.db = sqlite3.connect(folder.joinpath("index.db"), check_same_thread=False)
+        self.db.execute("PRAGMA journal_mode=WAL")
+        self.db.execute("PRAGMA synchronous=NORMAL")  # the images are on disk either way, a lost record is re-uploaded
+        self.db.execute(
+            """CREATE TABLE IF NOT EXISTS images (
+                id INTEGER PRIMARY KEY,
+                serial INTEGER NOT NULL,
+                scan_time INTEGER,
+                device_id TEXT NOT NULL,
+                received_at REAL NOT NULL,
+                path TEXT,
+                bytes INTEGER NOT NULL,
+                sha256 TEXT NOT NULL
+            )"""
+        )
+        self.db.execute("CREATE UNIQUE INDEX IF NOT EXISTS images_scan ON images (serial, scan_time, device_id)")
+        self.db.execute("CREATE INDEX IF NOT EXISTS images_scan_time ON images (scan_time)")
+        self.db.commit()
+
+    def begin(self, serial: int, scan_time: str, device_id: str, filename: str) -> "ReceivedImage":
+        return ReceivedImage(self, serial, int(scan_time) if scan_time.isdigit() else None, device_id, filename)
+
+    def add(self, image: "ReceivedImage"):
+        with self.lock:
+            self.db.execute(
+                "INSERT OR REPLACE INTO images (serial, scan_time, device_id, received_at, path, bytes, sha256) "
+                "VALUES (?, ?, ?, ?, ?, ?, ?)",
+                (
+                    image.serial,
+                    image.scan_time,
+                    image.device_id,
+                    time.time(),
+                    str(image.path) if image.path else None,
+                    image.length,
+                    image.sha256.hexdigest(),
+                ),
+            )
+            self.db.commit()
 
-        images: list[np.ndarray[np.uint8]] = []
-        response = 400
-        response_msg = ""
 
-        rfid_serial_number = int(
-            self.headers.get("rfid-serial-number", 0)
-        )  # set rfid to 0 if fail
-        content_type = self.headers.get("Content-Type").__str__()
+class ReceivedImage:
+    """
+    One image written to a `.part` file while it is received, moved into place by `finish()`.
+    An empty image (kept on the device's spill flash without it) only gets its record.
+    """
 
-        if rfid_serial_number == 0:
-            response = 417
-            response_msg = f"Expected key `rfid-serial-number` in the header"
-        elif (
-            "image/jpeg" in self.headers.get("Content-Type")
-            and "Content-Length" in self.headers
-        ):
-            data = self.rfile.read(int(self.headers["Content-Length"]))
-            if LOG_RECEIVED_DATA:
-                self.log_message(f"Trying to decode the image.")
-            np_arr = np.frombuffer(data, np.uint8)
-            images.append(cv2.imdecode(np_arr, cv2.IMREAD_UNCHANGED))
+    def __init__(self, store: ImageStore, serial: int, scan_time: Optional[int], device_id: str, filename: str):
+        self.store = store
+        self.serial = serial
+        self.scan_time = scan_time
+        self.device_id = device_id
+        self.name = filename
+        self.length = 0
+        self.sha256 = hashlib.sha256()
+
+        day = time.strftime("%Y%m%d", time.gmtime(scan_time / 1000 if scan_time else time.time()))
+        self.path: Optional[Path] = store.folder.joinpath(day, filename)
+        self.path.parent.mkdir(exist_ok=True)
+        self.partial = self.path.with_name(f"{filename}.{threading.get_ident()}.part")
+        self.file = open(self.partial, "wb")
+
+    def write(self, data: bytes):
+        self.file.write(data)
+        self.sha256.update(data)
+        self.length += len(data)
+
+    def discard(self):
+        self.file.close()
+        self.partial.unlink()
+
+    def finish(self) -> "ReceivedImage":
+        self.file.close()
+        if self.length == 0:
+            self.partial.unlink()
+            self.path = None
+        else:
+            os.replace(self.partial, self.path)
+        self.store.add(self)
+        return self
 
-            response = 200
 
-            # respond with received file size and serial number
-            response_msg = f"Got image for rfid tag {rfid_serial_number}"
-        elif content_type.find("multipart/form-data") > -1:
-            response = 200
-            if LOG_RECEIVED_DATA:
-                self.log_message(f"Response {response}")
-
-            # extract boundary from headers
-            boundary = re.search(
-                f"boundary=([^;]+)", self.headers["Content-Type"]
-            ).group(1)
-
-            # handling post requests sent all at once
-            if "Content-Length" in self.headers:
-                # read all bytes (headers included)
-                # 'readlines()' hangs the script because it needs the EOF character to stop,
-                # even if you specify how many bytes to read
-                # 'file.read(nbytes).splitlines(True)' does the trick because 'read()' reads 'nbytes' bytes
-                # and 'splitlines(True)' splits the file into lines and retains the newline character
-                data = self.rfile.read(int(self.headers["Content-Length"])).splitlines(
-                    True
+class Stats:
+    """
+    Counters of the requests served, for `GET /stats`.
+    """
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.started = time.monotonic()
+        self.requests = 0
+        self.images = 0
+        self.image_bytes = 0
+        self.statuses: Counter[int] = Counter()
+        self.paths: Counter[str] = Counter()
+        self.recent: deque[tuple[float, float]] = deque(maxlen=STATS_LATENCY_WINDOW)  # (finished, latency)
+        self.in_flight = 0
+
+    def begin(self):
+        with self.lock:
+            self.in_flight += 1
+
+    def finish(self, path: str, status: int, started: float, responded: float, images: int, image_bytes: int):
+        now = time.monotonic()
+        with self.lock:
+            self.in_flight -= 1
+            self.requests += 1
+            self.images += images
+            self.image_bytes += image_bytes
+            self.statuses[status] += 1
+            self.paths[path] += 1
+            self.recent.append((now, responded - started))
+
+    def snapshot(self) -> dict:
+        now = time.monotonic()
+        with self.lock:
+            latencies = sorted(latency for finished, latency in self.recent)
+            window = min(STATS_RATE_WINDOW_S, now - self.started)
+            in_window = sum(1 for finished, latency in self.recent if finished >= now - window)
+            snapshot = {
+                "uptime_s": round(now - self.started, 1),
+                "requests": self.requests,
+                "in_flight": self.in_flight,
+                "images": self.images,
+                "image_bytes": self.image_bytes,
+                "requests_per_s": round(in_window / window, 2) if window > 0 else 0,
+                "statuses": {str(status): count for status, count in self.statuses.items()},
+                "paths": dict(self.paths),
+                "latency_ms": {},
+            }
+        if latencies:
+            snapshot["latency_ms"] = {
+                name: round(latencies[min(len(latencies) - 1, len(latencies) * percent // 100)] * 1000, 2)
+                for name, percent in (("p50", 50), ("p95", 95), ("p99", 99))
+            }
+            snapshot["latency_ms"]["max"] = round(latencies[-1] * 1000, 2)
+        return snapshot
+
+
+stats = Stats()
+images: ImageStore = None  # opened in main, see --data-dir
+display_lock = threading.Lock()  # one window at a time, whichever request it came with
+
+
+class BodyReader:
+    """
+    The body of a request, sent with a Content-Length or chunked.
+    """
+
+    def __init__(self, rfile, headers):
+        self.rfile = rfile
+        self.chunked = "chunked" in headers.get("Transfer-Encoding", "")
+        self.left = 0 if self.chunked else int(headers.get("Content-Length", 0))
+        self.done = False
+
+    def read(self, size: int) -> bytes:
+        """
+        Up to `size` bytes, b"" at the end of the body.
+        """
+        if self.chunked and self.left == 0 and not self.done:
+            line = self.rfile.readline().strip()  # in the form <length-hex>[;extension]\r\n
+            self.left = int(line.split(b";")[0], 16) if line else 0
+            if self.left == 0:
+                # the trailers, up to an empty line
+                while self.rfile.readline().strip():
+                    pass
+                self.done = True
+
+        if self.left == 0:
+            return b""
+
+        data = self.rfile.read(min(size, self.left))
+        if not data:
+            raise ConnectionError("the body ended early")
+        self.left -= len(data)
+
+        # every chunk is followed by a line break
+        if self.chunked and self.left == 0:
+            self.rfile.readline()
+
+        return data
+
+
+def parse_part_headers(block: bytes) -> dict[str, str]:
+    """
+    The headers of a multipart part, the names lower cased and the filename of the content disposition added as
+    `filename`.
+    """
+    headers = {}
+    for line in block.decode(errors="replace").split("\r\n"):
+        name, colon, value = line.partition(":")
+        if colon:
+            headers[name.strip().lower()] = value.strip()
+
+    filename = re.search(r'filename="(.+?)"', headers.get("content-disposition", ""))
+    if filename is not None:
+        headers["filename"] = filename.group(1)
+
+    return headers
+
+
+def stream_multipart(reader: BodyReader, boundary: str, open_part) -> Optional[list]:
+    """
+    Splits a multipart/form-data body into its parts while it is read, so a body never has to fit into memory and
+    every byte is only looked at about once.
+    `open_part(headers)` is called for every part with a filename, see `parse_part_headers()`. The content of the part
+    is written to what it returns, which is `finish()`ed at the end of the part, or `discard()`ed if the body breaks off.
+
+    :return: what `finish()` returned for every part, None if the body isn't multipart with that boundary
+    """
+    # the line break before a delimiter belongs to it, the first one may come without
+    delimiter = b"\r\n--" + boundary.encode()
+    keep = len(delimiter) - 1  # what could be the start of a delimiter split across reads
+    buffer = bytearray(b"\r\n")
+    in_headers = False
+    part = None
+    parts = []
+
+    while True:
+        if in_headers:
+            if buffer.startswith(b"--"):
+                # the closing delimiter, what follows is the epilogue
+                while reader.read(READ_SIZE):
+                    pass
+                return parts
+
+            header_end = buffer.find(b"\r\n\r\n")
+            if header_end >= 0:
+                headers = parse_part_headers(bytes(buffer[:header_end]))
+                del buffer[: header_end + 4]
+                part = open_part(headers) if "filename" in headers else None
+                in_headers = False
+                continue
+            if len(buffer) > MAX_PART_HEADER_SIZE:
+                return None
+        else:
+            at = buffer.find(delimiter)
+            if at >= 0:
+                if part is not None:
+                    part.write(bytes(buffer[:at]))
+                    parts.append(part.finish())
+                    part = None
+                del buffer[: at + len(delimiter)]
+                in_headers = True
+                continue
+
+            # the preamble or the content of a part, all but what could start a delimiter
+            if len(buffer) > keep:
+                if part is not None:
+                    part.write(bytes(buffer[: len(buffer) - keep]))
+                del buffer[: len(buffer) - keep]
+
+        try:
+            data = reader.read(READ_SIZE)
+        except ConnectionError:
+            if part is not None:
+                part.discard()
+            raise
+        if not data:
+            if part is not None:
+                part.discard()
+            return None
+        buffer += data
+
+
+
+class MyHandler(BaseHTTPRequestHandler):
+    # keeping the connection open between uploads, every response must carry a Content-Length
+    protocol_version = "HTTP/1.1"
+    # the response headers and body are written separately, delayed acks would hold the body back for ~40ms
+    disable_nagle_algorithm = True
+
+    def handle_one_request(self):
+        self.started = None
+        self.status = 0  # a request broken off before its response is counted with status 0
+        self.responded = None
+        self.image_count = 0
+        self.image_bytes = 0
+        try:
+            super().handle_one_request()
+        finally:
+            if self.started is not None:
+                stats.finish(
+                    urlsplit(self.path).path,
+                    self.status,
+                    self.started,
+                    self.responded or time.monotonic(),
+                    self.image_count,
+                    self.image_bytes,
                 )
-            # handling post request sent in chunks
-            elif "chunked" in self.headers.get("Transfer-Encoding", ""):
-                # the chunk buffer
-                data = "".encode()
-                while True:
-                    line = self.rfile.readline()
-                    if LOG_RECEIVED_DATA:
-                        self.log_message(str(line))
-                    line = line.strip().strip()  # in the form <length-hex>\r\n
-
-                    # skip if only line endings are provided
-                    if len(line) == 0:
-                        continue
-
-                    chunk_length = int(line, 16)  # in the hexadecimal format
-
-                    if chunk_length != 0:
-                        chunk = self.rfile.read(chunk_length)
-                        # print(str(chunk))  # logging causes error
-                        data += chunk
-
-                    # Each chunk is followed by an additional empty newline
-                    # that we have to consume.
-                    if LOG_RECEIVED_DATA:
-                        self.log_message(str(self.rfile.readline()))
-                    else:
-                        self.rfile.readline()
-
-                    # Finally, a chunk size of 0 is an end indication
-                    if chunk_length == 0:
-                        break
-                data = data.splitlines(True)
 
-            if LOG_RECEIVED_DATA:
-                self.log_message("Received data: \n %s", data)
-            # find all filenames
-            filenames = re.findall(f'{boundary}.+?filename="(.+?)"', str(data))
+    def begin_request(self):
+        self.started = time.monotonic()
+        stats.begin()
+        if not QUIET:
+            self.log_request()
+
+    def log_message(self, format, *args):
+        if not QUIET:
+            super().log_message(format, *args)
 
-            if not filenames:
-                return False, "couldn't find file name(s)."
+    def send_body(self, response: int, body: bytes, headers: dict[str, str] = {}):
+        self.send_response(response)
+        for name, value in headers.items():
+            self.send_header(name, value)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+        self.status = response
+        self.responded = time.monotonic()
 
-            filenames = [sanitize_filename(filename) for filename in filenames]
+    def do_GET(self):
+        self.begin_request()
 
-            # find all boundary occurrences in data
-            boundary_indices = list(
-                (i for i, line in enumerate(data) if re.search(boundary, str(line)))
+        path = urlsplit(self.path).path
+        if path == "/roster":
+            return self.handle_roster_get()
+
+        if path == "/stats":
+            return self.send_body(
+                200, json.dumps(stats.snapshot()).encode(), {"Content-Type": "application/json"}
             )
 
-            # append images
-            for i in range(len(filenames)):
-                # remove file headers
-                file_data = data[(boundary_indices[i] + 3) : boundary_indices[i + 1]]
+        body = bytes("Hello to Esp32 from server.", "utf-8")
+        # send 200 response with our own custom header
+        self.send_body(200, body, {"mock_header_key": "mock_header_value"})
 
-                # join list of bytes into bytestring
-                file_data = b"".join(file_data)
+    def do_POST(self):
+        self.begin_request()
 
-                if LOG_RECEIVED_DATA:
-                    self.log_message(f"Trying to decode the image.")
-                np_arr = np.frombuffer(file_data, np.uint8)
-                images.append(cv2.imdecode(np_arr, cv2.IMREAD_UNCHANGED))
+        if self.path == "/trace":
+            return self.handle_trace()
 
-                # respond with received file size and serial number
-                response_msg = f"Got image for rfid tag {rfid_serial_number}"
+        if self.path == "/roster":
+            return self.handle_roster_post()
 
-        else:
-            response = 415
-            response_msg = f"Unsupported meadia type {content_type}, expected image/jpeg along with Content-Length or multipart/form-data"
+        # common across all paths
+
+        # the cpu time spent on the request, to compare the upload modes of the device
+        cpu_start = time.thread_time()
+        stored: list[ReceivedImage] = []
+        response = 400
+        response_msg = ""
+
+        rfid_serial_number = int(
+            self.headers.get("rfid-serial-number", 0)
+        )  # set rfid to 0 if fail
+        content_type = self.headers.get("Content-Type").__str__()
+        device_id = self.headers.get("device-id", "")
+
+        try:
+            if rfid_serial_number == 0:
+                response = 417
+                response_msg = f"Expected key `rfid-serial-number` in the header"
+                self.close_connection = True  # the body wasn't read
+            elif "image/jpeg" in content_type and not SCAN_TIME_PATTERN.fullmatch(self.headers.get("scan-time", "")):
+                # it goes into the file name, so it is checked before any path is built
+                response_msg = f"Expected key `scan-time` in the header, in ms since the epoch"
+                self.close_connection = True  # the body wasn't read
+            elif "image/jpeg" in content_type and "Content-Length" in self.headers:
+                # the raw upload mode of the device, the metadata is in the headers
+                scan_time = self.headers["scan-time"]
+                image = images.begin(rfid_serial_number, scan_time, device_id, f"{rfid_serial_number}_{scan_time}.jpg")
+                reader = BodyReader(self.rfile, self.headers)
+                try:
+                    while data := reader.read(READ_SIZE):
+                        image.write(data)
+                except ConnectionError:
+                    image.discard()
+                    raise
+
+                digest = self.headers.get("content-sha256")
+                if digest is not None and image.sha256.hexdigest() != digest.lower():
+                    image.discard()
+                    response = 400
+                    response_msg = "content-sha256 doesn't match the body"
+                else:
+                    stored.append(image.finish())
+                    self.log_message(
+                        f"Got {image.length} bytes from device {device_id or '?'} "
+                        f"for rfid tag {rfid_serial_number}, scanned at {scan_time}"
+                    )
+                    response = 200
+
+                    # respond with received file size and serial number
+                    response_msg = f"Got image for rfid tag {rfid_serial_number}"
+            elif content_type.find("multipart/form-data") > -1:
+                # extract boundary from headers
+                boundary = re.search(f"boundary=([^;]+)", content_type).group(1)
+
+                def open_part(headers: dict[str, str]) -> ReceivedImage:
+                    # every part carries its own serial and scan time, older firmware only sets the request header
+                    return images.begin(
+                        int(headers.get("rfid-serial-number", rfid_serial_number)),
+                        headers.get("scan-time", ""),
+                        device_id,
+                        sanitize_filename(headers["filename"]),
+                    )
+
+                # sent with a Content-Length or in chunks, the parts are written to disk as they come in
+                parts = stream_multipart(BodyReader(self.rfile, self.headers), boundary, open_part)
+                if parts is None:
+                    response_msg = "malformed multipart body"
+                    self.close_connection = True  # where the body ends is unknown
+                elif not parts:
+                    response_msg = "couldn't find file name(s)."
+                else:
+                    # the device batches several captures in one request
+                    for image in parts:
+                        self.log_message(
+                            f"Got {image.name} ({image.length} bytes) for rfid tag {image.serial}, "
+                            f"scanned at {image.scan_time}"
+                        )
+                        if image.length == 0:
+                            # kept on the device's spill flash without its image
+                            self.log_message(f"Attendance only for rfid tag {image.serial}")
+                    stored = parts
+                    response = 200
+
+                    # respond with the number of images and serial numbers received
+                    response_msg = f"Got {len(parts)} image(s)"
+            else:
+                response = 415
+                self.close_connection = True  # the body wasn't read
+                response_msg = f"Unsupported meadia type {content_type}, expected image/jpeg along with Content-Length or multipart/form-data"
+        except (ConnectionError, ValueError) as e:
+            # broken off or malformed framing, there is no telling where the next request starts
+            self.log_message(f"Dropping the connection: {e}")
+            self.close_connection = True
+            return
+
+        self.image_count = sum(1 for image in stored if image.length > 0)
+        self.image_bytes = sum(image.length for image in stored)
 
         if LOG_RECEIVED_DATA:
             self.log_message(f"Response {response}")
-        self.send_response(response)
-        self.end_headers()
-        self.wfile.write(response_msg.encode())
+        self.send_body(response, response_msg.encode())
+        self.log_message(
+            f"{content_type.split(';')[0]} request took {(time.thread_time() - cpu_start) * 1000:.2f} ms cpu"
+        )
+
+        if HEADLESS:
+            return
 
-        if len(images) > 0:
-            for i, image in enumerate(images):
-                display_image_and_wait(image, f"{rfid_serial_number}_{i}")
+        for image in stored:
+            if image.path is None:
+                continue
+            if LOG_RECEIVED_DATA:
+                self.log_message(f"Trying to decode the image.")
+            with display_lock:
+                display_image_and_wait(image.path)
+
+    def handle_trace(self):
+        """
+        Logs the per stage scan latencies posted by `trace_post_json()`
+        """
+        data = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        try:
+            trace = json.loads(data)
+        except ValueError:
+            return self.send_body(400, b"expected json")
+
+        self.log_message(f"Scan trace over the last {trace.get('stamps', 0)} stamps (us)")
+        for stage in trace.get("stages", []):
+            since_scan = stage["since_scan_us"]
+            since_previous = stage["since_previous_us"]
+            self.log_message(
+                f"{stage['stage']:<16} {stage['count']:>6} | "
+                f"{since_scan['p50']:>10} {since_scan['p95']:>10} {since_scan['p99']:>10} | "
+                f"{since_previous['p50']:>10} {since_previous['p95']:>10} {since_previous['p99']:>10}"
+            )
+
+        self.send_body(200, b"")
+
+
+    def handle_roster_get(self):
+        """
+        The net roster changes since the device's version, a page at a time:
+        `GET /roster?since=<version>[&to=<version>&offset=<n>&limit=<n>]`
+        The first page tells the version it leads `to`, the device pins it for the following pages.
+        Serials are sent as strings, they don't all fit into a double.
+        """
+        query = parse_qs(urlsplit(self.path).query)
+        try:
+            since = int(query.get("since", ["0"])[0])
+            to = int(query.get("to", [str(roster.version)])[0])
+            offset = int(query.get("offset", ["0"])[0])
+            limit = min(int(query.get("limit", [str(ROSTER_PAGE_LIMIT)])[0]), ROSTER_PAGE_LIMIT)
+        except ValueError:
+            return self.send_body(400, b"expected integer query parameters")
+        to = min(to, roster.version)
+
+        full, add, remove = roster.delta(since, to)
+        changes = [("add", serial) for serial in add] + [("remove", serial) for serial in remove]
+        page = changes[offset : offset + limit]
+
+        body = json.dumps(
+            {
+                "version": to,
+                "full": full,
+                "total": len(changes),
+                "add": [str(serial) for op, serial in page if op == "add"],
+                "remove": [str(serial) for op, serial in page if op == "remove"],
+            }
+        )
+        self.log_message(f"Roster {since} -> {to}: {len(page)} of {len(changes)} changes from {offset}")
+        self.send_body(200, body.encode())
+
+    def handle_roster_post(self):
+        """
+        Enrolls and removes cards as one new roster version:
+        `curl -d '{"add": [911101686122], "remove": []}' http://<server>:8000/roster`
+        """
+        data = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        try:
+            request = json.loads(data)
+            add = [int(serial) for serial in request.get("add", [])]
+            remove = [int(serial) for serial in request.get("remove", [])]
+        except (ValueError, TypeError, AttributeError):
+            return self.send_body(400, b"expected json with `add` and `remove` lists of serials")
+
+        version = roster.enroll(add, remove)
+        self.log_message(f"Roster version {version}: {len(add)} added, {len(remove)} removed")
+        self.send_body(200, json.dumps({"version": version}).encode())
+
+
+class IngestionServer(ThreadingHTTPServer):
+    # dozens of readers connect at once after an outage (or a load test), the default backlog of 5 drops connects
+    request_queue_size = 128
 
 
 def get_ip():
@@ -221,16 +688,19 @@ def set_server_address(file, address):
     print(msg)
 
 
-def display_image_and_wait(img: np.ndarray, img_name: str):
+def display_image_and_wait(path: Path):
     """
-    Displays image waits for `n` or `q` key presses. \n
+    Displays the image at `path` and waits for `n` or `q` key presses. \n
     n => close the current window \n
     q => close all the windows \n
 
-    Parameters
-    ---------
-    img_name: The window name
+    numpy and opencv are only imported here, so --headless runs without them.
     """
+    import numpy as np
+    import cv2
+
+    img = cv2.imdecode(np.fromfile(path, np.uint8), cv2.IMREAD_UNCHANGED)
+    img_name = path.stem
     while True:
         cv2.imshow(img_name, img)
 
@@ -251,17 +721,40 @@ if __name__ == "__main__":
     Log the local ip.
     """
 
+    parser = argparse.ArgumentParser(description="Receives the uploads of the attendance readers.")
+    parser.add_argument("--port", type=int, default=8000)
+    parser.add_argument(
+        "--headless",
+        action="store_true",
+        help="only store the received images, for load tests and as a stand in for production",
+    )
+    parser.add_argument("--quiet", action="store_true", help="no log line per request, see GET /stats instead")
+    parser.add_argument(
+        "--data-dir",
+        type=Path,
+        default=module_path.parent.joinpath("received"),
+        help="where the images and their index (index.db) are kept",
+    )
+    args = parser.parse_args()
+    HEADLESS = args.headless
+    QUIET = args.quiet
+    images = ImageStore(args.data_dir)
+
     address = get_ip()
-    port = 8000
+    port = args.port
     header_filename = "globals.h"
 
     # replacing the address in globals.h
     set_server_address(
         include_folder.joinpath(header_filename).resolve(), f"{address}:{port}"
     )
-    print(f"Opening http server on {address}:{port}")
-    httpd = HTTPServer(("0.0.0.0", port), MyHandler)
+    print(f"Opening http server on {address}:{port}, images go to {args.data_dir}")
+    # a thread per connection, so one slow reader (or an image on screen) doesn't hold up the others
+    httpd = IngestionServer(("0.0.0.0", port), MyHandler)
     httpd.serve_forever()
 
     # cleanup
-    cv2.destroyAllWindows()
+    if not HEADLESS:
+        import cv2
+
+        cv2.destroyAllWindows()
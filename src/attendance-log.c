@@ -0,0 +1,260 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include "sys/stat.h"
+#include "sys/time.h"
+#include "unistd.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_rom_crc.h"
+#include "esp_log.h"
+#include "esp_err.h"
+
+// local includes
+
+#include "globals.h"
+#include "attendance-log.h"
+
+// --------------
+
+_Static_assert(sizeof(attendance_log_header_t) == 24, "the log format is fixed");
+_Static_assert(sizeof(attendance_record_t) == 40, "the log format is fixed");
+
+static SemaphoreHandle_t log_lock = NULL; // guards the batch, the file is only written by the log task
+static TaskHandle_t log_task_handle = NULL;
+static FILE *log_file = NULL;
+static long log_length = 0; // where the last whole record ends, a batch written only in part is cut back to it
+static bool log_torn = false; // cutting the part of a batch back failed, no batch is written until it is done
+
+static attendance_record_t batch[ATTENDANCE_LOG_BUFFER_SIZE];
+static attendance_record_t writing[ATTENDANCE_LOG_BUFFER_SIZE]; // the batch being written, so scans aren't held up
+static size_t batch_count = 0;
+static uint32_t dropped_records = 0;
+
+static uint32_t header_crc(const attendance_log_header_t *header)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)header, offsetof(attendance_log_header_t, crc));
+}
+
+static bool read_header(FILE *f)
+{
+    attendance_log_header_t header;
+
+    return 0 == fseek(f, 0, SEEK_SET) && 1 == fread(&header, sizeof(header), 1, f) &&
+           header.magic == ATTENDANCE_LOG_MAGIC && header.version == ATTENDANCE_LOG_VERSION &&
+           header.record_size == sizeof(attendance_record_t) && header.crc == header_crc(&header);
+}
+
+static esp_err_t create_log()
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    attendance_log_header_t header = {
+        .magic = ATTENDANCE_LOG_MAGIC,
+        .version = ATTENDANCE_LOG_VERSION,
+        .record_size = sizeof(attendance_record_t),
+        .created_ms = (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000,
+    };
+    header.crc = header_crc(&header);
+
+    FILE *f = fopen(ATTENDANCE_LOG_PATH, "wb");
+    if (f == NULL)
+    {
+        return ESP_FAIL;
+    }
+
+    bool written = 1 == fwrite(&header, sizeof(header), 1, f) && 0 == fflush(f);
+    fsync(fileno(f));
+    fclose(f);
+
+    return written ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t attendance_log_init()
+{
+    struct stat st;
+
+    if (0 == stat(ATTENDANCE_LOG_PATH, &st))
+    {
+        FILE *f = fopen(ATTENDANCE_LOG_PATH, "r+b");
+        if (f == NULL || !read_header(f))
+        {
+            // keeping what is there for whoever wants to look at it, a new log is started next to it
+            ESP_LOGE(TAG, "The attendance log " ATTENDANCE_LOG_PATH " isn't one, moving it aside.");
+            if (f != NULL)
+            {
+                fclose(f);
+            }
+            unlink(ATTENDANCE_LOG_PATH ".bad");
+            rename(ATTENDANCE_LOG_PATH, ATTENDANCE_LOG_PATH ".bad");
+        }
+        else
+        {
+            size_t records = (st.st_size - sizeof(attendance_log_header_t)) / sizeof(attendance_record_t);
+            off_t length = sizeof(attendance_log_header_t) + records * sizeof(attendance_record_t);
+            if (length != st.st_size)
+            {
+                ESP_LOGW(TAG, "Cutting a torn record off the attendance log.");
+                ftruncate(fileno(f), length);
+            }
+            fclose(f);
+            ESP_LOGI(TAG, "Attendance log: %zu records", records);
+        }
+    }
+
+    if (0 != stat(ATTENDANCE_LOG_PATH, &st) && ESP_OK != create_log())
+    {
+        ESP_LOGE(TAG, "Couldn't create the attendance log " ATTENDANCE_LOG_PATH);
+        return ESP_FAIL;
+    }
+
+    log_file = fopen(ATTENDANCE_LOG_PATH, "ab");
+    if (log_file == NULL || 0 != fseek(log_file, 0, SEEK_END) || 0 > (log_length = ftell(log_file)))
+    {
+        return ESP_FAIL;
+    }
+
+    if (NULL == (log_lock = xSemaphoreCreateMutex()))
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (pdPASS != xTaskCreate(attendance_log_task,
+                              "Attendance_Log_Task",
+                              TASK_ATTENDANCE_LOG_STACK_SIZE,
+                              NULL,
+                              ATTENDANCE_LOG_TASK_PRIORITY,
+                              &log_task_handle))
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t attendance_log_record(const rfid_a_s_event_data_t *scan, attendance_outcome_t outcome, uint32_t image_length)
+{
+    if (log_lock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    attendance_record_t record = {
+        .serial_number = scan->tag.serial_number,
+        .wall_time_ms = scan->scan_wall_time_ms,
+        .monotonic_us = scan->scan_time_us,
+        .scan_id = scan->scan_id,
+        .outcome = outcome,
+        .image_length = image_length,
+    };
+    record.crc = esp_rom_crc32_le(0, (const uint8_t *)&record, offsetof(attendance_record_t, crc));
+
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(log_lock, portMAX_DELAY);
+    if (batch_count < ATTENDANCE_LOG_BUFFER_SIZE)
+    {
+        batch[batch_count++] = record;
+    }
+    else
+    {
+        // the log task has been stuck on the card for a while
+        dropped_records++;
+        ret = ESP_ERR_NO_MEM;
+    }
+    bool full = batch_count == ATTENDANCE_LOG_BATCH_SIZE;
+    xSemaphoreGive(log_lock);
+
+    if (full)
+    {
+        xTaskNotifyGive(log_task_handle);
+    }
+
+    return ret;
+}
+
+/**
+ * Cuts what a failed write left of a batch off the log, records appended after a partial one would all be misaligned.
+ * The file is closed first, so none of the batch is left in its buffer to be written later.
+ */
+static esp_err_t cut_torn_batch()
+{
+    if (log_file != NULL)
+    {
+        fclose(log_file);
+        log_file = NULL;
+    }
+
+    FILE *f = fopen(ATTENDANCE_LOG_PATH, "r+b");
+    log_torn = f == NULL || 0 != ftruncate(fileno(f), log_length);
+    if (f != NULL)
+    {
+        fsync(fileno(f));
+        fclose(f);
+    }
+
+    log_file = fopen(ATTENDANCE_LOG_PATH, "ab");
+    if (log_torn || log_file == NULL)
+    {
+        ESP_LOGE(TAG, "Couldn't cut a torn batch off the attendance log, trying again with the next one.");
+        log_torn = true;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t flush_batch()
+{
+    xSemaphoreTake(log_lock, portMAX_DELAY);
+    size_t count = batch_count;
+    memcpy(writing, batch, count * sizeof(attendance_record_t));
+    batch_count = 0;
+    uint32_t dropped = dropped_records;
+    dropped_records = 0;
+    xSemaphoreGive(log_lock);
+
+    if (dropped > 0)
+    {
+        ESP_LOGE(TAG, "%" PRIu32 " attendance records were dropped, the log couldn't keep up.", dropped);
+    }
+
+    if (count == 0)
+    {
+        return ESP_OK;
+    }
+
+    if (log_torn && ESP_OK != cut_torn_batch())
+    {
+        ESP_LOGE(TAG, "%zu attendance records were dropped, the log is torn.", count);
+        return ESP_FAIL;
+    }
+
+    if (count != fwrite(writing, sizeof(attendance_record_t), count, log_file) || 0 != fflush(log_file))
+    {
+        ESP_LOGE(TAG, "Couldn't write %zu records to the attendance log.", count);
+        cut_torn_batch();
+        return ESP_FAIL;
+    }
+    fsync(fileno(log_file));
+    log_length += count * sizeof(attendance_record_t);
+
+    return ESP_OK;
+}
+
+void attendance_log_task(void *args)
+{
+    while (1)
+    {
+        // woken early by a full batch
+        ulTaskNotifyTake(pdTRUE, ATTENDANCE_LOG_FLUSH_INTERVAL_MS / portTICK_PERIOD_MS);
+
+        flush_batch();
+    }
+
+    vTaskDelete(NULL);
+}
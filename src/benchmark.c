@@ -0,0 +1,448 @@
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "sys/stat.h"
+#include "unistd.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_heap_caps.h"
+#include "esp_camera.h"
+#include "esp_event.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_err.h"
+
+// local includes
+
+#include "globals.h"
+#include "benchmark.h"
+#include "camera.h"
+#include "events.h"
+#include "frame-pool.h"
+#include "frame-quality.h"
+#include "sd-card.h"
+#include "sd-writer.h"
+#include "multipart.h"
+#include "roster.h"
+
+// --------------
+
+#define BENCHMARK_FILE_PATH BENCHMARK_SCRATCH_FOLDER "/bench.bin"
+
+static void log_result(const char *name, int iterations, int64_t elapsed_us, size_t bytes_per_iteration)
+{
+    if (iterations <= 0 || elapsed_us <= 0)
+    {
+        ESP_LOGW(TAG, "benchmark %-24s: no result", name);
+        return;
+    }
+
+    double per_iteration_us = (double)elapsed_us / iterations;
+    double per_second = 1000000.0 / per_iteration_us;
+
+    if (bytes_per_iteration)
+    {
+        ESP_LOGI(TAG, "benchmark %-24s: %d x, %10.1f us each, %8.1f /s, %6.2f MB/s", name, iterations,
+                 per_iteration_us, per_second, per_second * bytes_per_iteration / (1024.0 * 1024.0));
+    }
+    else
+    {
+        ESP_LOGI(TAG, "benchmark %-24s: %d x, %10.1f us each, %8.1f /s", name, iterations, per_iteration_us, per_second);
+    }
+}
+
+typedef struct benchmark_sink_t
+{
+    uint8_t *buffer;
+    size_t used;
+} benchmark_sink_t;
+
+static int sink_write(void *context, const char *data, size_t length)
+{
+    benchmark_sink_t *sink = context;
+    memcpy(sink->buffer + sink->used, data, length);
+    sink->used += length;
+    return length;
+}
+
+/**
+ * The multipart body of an upload, with the transport replaced by a copy into a sink buffer.
+ */
+static void benchmark_multipart_encoding(const uint8_t *frame, size_t frame_length)
+{
+    static multipart_body_t body;
+    benchmark_sink_t sink = {
+        .buffer = heap_caps_malloc(frame_length + 1024, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT),
+    };
+    if (sink.buffer == NULL)
+    {
+        ESP_LOGE(TAG, "benchmark multipart_encoding: no memory for the sink");
+        return;
+    }
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++)
+    {
+        sink.used = 0;
+        multipart_body_init(&body);
+        multipart_body_add_jpeg(&body, 911101686122, 1700000000000, frame, frame_length);
+        multipart_body_finish(&body);
+        multipart_write_segments(body.segments, body.segment_count, sink_write, &sink);
+    }
+    log_result("multipart_encoding", BENCHMARK_ITERATIONS, esp_timer_get_time() - start, frame_length);
+
+    free(sink.buffer);
+}
+
+static void benchmark_frame_pool(const camera_fb_t *fb)
+{
+    int64_t start = esp_timer_get_time();
+    int filled = 0;
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++)
+    {
+        frame_slot_t *frame = frame_pool_fill(fb);
+        if (frame != NULL)
+        {
+            filled++;
+            frame_pool_release(frame);
+        }
+    }
+    log_result("frame_pool_fill", filled, esp_timer_get_time() - start, fb->len);
+}
+
+static void benchmark_frame_quality(const uint8_t *frame, size_t frame_length)
+{
+    frame_quality_t quality;
+    if (ESP_OK != frame_quality_score(frame, frame_length, &quality))
+    {
+        ESP_LOGW(TAG, "benchmark frame_quality_score: the frame couldn't be scored");
+        return;
+    }
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++)
+    {
+        frame_quality_score(frame, frame_length, &quality);
+    }
+    log_result("frame_quality_score", BENCHMARK_ITERATIONS, esp_timer_get_time() - start, frame_length);
+}
+
+static void benchmark_sd_write(const uint8_t *frame, size_t frame_length)
+{
+    // the raw cost of the card, for comparison with the save path below
+    int64_t start = esp_timer_get_time();
+    int64_t worst = 0;
+    int written = 0;
+    for (int i = 0; i < BENCHMARK_SD_ITERATIONS; i++)
+    {
+        int64_t iteration_start = esp_timer_get_time();
+        FILE *f = fopen(BENCHMARK_FILE_PATH, "w");
+        if (f == NULL)
+        {
+            ESP_LOGE(TAG, "benchmark sd_raw_write: couldn't open " BENCHMARK_FILE_PATH);
+            return;
+        }
+        if (frame_length == fwrite(frame, 1, frame_length, f))
+        {
+            written++;
+        }
+        fclose(f);
+        int64_t elapsed = esp_timer_get_time() - iteration_start;
+        worst = elapsed > worst ? elapsed : worst;
+    }
+    log_result("sd_raw_write", written, esp_timer_get_time() - start, frame_length);
+    ESP_LOGI(TAG, "benchmark %-24s: worst %" PRId64 " us", "sd_raw_write", worst);
+    unlink(BENCHMARK_FILE_PATH);
+
+    // new files in one directory like the image store gets them, but in the scratch folder so the store stays as it is
+    char path[IMAGE_FILEPATH_LENGTH];
+    start = esp_timer_get_time();
+    worst = 0;
+    int saved = 0;
+    for (int i = 0; i < BENCHMARK_SD_ITERATIONS; i++)
+    {
+        int64_t iteration_start = esp_timer_get_time();
+        snprintf(path, sizeof(path), BENCHMARK_SCRATCH_FOLDER "/%d_%" PRId64 ".jpg", i, iteration_start);
+        struct stat st;
+        if (0 != stat(path, &st) && ESP_OK == write_to_file_path(path, frame, frame_length))
+        {
+            saved++;
+        }
+        int64_t elapsed = esp_timer_get_time() - iteration_start;
+        worst = elapsed > worst ? elapsed : worst;
+    }
+    log_result("sd_image_files", BENCHMARK_SD_ITERATIONS, esp_timer_get_time() - start, frame_length);
+    ESP_LOGI(TAG, "benchmark %-24s: worst %" PRId64 " us, %d of %d saved", "sd_image_files", worst, saved, BENCHMARK_SD_ITERATIONS);
+}
+
+/**
+ * Appending frames to one preallocated file, the way the offline store does, with the buffer size and the number
+ * of records between syncs varied.
+ */
+static void benchmark_sd_writer_config(const uint8_t *frame, size_t frame_length, size_t buffer_size, int sync_interval)
+{
+    static const uint8_t header[32] = {0}; // stands in for the record header
+    char name[32];
+    sd_writer_t writer;
+
+    snprintf(name, sizeof(name), "sd_writer %zuK sync/%d", buffer_size / 1024, sync_interval);
+
+    FILE *f = fopen(BENCHMARK_FILE_PATH, "w+b");
+    if (f == NULL)
+    {
+        ESP_LOGE(TAG, "benchmark %s: couldn't open " BENCHMARK_FILE_PATH, name);
+        return;
+    }
+    if (ESP_OK != sd_writer_preallocate(f, BENCHMARK_SD_ITERATIONS * (frame_length + sizeof(header))) ||
+        ESP_OK != sd_writer_open(&writer, f, buffer_size))
+    {
+        ESP_LOGE(TAG, "benchmark %s: couldn't set up the file", name);
+        fclose(f);
+        unlink(BENCHMARK_FILE_PATH);
+        return;
+    }
+
+    int64_t start = esp_timer_get_time();
+    int64_t worst = 0;
+    int written = 0;
+    for (int i = 0; i < BENCHMARK_SD_ITERATIONS; i++)
+    {
+        int64_t iteration_start = esp_timer_get_time();
+        if (ESP_OK == sd_writer_write(&writer, header, sizeof(header)) &&
+            ESP_OK == sd_writer_write(&writer, frame, frame_length) &&
+            ((i + 1) % sync_interval != 0 || ESP_OK == sd_writer_flush(&writer, true)))
+        {
+            written++;
+        }
+        int64_t elapsed = esp_timer_get_time() - iteration_start;
+        worst = elapsed > worst ? elapsed : worst;
+    }
+    sd_writer_flush(&writer, true);
+    log_result(name, written, esp_timer_get_time() - start, frame_length + sizeof(header));
+    ESP_LOGI(TAG, "benchmark %-24s: worst append %" PRId64 " us, %" PRIu32 " writes (worst %" PRId64 " us), %" PRIu32 " syncs (worst %" PRId64 " us)",
+             name, worst, writer.stats.writes, writer.stats.worst_write_us, writer.stats.syncs, writer.stats.worst_sync_us);
+
+    sd_writer_close(&writer);
+    fclose(f);
+    unlink(BENCHMARK_FILE_PATH);
+}
+
+static void benchmark_sd_writer(const uint8_t *frame, size_t frame_length)
+{
+    // unbuffered is what the offline store did before the writer
+    benchmark_sd_writer_config(frame, frame_length, 0, 1);
+    for (size_t buffer_size = SD_WRITER_ALIGNMENT; buffer_size <= BENCHMARK_SD_WRITER_MAX_BUFFER; buffer_size *= 2)
+    {
+        benchmark_sd_writer_config(frame, frame_length, buffer_size, 1);
+    }
+    benchmark_sd_writer_config(frame, frame_length, SD_WRITER_BUFFER_SIZE, BENCHMARK_SD_WRITER_SYNC_INTERVAL);
+}
+
+/**
+ * Lookups in a roster of BENCHMARK_ROSTER_SIZE serials in PSRAM, half of them for cards that aren't on it.
+ */
+static void benchmark_roster_lookup()
+{
+    uint64_t *serials = heap_caps_malloc(BENCHMARK_ROSTER_SIZE * sizeof(uint64_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (serials == NULL)
+    {
+        ESP_LOGE(TAG, "benchmark roster_lookup: no memory for the roster");
+        return;
+    }
+
+    // spread out like the serials of a few batches of cards, the odd ones are never enrolled
+    for (uint32_t i = 0; i < BENCHMARK_ROSTER_SIZE; i++)
+    {
+        serials[i] = 911101686122ULL + (uint64_t)i * 2 * 7919;
+    }
+
+    int found = 0;
+    uint32_t pick = 1;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCHMARK_ROSTER_LOOKUPS; i++)
+    {
+        pick = pick * 1664525 + 1013904223;
+        uint64_t serial = serials[pick % BENCHMARK_ROSTER_SIZE] + (i & 1);
+        found += roster_contains(serials, BENCHMARK_ROSTER_SIZE, serial);
+    }
+    log_result("roster_lookup", BENCHMARK_ROSTER_LOOKUPS, esp_timer_get_time() - start, 0);
+
+    if (found != BENCHMARK_ROSTER_LOOKUPS / 2)
+    {
+        ESP_LOGE(TAG, "benchmark roster_lookup: %d of %d enrolled cards found", found, BENCHMARK_ROSTER_LOOKUPS / 2);
+    }
+
+    free(serials);
+}
+
+static void queue_consumer_task(void *args)
+{
+    QueueHandle_t queue = (QueueHandle_t)args;
+    rfid_a_s_event_data_t item;
+
+    for (int i = 0; i < BENCHMARK_QUEUE_ITEMS; i++)
+    {
+        xQueueReceive(queue, &item, portMAX_DELAY);
+    }
+
+    vTaskDelete(NULL);
+}
+
+/**
+ * Items of the same size as the ones going through `rfid_photo_queue`, with the consumer on the same priority
+ * as the register photo task.
+ */
+static void benchmark_photo_queue()
+{
+    QueueHandle_t queue = xQueueCreate(RFID_PHOTO_QUEUE_SIZE, sizeof(rfid_a_s_event_data_t));
+    rfid_a_s_event_data_t item = {
+        .tag.serial_number = 911101686122,
+    };
+
+    xTaskCreate(queue_consumer_task, "Bench_Queue", 2048, queue, REGISTER_PHOTO_TASK_PRIORITY, NULL);
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCHMARK_QUEUE_ITEMS; i++)
+    {
+        xQueueSend(queue, &item, portMAX_DELAY);
+    }
+    // waiting for the consumer to take the last items
+    while (uxQueueMessagesWaiting(queue) > 0)
+    {
+        vTaskDelay(1);
+    }
+    log_result("rfid_photo_queue", BENCHMARK_QUEUE_ITEMS, esp_timer_get_time() - start, 0);
+
+    vTaskDelay(10 / portTICK_PERIOD_MS); // letting the consumer delete itself
+    vQueueDelete(queue);
+}
+
+static volatile int events_received = 0;
+
+static void count_event(void *ptr, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    events_received++;
+}
+
+/**
+ * The same path a scan takes from `esp_event_post()` to its handler, on an event id nothing else listens to.
+ */
+static void benchmark_event_loop()
+{
+    rfid_a_s_event_data_t item = {
+        .tag.serial_number = 911101686122,
+    };
+
+    events_received = 0;
+    esp_event_handler_register(RFID_A_S_EVENTS, RFID_A_S_EVENT_NONE, count_event, NULL);
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < BENCHMARK_QUEUE_ITEMS; i++)
+    {
+        esp_event_post(RFID_A_S_EVENTS, RFID_A_S_EVENT_NONE, &item, sizeof(item), portMAX_DELAY);
+    }
+    while (events_received < BENCHMARK_QUEUE_ITEMS)
+    {
+        vTaskDelay(1);
+    }
+    log_result("rfid_a_s_events", BENCHMARK_QUEUE_ITEMS, esp_timer_get_time() - start, 0);
+
+    esp_event_handler_unregister(RFID_A_S_EVENTS, RFID_A_S_EVENT_NONE, count_event);
+}
+
+/**
+ * Removes everything the sdcard benchmarks wrote.
+ */
+static void remove_scratch_folder()
+{
+    char path[IMAGE_FILEPATH_LENGTH];
+    DIR *dir = opendir(BENCHMARK_SCRATCH_FOLDER);
+    if (dir != NULL)
+    {
+        struct dirent *entry;
+        while (NULL != (entry = readdir(dir)))
+        {
+            if (entry->d_name[0] == '.')
+            {
+                continue;
+            }
+            int length = snprintf(path, sizeof(path), BENCHMARK_SCRATCH_FOLDER "/%s", entry->d_name);
+            if (length < 0 || (size_t)length >= sizeof(path))
+            {
+                // not one the benchmarks wrote, a cut off name would unlink something else
+                ESP_LOGW(TAG, "Skipping %s in " BENCHMARK_SCRATCH_FOLDER ", the name is too long.", entry->d_name);
+                continue;
+            }
+            unlink(path);
+        }
+        closedir(dir);
+    }
+    if (0 != rmdir(BENCHMARK_SCRATCH_FOLDER))
+    {
+        ESP_LOGW(TAG, "Couldn't remove " BENCHMARK_SCRATCH_FOLDER " (errno %d)", errno);
+    }
+}
+
+void run_benchmarks(sdmmc_card_t *card)
+{
+    ESP_LOGI(TAG, "Running benchmarks");
+
+    // a real frame if the camera is up, so the scorer and the encoder see actual jpeg data
+    camera_fb_t *fb = esp_camera_fb_get();
+    uint8_t *frame = NULL;
+    size_t frame_length = BENCHMARK_FRAME_SIZE;
+
+    if (fb != NULL)
+    {
+        frame_length = fb->len;
+        benchmark_frame_pool(fb);
+    }
+
+    frame = heap_caps_malloc(frame_length, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (frame == NULL)
+    {
+        ESP_LOGE(TAG, "No memory for the benchmark frame.");
+        esp_camera_fb_return(fb);
+        return;
+    }
+
+    if (fb != NULL)
+    {
+        memcpy(frame, fb->buf, frame_length);
+        esp_camera_fb_return(fb);
+        benchmark_frame_quality(frame, frame_length);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "No camera frame, using %zu bytes of noise.", frame_length);
+        for (size_t i = 0; i < frame_length; i++)
+        {
+            frame[i] = (uint8_t)rand();
+        }
+    }
+
+    benchmark_multipart_encoding(frame, frame_length);
+    benchmark_photo_queue();
+    benchmark_event_loop();
+    benchmark_roster_lookup();
+
+    if (card != NULL && (0 == mkdir(BENCHMARK_SCRATCH_FOLDER, 0775) || errno == EEXIST))
+    {
+        benchmark_sd_write(frame, frame_length);
+        benchmark_sd_writer(frame, frame_length);
+        remove_scratch_folder();
+    }
+    else
+    {
+        ESP_LOGW(TAG, "No sdcard, skipping the sdcard benchmarks.");
+    }
+
+    free(frame);
+
+    ESP_LOGI(TAG, "Benchmarks done");
+}
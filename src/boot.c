@@ -0,0 +1,91 @@
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_err.h"
+
+// local includes
+
+#include "globals.h"
+#include "boot.h"
+
+// --------------
+
+static EventGroupHandle_t boot_event_group = NULL;
+
+static void boot_stage_task(void *args)
+{
+    boot_stage_t *stage = (boot_stage_t *)args;
+
+    if (stage->depends_on != 0)
+    {
+        xEventGroupWaitBits(boot_event_group, stage->depends_on, pdFALSE, pdTRUE, portMAX_DELAY);
+    }
+
+    stage->started_us = esp_timer_get_time();
+    stage->result = stage->run();
+    stage->finished_us = esp_timer_get_time();
+
+    if (stage->result != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Boot stage %s failed (error : %s)", stage->name, esp_err_to_name(stage->result));
+    }
+
+    xEventGroupSetBits(boot_event_group, stage->bit);
+
+    vTaskDelete(NULL);
+}
+
+esp_err_t boot_start(boot_stage_t *stages, size_t count)
+{
+    if (boot_event_group == NULL && NULL == (boot_event_group = xEventGroupCreate()))
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (pdPASS != xTaskCreate(boot_stage_task,
+                                  stages[i].name,
+                                  TASK_BOOT_STAGE_STACK_SIZE,
+                                  &stages[i],
+                                  BOOT_STAGE_TASK_PRIORITY,
+                                  NULL))
+        {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    return ESP_OK;
+}
+
+EventBits_t boot_wait(EventBits_t bits, TickType_t timeout)
+{
+    if (boot_event_group == NULL)
+    {
+        return 0;
+    }
+
+    return xEventGroupWaitBits(boot_event_group, bits, pdFALSE, pdTRUE, timeout);
+}
+
+void boot_log_stages(const boot_stage_t *stages, size_t count)
+{
+    EventBits_t done = boot_event_group != NULL ? xEventGroupGetBits(boot_event_group) : 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const boot_stage_t *stage = &stages[i];
+        if (!(done & stage->bit))
+        {
+            ESP_LOGW(TAG, "Boot stage %-10s still running", stage->name);
+            continue;
+        }
+        ESP_LOGI(TAG, "Boot stage %-10s started at %6" PRId64 " ms, took %6" PRId64 " ms%s", stage->name,
+                 stage->started_us / 1000, (stage->finished_us - stage->started_us) / 1000,
+                 stage->result == ESP_OK ? "" : ", failed");
+    }
+}
@@ -1,13 +1,13 @@
 #include "driver/sdmmc_types.h"
-#include "lwip/netdb.h"
-#include "ping/ping_sock.h"
 #include "inttypes.h"
+#include "stdlib.h"
+#include "sys/time.h"
 
 #include "esp_camera.h"
 #include "esp_log.h"
 #include "esp_err.h"
 #include "esp_camera.h"
-#include "esp_spiffs.h"
+#include "esp_timer.h"
 
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
@@ -19,22 +19,21 @@
 #include "camera.h"
 #include "events.h"
 #include "upload.h"
-#include "sd-card.h"
-#include "wifi.h"
+#include "frame-pool.h"
+#include "frame-ring.h"
+#include "frame-quality.h"
+#include "trace.h"
+#include "offline-store.h"
+#include "attendance-log.h"
+#include "connectivity.h"
 //---------------
 
 TaskHandle_t camera_feed_task_handle = NULL;
 EventGroupHandle_t eth_event_group;
 QueueHandle_t rfid_photo_queue;
 
-bool photo_being_taken = pdFALSE;
-rc522_tag_t *current_tag = NULL;
-
-#define PING_SUCCESS_BIT BIT0
-#define PING_FAILED_BIT BIT1
-
-// function declaration
-void initialize_and_start_ping(rfid_a_s_event_data_t *rfid_a_s_data);
+// scans handed from the event loop to the camera feed task
+static QueueHandle_t scan_request_queue;
 
 static camera_config_t camera_config = {
     .pin_pwdn = CAM_PIN_PWDN,
@@ -69,39 +68,6 @@ static camera_config_t camera_config = {
     .grab_mode = CAMERA_GRAB_LATEST, // CAMERA_GRAB_LATEST. Sets when buffers should be filled
     .sccb_i2c_port = 0};
 
-esp_err_t initialize_spiffs()
-{
-    ESP_LOGI(TAG, "Initializing SPIFFS");
-
-    esp_vfs_spiffs_conf_t conf = {
-        .base_path = "/spiffs",
-        .partition_label = NULL,
-        .max_files = 5,
-        .format_if_mount_failed = true};
-
-    // Use settings defined above to initialize and mount SPIFFS filesystem.
-    // Note: esp_vfs_spiffs_register is an all-in-one convenience function.
-    esp_err_t ret = esp_vfs_spiffs_register(&conf);
-
-    if (ret != ESP_OK)
-    {
-        if (ret == ESP_FAIL)
-        {
-            ESP_LOGE(TAG, "Failed to mount or format filesystem");
-        }
-        else if (ret == ESP_ERR_NOT_FOUND)
-        {
-            ESP_LOGE(TAG, "Failed to find SPIFFS partition");
-        }
-        else
-        {
-            ESP_LOGE(TAG, "Failed to initialize SPIFFS (%s)", esp_err_to_name(ret));
-        }
-        return ret;
-    }
-    return ret;
-}
-
 esp_err_t camera_init()
 {
     // initialize the camera
@@ -112,47 +78,63 @@ esp_err_t camera_init()
         return err;
     }
 
-    return ESP_OK;
+    // the captured frames are kept in the pool, so that the driver buffers can be returned right away
+    return frame_pool_init();
 }
 
-esp_err_t camera_capture(rc522_tag_t *rfid_tag, sdmmc_card_t *card, camera_fb_t *fb)
+/**
+ * Keeps the capture on the sdcard, or on the spill flash when there is no card.
+ */
+static void save_capture_offline(rfid_a_s_event_data_t *scan, frame_slot_t *frame)
 {
+    ESP_LOGI(TAG, "saving image offline.");
+    if (ESP_OK != offline_store_append(scan->tag.serial_number, scan->scan_wall_time_ms, frame->fb.buf, frame->fb.len))
+    {
+        ESP_LOGE(TAG, "Couldn't save image for rfid_tag: %" PRIu64 " offline.", scan->tag.serial_number);
+        attendance_log_record(scan, ATTENDANCE_IMAGE_LOST, 0);
+    }
+    else
+    {
+        attendance_log_record(scan, ATTENDANCE_STORED, frame->fb.len);
+    }
+    trace_stamp(scan->scan_id, TRACE_STAGE_SD_SAVED);
+}
 
-    if (!fb)
+/**
+ * Hands the frame to the uploader, or to the offline store when the server isn't reachable.
+ * The caller keeps its own reference to the frame, the uploader takes its own.
+ */
+esp_err_t camera_capture(rfid_a_s_event_data_t *scan, frame_slot_t *frame)
+{
+
+    if (!frame)
     {
         ESP_LOGE(TAG, "The frame buffer is emtpy");
         return ESP_FAIL;
     }
 
-    // if the wifi isn't connected, there is no point in pinging
-    if (WIFI_CONNECTED_BIT & xEventGroupGetBits(s_wifi_event_group))
-    {
-        rfid_a_s_event_data_t event_data = {
-            .fb = fb,
-            .tag = rfid_tag,
-            .card = card};
-
-        // since long running tasks cannot be handled in event handlers
-        // directly calling the function
-        initialize_and_start_ping(&event_data);
-    }
-    else
+    // the cached state of the connectivity monitor, finding out here would hold up every scan
+    if (connectivity_server_reachable())
     {
-        // directly try to save to sdcard
-        if (NULL == card)
+        rfid_a_s_event_data_t event_data = *scan;
+        event_data.frame = frame;
+
+        // the uploader outlives this call, so it needs its own reference
+        frame_pool_ref(frame);
+
+        esp_err_t err = upload_enqueue(&event_data);
+        if (ESP_OK == err)
         {
-            ESP_LOGE(TAG, "Couldn't save to sdcard as it wasn't initialized");
-        }
-        else
-        {
-            ESP_LOGI(TAG, "saving image to sdcard.");
-            if (ESP_OK != save_image_to_sdcard(fb->buf, rfid_tag->serial_number))
-            {
-                ESP_LOGE(TAG, "Couldn't save image for rfid_tag: %" PRIu64 " to sdcard.", rfid_tag->serial_number);
-            }
+            trace_stamp(scan->scan_id, TRACE_STAGE_UPLOAD_QUEUED);
+            return ESP_OK;
         }
+
+        ESP_LOGW(TAG, "Couldn't queue the upload (error : %s), saving image offline.", esp_err_to_name(err));
+        frame_pool_release(frame);
     }
 
+    save_capture_offline(scan, frame);
+
     return ESP_OK;
 }
 
@@ -171,7 +153,10 @@ void register_photo_task(void *args)
 
             // take photo
             // sending the rid tag too, for keeping the identity in image
-            camera_capture(rfid_a_s_event_data->tag, rfid_a_s_event_data->card, rfid_a_s_event_data->fb);
+            camera_capture(rfid_a_s_event_data, rfid_a_s_event_data->frame);
+
+            // dropping the reference taken when the frame was queued
+            frame_pool_release(rfid_a_s_event_data->frame);
         }
     }
 
@@ -180,176 +165,76 @@ void register_photo_task(void *args)
     vTaskDelete(NULL);
 }
 
-static void on_ping_success(esp_ping_handle_t hdl, void *args)
-{
-    rfid_a_s_event_data_t *rfid_a_s_data = (rfid_a_s_event_data_t *)args;
-
-    uint8_t ttl;
-    uint16_t seqno;
-    uint32_t elapsed_time, recv_len;
-    ip_addr_t target_addr;
-    esp_ping_get_profile(hdl, ESP_PING_PROF_SEQNO, &seqno, sizeof(seqno));
-    esp_ping_get_profile(hdl, ESP_PING_PROF_TTL, &ttl, sizeof(ttl));
-    esp_ping_get_profile(hdl, ESP_PING_PROF_IPADDR, &target_addr, sizeof(target_addr));
-    esp_ping_get_profile(hdl, ESP_PING_PROF_SIZE, &recv_len, sizeof(recv_len));
-    esp_ping_get_profile(hdl, ESP_PING_PROF_TIMEGAP, &elapsed_time, sizeof(elapsed_time));
-    ESP_LOGI(TAG, "%lu bytes from %s icmp_seq=%d ttl=%d time=%lu ms\n",
-             recv_len, inet_ntoa(target_addr.u_addr.ip4), seqno, ttl, elapsed_time);
-
-    // stopping the ping session and deleting it
-    esp_err_t ret;
-    if (ESP_OK != (ret = esp_ping_stop(hdl)))
-    {
-        ESP_LOGE(TAG, "Couldn't stop ping session. (error : %s)", esp_err_to_name(ret));
-    }
-    if (ESP_OK != (ret = esp_ping_delete_session(hdl)))
-    {
-        ESP_LOGE(TAG, "Couldn't delete ping session. (error : %s)", esp_err_to_name(ret));
-    }
-
-    // the memory freeing of `*args` must be handled inside of the task
-    // as the lifetime of task's args need to be valid inside of task
-
-    // one success is enough
-    xTaskCreate(
-        upload_jpeg_task,
-        "Upload_JPEG",
-        TASK_UPLOAD_JPEG_STACK_SIZE,
-        rfid_a_s_data,
-        UPLOAD_JPEG_TASK_CORE_AFFINITY,
-        NULL);
-}
-
-static void on_ping_timeout(esp_ping_handle_t hdl, void *args)
+void handle_tag_scanned(void *ptr, esp_event_base_t base, int32_t event_id, void *event_data)
 {
-    rfid_a_s_event_data_t *rfid_a_s_data = (rfid_a_s_event_data_t *)args;
-
-    uint16_t seqno;
-    ip_addr_t target_addr;
-    esp_ping_get_profile(hdl, ESP_PING_PROF_SEQNO, &seqno, sizeof(seqno));
-    esp_ping_get_profile(hdl, ESP_PING_PROF_IPADDR, &target_addr, sizeof(target_addr));
-    ESP_LOGI(TAG, "From %s icmp_seq=%d timeout\n", inet_ntoa(target_addr.u_addr.ip4), seqno);
+    rfid_a_s_event_data_t *evt_data = (rfid_a_s_event_data_t *)event_data;
 
-    // if the last sequence fails
-    if (seqno == PING_COUNT)
+    switch (event_id)
     {
-        // stopping the ping session and deleting it
-        esp_err_t ret;
-        if (ESP_OK != (ret = esp_ping_stop(hdl)))
-        {
-            ESP_LOGE(TAG, "Couldn't stop ping session. (error : %s)", esp_err_to_name(ret));
-        }
-        if (ESP_OK != (ret = esp_ping_delete_session(hdl)))
-        {
-            ESP_LOGE(TAG, "Couldn't delete ping session. (error : %s)", esp_err_to_name(ret));
-        }
-        ESP_LOGI(TAG, "Saving image locally because of unavailability of internet access.");
-
-        // keeping a copy for freeing the callback args later on
-        esp_err_t delete_ret = ret;
-
-        // if the control reaches this part, the tag and frame buffer should never be null
-        // todo: remove at production
-        assert(rfid_a_s_data->tag != NULL);
-        assert(rfid_a_s_data->fb != NULL);
-
-        // save the frame buffer to the file path
-        sdmmc_card_t *card = rfid_a_s_data->card;
-        if (card == NULL)
-        {
-            ESP_LOGE(TAG, "Couldn't save to sdcard as it wasn't initialized");
-        }
-        else
+    case RFID_A_S_RFID_SCANNED:
+    {
+        // copying the scan, the event data only lives as long as this handler
+        rfid_a_s_event_data_t scan = *evt_data;
+        struct timeval now;
+        scan.scan_time_us = esp_timer_get_time();
+        gettimeofday(&now, NULL);
+        scan.scan_wall_time_ms = (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+        scan.frame = NULL;
+
+        if (scan.scan_id == 0)
         {
-            ESP_LOGI(TAG, "saving image to sdcard.");
-            if (ESP_OK != save_image_to_sdcard(rfid_a_s_data->fb->buf, rfid_a_s_data->tag->serial_number))
-            {
-                ESP_LOGE(TAG, "Couldn't save image for rfid_tag: %" PRIu64 " to sdcard.", rfid_a_s_data->tag->serial_number);
-            }
+            scan.scan_id = trace_begin_scan(); // posted by something that doesn't trace
         }
+        trace_stamp(scan.scan_id, TRACE_STAGE_SCAN_HANDLED);
 
-        // free the callback args if the ping sessions was sucessfully deleted
-        if (ESP_OK == delete_ret) // after all ping ends
+        // waking the camera feed task, the event loop must not block here
+        if (pdTRUE != xQueueSend(scan_request_queue, &scan, 0))
         {
-            // freeing the memory
-            free(args);
+            ESP_LOGE(TAG, "Dropping the scan of rfid_tag: %" PRIu64 ", the camera is still busy with the previous ones.", scan.tag.serial_number);
         }
+        break;
+    }
+    default:
+        break;
     }
 }
 
-static void on_ping_end(esp_ping_handle_t hdl, void *args)
+/**
+ * Picks the frame of the burst to be registered for the scan.
+ * The burst is sorted oldest first, the caller still owns all of its references.
+ */
+static frame_slot_t *select_burst_frame(frame_slot_t **burst, size_t burst_length, int64_t scan_time_us)
 {
-    uint32_t transmitted;
-    uint32_t received;
-    uint32_t total_time_ms;
-
-    esp_ping_get_profile(hdl, ESP_PING_PROF_REQUEST, &transmitted, sizeof(transmitted));
-    esp_ping_get_profile(hdl, ESP_PING_PROF_REPLY, &received, sizeof(received));
-    esp_ping_get_profile(hdl, ESP_PING_PROF_DURATION, &total_time_ms, sizeof(total_time_ms));
-    ESP_LOGI(TAG, "%lu packets transmitted, %lu received, time %lums\n", transmitted, received, total_time_ms);
-
-    // the image should already have been uploaded if there was a success
-}
+    frame_slot_t *selected = NULL;
+    int64_t selected_distance = INT64_MAX;
+    float selected_score = -1.0f;
+    frame_quality_t quality;
+    int64_t score_start = esp_timer_get_time();
 
-void initialize_and_start_ping(rfid_a_s_event_data_t *rfid_a_s_data)
-{
-    /* convert URL to IP address */
-    ip_addr_t target_addr;
-    struct addrinfo hint;
-    struct addrinfo *res = NULL;
-    memset(&hint, 0, sizeof(hint));
-    memset(&target_addr, 0, sizeof(target_addr));
-    getaddrinfo(PING_TARGET, NULL, &hint, &res);
-    struct in_addr addr4 = ((struct sockaddr_in *)(res->ai_addr))->sin_addr;
-    inet_addr_to_ip4addr(ip_2_ip4(&target_addr), &addr4);
-    freeaddrinfo(res);
-
-    esp_ping_config_t ping_config = ESP_PING_DEFAULT_CONFIG();
-    ping_config.target_addr = target_addr; // target IP address
-    ping_config.count = PING_COUNT;
-
-    /* set callback functions */
-    esp_ping_callbacks_t cbs;
-    cbs.on_ping_success = on_ping_success;
-    cbs.on_ping_timeout = on_ping_timeout;
-    cbs.on_ping_end = on_ping_end;
-
-    rfid_a_s_event_data_t *callback_args = malloc(sizeof(rfid_a_s_event_data_t));
-    memcpy(callback_args, rfid_a_s_data, sizeof(*rfid_a_s_data));
-    cbs.cb_args = (void *)callback_args;
-
-    esp_ping_handle_t ping;
-    esp_err_t ret = ESP_OK;
-    if (ESP_OK != (ret = esp_ping_new_session(&ping_config, &cbs, &ping)))
+    for (size_t i = 0; i < burst_length; i++)
     {
-        ESP_LOGI(TAG, "Pinging " PING_TARGET " failed");
-    }
-    else
-    {
-        if (ESP_OK == (ret = esp_ping_start(ping)))
+        int64_t distance = llabs(frame_timestamp_us(burst[i]) - scan_time_us);
+
+        // the sharpest, well exposed frame, ties (and frames that couldn't be scored) go to the one closest to the scan instant
+        float score = -1.0f;
+        if (burst[i]->fb.format == PIXFORMAT_JPEG && ESP_OK == frame_quality_score(burst[i]->fb.buf, burst[i]->fb.len, &quality))
         {
-            ESP_LOGI(TAG, "Pinging  " PING_TARGET);
+            score = quality.score;
+            ESP_LOGD(TAG, "Burst frame %zu: sharpness %.1f, mean luma %.1f, %" PRId64 " ms from the scan",
+                     i, quality.sharpness, quality.mean_luma, (frame_timestamp_us(burst[i]) - scan_time_us) / 1000);
         }
-        else
+
+        if (score > selected_score || (score == selected_score && distance < selected_distance))
         {
-            ESP_LOGE(TAG, "Couldn't start the ping session to ping " PING_TARGET);
+            selected = burst[i];
+            selected_score = score;
+            selected_distance = distance;
         }
     }
-}
 
-void handle_tag_scanned(void *ptr, esp_event_base_t base, int32_t event_id, void *event_data)
-{
-    rfid_a_s_event_data_t *evt_data = (rfid_a_s_event_data_t *)event_data;
+    ESP_LOGD(TAG, "Scored %zu burst frames in %" PRId64 " us", burst_length, esp_timer_get_time() - score_start);
 
-    switch (event_id)
-    {
-    case RFID_A_S_RFID_SCANNED:
-        photo_being_taken = pdTRUE;
-        current_tag = evt_data->tag;
-        break;
-    default:
-        break;
-    }
+    return selected;
 }
 
 void start_camera_feed(void *card)
@@ -359,9 +244,10 @@ void start_camera_feed(void *card)
     card = (sdmmc_card_t *)card;
 
     if (!card)
-        ESP_LOGE(TAG, "SdCard isn't initialized so cannot save images.");
+        ESP_LOGE(TAG, "SdCard isn't initialized, images are only kept on the spill flash while offline.");
 
     rfid_photo_queue = xQueueCreate(RFID_PHOTO_QUEUE_SIZE, sizeof(rfid_a_s_event_data_t));
+    scan_request_queue = xQueueCreate(SCAN_REQUEST_QUEUE_SIZE, sizeof(rfid_a_s_event_data_t));
 
     ret = esp_event_handler_register(RFID_A_S_EVENTS, RFID_A_S_RFID_SCANNED, handle_tag_scanned, NULL);
 
@@ -379,55 +265,101 @@ void start_camera_feed(void *card)
                 &camera_feed_task_handle);
 
     camera_fb_t *fb;
+    frame_slot_t *frame;
 
     // now use lower quality as described in : https://github.com/espressif/esp32-camera/issues/185#issue-716800775
     sensor_t *ss = esp_camera_sensor_get();
     ss->set_quality(ss, 12);
 
+    frame_slot_t *burst[FRAME_RING_SIZE];
+    size_t burst_length;
+
+    rfid_a_s_event_data_t scan;
+    bool scan_pending = false;
+    int64_t last_scan_time_us = esp_timer_get_time();
+
     while (1)
     {
+        // idle mode: the sensor keeps streaming into the driver buffers, but no frames are copied until a scan arrives
+        // without pre-trigger frames there is nothing to keep, so the task is always idle between scans
+        if (!scan_pending && (FRAME_RING_PRE_FRAMES == 0 || esp_timer_get_time() - last_scan_time_us > CAMERA_FEED_IDLE_TIMEOUT_MS * 1000LL))
+        {
+            scan_pending = pdTRUE == xQueueReceive(scan_request_queue, &scan, portMAX_DELAY);
+
+            // whatever is left in the ring is from before going idle, too old to be part of this scan's burst
+            while (frame_ring_drop_oldest())
+                ;
+        }
 
-        // get the current frame buffer
+        // get the current frame buffer, this blocks until the driver has a frame
         fb = esp_camera_fb_get();
 
-        // do some display stuffs
-        vTaskDelay(50 / portTICK_PERIOD_MS);
+        if (fb != NULL)
+        {
+            // copying the frame once into the pre-trigger ring, so the driver gets its buffer back immediately
+            frame = frame_pool_fill(fb);
+            if (frame == NULL && frame_ring_drop_oldest())
+            {
+                // the ring was holding on to every free slot
+                frame = frame_pool_fill(fb);
+            }
+            esp_camera_fb_return(fb);
 
-        // release the buffer
-        esp_camera_fb_return(fb);
+            frame_ring_push(frame);
+        }
 
-        if (photo_being_taken == pdTRUE && fb != NULL && current_tag != NULL)
+        if (!scan_pending)
         {
-            // the current frame buffer
-            fb = esp_camera_fb_get();
+            scan_pending = pdTRUE == xQueueReceive(scan_request_queue, &scan, 0);
+        }
+
+        // waiting until the frames following the scan have been captured too
+        if (scan_pending && frame_ring_count_since(scan.scan_time_us) >= FRAME_RING_POST_FRAMES)
+        {
+            burst_length = frame_ring_get_around(scan.scan_time_us, FRAME_RING_PRE_FRAMES, FRAME_RING_POST_FRAMES, burst, FRAME_RING_SIZE);
+
+            frame = select_burst_frame(burst, burst_length, scan.scan_time_us);
 
             /** Might require handling of case when countdown is going on*/
 
-            rfid_a_s_event_data_t queue_data = {
-                .fb = fb,
-                .tag = current_tag,
-                .card = card,
-            };
-            // logging the captured frame size
-            ESP_LOGI(TAG, "The captured frame size is: %zu", fb->len);
-            // publish the event only
-            esp_event_post(RFID_A_S_EVENTS, RFID_A_S_PHOTO_TAKEN, &queue_data, sizeof(rfid_a_s_event_data_t), portMAX_DELAY);
-
-            // send to queue for other task
-            // this will fail if queue is full
-            // we don't care about lost images when the queue is full, as this condition implies some other thing isn't working
-            // i.e. either upload or save functionality
-            // so just logging
-            if (pdTRUE != (ret = xQueueSend(rfid_photo_queue, (void *)&queue_data, 100)))
+            if (frame != NULL)
             {
-                ESP_LOGE(TAG, "Couldn't send to queue `rfid_photo_queue` (error : %s)", esp_err_to_name(ret));
+                // the queued item gets its own reference, the burst is released below
+                frame_pool_ref(frame);
+
+                rfid_a_s_event_data_t queue_data = scan;
+                queue_data.frame = frame;
+                queue_data.card = card;
+
+                // logging the captured frame size
+                ESP_LOGI(TAG, "The captured frame size is: %zu (frame %" PRId64 " ms from the scan)",
+                         frame->fb.len, (frame_timestamp_us(frame) - scan.scan_time_us) / 1000);
+                // publish the event only
+                esp_event_post(RFID_A_S_EVENTS, RFID_A_S_PHOTO_TAKEN, &queue_data, sizeof(rfid_a_s_event_data_t), portMAX_DELAY);
+
+                // send to queue for other task
+                // this will fail if queue is full
+                // we don't care about lost images when the queue is full, as this condition implies some other thing isn't working
+                // i.e. either upload or save functionality
+                // so just logging
+                if (pdTRUE != (ret = xQueueSend(rfid_photo_queue, (void *)&queue_data, 100)))
+                {
+                    ESP_LOGE(TAG, "Couldn't send to queue `rfid_photo_queue` (error : %s)", esp_err_to_name(ret));
+                    frame_pool_release(frame);
+                }
+                else
+                {
+                    trace_stamp(scan.scan_id, TRACE_STAGE_FRAME_SELECTED);
+                }
             }
 
-            esp_camera_fb_return(fb);
+            for (size_t i = 0; i < burst_length; i++)
+            {
+                frame_pool_release(burst[i]);
+            }
 
-            // reset the variables
-            photo_being_taken = pdFALSE;
-            current_tag = NULL;
+            last_scan_time_us = scan.scan_time_us;
+            scan_pending = false;
         }
     }
 
@@ -0,0 +1,231 @@
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <fcntl.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "lwip/netdb.h"
+#include "lwip/sockets.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_err.h"
+
+// local includes
+
+#include "globals.h"
+#include "connectivity.h"
+#include "wifi.h"
+
+// --------------
+
+#define SERVER_REACHABLE_BIT BIT0
+
+static EventGroupHandle_t connectivity_event_group = NULL;
+static TaskHandle_t connectivity_task_handle = NULL;
+static volatile int64_t last_reached_us = 0; // the last time the server answered, a probe or an upload
+
+/**
+ * Splits SERVER_ADDRESS ("host:port") and resolves it.
+ * The caller frees the result with `freeaddrinfo()`.
+ */
+static esp_err_t resolve_server(struct addrinfo **out)
+{
+    char host[64];
+    const char *port = "80";
+
+    strncpy(host, SERVER_ADDRESS, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+
+    char *colon = strchr(host, ':');
+    if (colon != NULL)
+    {
+        *colon = '\0';
+        port = SERVER_ADDRESS + (colon - host) + 1;
+    }
+
+    struct addrinfo hint;
+    memset(&hint, 0, sizeof(hint));
+    hint.ai_family = AF_INET;
+    hint.ai_socktype = SOCK_STREAM;
+
+    *out = NULL;
+    int err = getaddrinfo(host, port, &hint, out);
+    if (err != 0 || *out == NULL)
+    {
+        ESP_LOGE(TAG, "Couldn't resolve " SERVER_ADDRESS " (error : %d)", err);
+        if (*out != NULL)
+        {
+            freeaddrinfo(*out);
+            *out = NULL;
+        }
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Opens (and closes) a tcp connection to the server, which is all an upload needs to get going.
+ */
+static bool probe_server()
+{
+    struct addrinfo *res;
+    if (ESP_OK != resolve_server(&res))
+    {
+        return false;
+    }
+
+    bool reached = false;
+    int sock = socket(res->ai_family, res->ai_socktype, 0);
+    if (sock < 0)
+    {
+        freeaddrinfo(res);
+        return false;
+    }
+
+    // non blocking, so the timeout is ours instead of the tcp stack's
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+    if (0 == connect(sock, res->ai_addr, res->ai_addrlen))
+    {
+        reached = true;
+    }
+    else if (errno == EINPROGRESS)
+    {
+        fd_set writable;
+        FD_ZERO(&writable);
+        FD_SET(sock, &writable);
+        struct timeval timeout = {
+            .tv_sec = CONNECTIVITY_PROBE_TIMEOUT_MS / 1000,
+            .tv_usec = (CONNECTIVITY_PROBE_TIMEOUT_MS % 1000) * 1000,
+        };
+
+        if (select(sock + 1, NULL, &writable, NULL, &timeout) > 0)
+        {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &length);
+            reached = error == 0;
+        }
+    }
+
+    close(sock);
+    freeaddrinfo(res);
+
+    return reached;
+}
+
+static void set_reachable(bool reached)
+{
+    bool was_reachable = SERVER_REACHABLE_BIT & xEventGroupGetBits(connectivity_event_group);
+
+    if (reached)
+    {
+        last_reached_us = esp_timer_get_time();
+        xEventGroupSetBits(connectivity_event_group, SERVER_REACHABLE_BIT);
+    }
+    else
+    {
+        xEventGroupClearBits(connectivity_event_group, SERVER_REACHABLE_BIT);
+    }
+
+    if (was_reachable != reached)
+    {
+        ESP_LOGI(TAG, "Server " SERVER_ADDRESS " is %s", reached ? "reachable" : "unreachable");
+    }
+}
+
+bool connectivity_server_reachable()
+{
+    if (connectivity_event_group == NULL)
+    {
+        return false;
+    }
+
+    return (WIFI_CONNECTED_BIT & xEventGroupGetBits(s_wifi_event_group)) &&
+           (SERVER_REACHABLE_BIT & xEventGroupGetBits(connectivity_event_group));
+}
+
+void connectivity_report(bool reached)
+{
+    if (connectivity_event_group == NULL)
+    {
+        return;
+    }
+
+    set_reachable(reached);
+
+    if (!reached && connectivity_task_handle != NULL)
+    {
+        // starting the retries from the shortest interval
+        xTaskNotifyGive(connectivity_task_handle);
+    }
+}
+
+void connectivity_monitor_task(void *args)
+{
+    uint32_t retry_ms = CONNECTIVITY_RETRY_MIN_MS;
+
+    while (1)
+    {
+        // nothing to probe without wifi
+        if (!(WIFI_CONNECTED_BIT & xEventGroupGetBits(s_wifi_event_group)))
+        {
+            set_reachable(false);
+            xEventGroupWaitBits(s_wifi_event_group, WIFI_CONNECTED_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+            retry_ms = CONNECTIVITY_RETRY_MIN_MS;
+        }
+
+        uint32_t wait_ms;
+        int64_t since_reached_ms = (esp_timer_get_time() - last_reached_us) / 1000;
+
+        if (connectivity_server_reachable() && since_reached_ms < CONNECTIVITY_PROBE_INTERVAL_MS)
+        {
+            // a recent upload already showed the server is there
+            wait_ms = CONNECTIVITY_PROBE_INTERVAL_MS - since_reached_ms;
+        }
+        else if (probe_server())
+        {
+            set_reachable(true);
+            retry_ms = CONNECTIVITY_RETRY_MIN_MS;
+            wait_ms = CONNECTIVITY_PROBE_INTERVAL_MS;
+        }
+        else
+        {
+            set_reachable(false);
+            wait_ms = retry_ms;
+            retry_ms = retry_ms * 2 > CONNECTIVITY_RETRY_MAX_MS ? CONNECTIVITY_RETRY_MAX_MS : retry_ms * 2;
+        }
+
+        // woken early when an upload fails
+        if (ulTaskNotifyTake(pdTRUE, wait_ms / portTICK_PERIOD_MS) > 0)
+        {
+            retry_ms = CONNECTIVITY_RETRY_MIN_MS;
+        }
+    }
+
+    vTaskDelete(NULL);
+}
+
+esp_err_t connectivity_init()
+{
+    connectivity_event_group = xEventGroupCreate();
+    if (connectivity_event_group == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (pdPASS != xTaskCreate(connectivity_monitor_task,
+                              "Connectivity_Task",
+                              TASK_CONNECTIVITY_STACK_SIZE,
+                              NULL,
+                              CONNECTIVITY_TASK_PRIORITY,
+                              &connectivity_task_handle))
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
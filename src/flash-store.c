@@ -0,0 +1,502 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_log.h"
+#include "esp_err.h"
+
+// local includes
+
+#include "globals.h"
+#include "flash-store.h"
+
+// --------------
+
+#define SECTOR_DATA_SIZE (FLASH_STORE_SECTOR_SIZE - sizeof(flash_sector_header_t))
+#define NO_RECORD 0xffff
+#define STATE_PENDING 0xffffffff
+#define STATE_CONSUMED 0
+#define VERIFY_BUFFER_SIZE 1024
+
+/*
+ * The ring is addressed by positions counting the data bytes ever written, position / SECTOR_DATA_SIZE is the
+ * sequence of the sector it lies in. Everything before `tail` is erased or about to be, `unread` is the oldest
+ * record not yet consumed and `head` where the next record goes.
+ */
+static const esp_partition_t *partition = NULL;
+static SemaphoreHandle_t store_lock = NULL;
+static uint32_t sector_count = 0;
+static uint64_t tail = 0;
+static uint64_t unread = 0;
+static uint64_t head = 0;
+static uint32_t pending_records = 0;
+static uint32_t degraded_records = 0; // kept without their image
+static uint32_t evicted_records = 0;  // erased before they were consumed
+
+// only used with `store_lock` held (or before the store is up)
+static uint8_t verify_buffer[VERIFY_BUFFER_SIZE];
+
+static uint32_t record_size(uint32_t length)
+{
+    return sizeof(flash_record_header_t) + ((length + 3) & ~3u);
+}
+
+static uint32_t sector_header_crc(flash_sector_header_t header)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)&header, offsetof(flash_sector_header_t, crc));
+}
+
+static uint64_t capacity()
+{
+    // the sector being refilled never holds anything readable
+    return (uint64_t)(sector_count - 1) * SECTOR_DATA_SIZE;
+}
+
+/**
+ * Reads or writes the data area of the ring at `position`, running on across sectors.
+ */
+static esp_err_t ring_io(uint64_t position, void *data, size_t length, bool write)
+{
+    uint8_t *bytes = data;
+
+    while (length > 0)
+    {
+        size_t sector = (position / SECTOR_DATA_SIZE) % sector_count;
+        size_t offset = position % SECTOR_DATA_SIZE;
+        size_t n = SECTOR_DATA_SIZE - offset < length ? SECTOR_DATA_SIZE - offset : length;
+        size_t address = sector * FLASH_STORE_SECTOR_SIZE + sizeof(flash_sector_header_t) + offset;
+
+        esp_err_t err = write ? esp_partition_write(partition, address, bytes, n)
+                              : esp_partition_read(partition, address, bytes, n);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+
+        position += n;
+        bytes += n;
+        length -= n;
+    }
+
+    return ESP_OK;
+}
+
+static bool read_sector_header(uint32_t sector, flash_sector_header_t *out)
+{
+    return ESP_OK == esp_partition_read(partition, sector * FLASH_STORE_SECTOR_SIZE, out, sizeof(*out)) &&
+           out->magic == FLASH_SECTOR_MAGIC && out->crc == sector_header_crc(*out) &&
+           out->sequence % sector_count == sector;
+}
+
+static bool read_record_header(uint64_t position, flash_record_header_t *out)
+{
+    return ESP_OK == ring_io(position, out, sizeof(*out), false) && out->magic == FLASH_RECORD_MAGIC &&
+           record_size(out->length) <= capacity();
+}
+
+static uint32_t record_crc(flash_record_header_t header, uint64_t position, const uint8_t *jpeg)
+{
+    header.crc = 0;
+    header.state = STATE_PENDING;
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&header, sizeof(header));
+
+    if (jpeg != NULL)
+    {
+        return esp_rom_crc32_le(crc, jpeg, header.length);
+    }
+
+    // going through the flash in small pieces, the jpeg isn't needed
+    position += sizeof(header);
+    for (uint32_t done = 0; done < header.length;)
+    {
+        uint32_t n = header.length - done < VERIFY_BUFFER_SIZE ? header.length - done : VERIFY_BUFFER_SIZE;
+        if (ESP_OK != ring_io(position + done, verify_buffer, n, false))
+        {
+            return ~header.crc; // can't match
+        }
+        crc = esp_rom_crc32_le(crc, verify_buffer, n);
+        done += n;
+    }
+
+    return crc;
+}
+
+/**
+ * Moves `unread` to the next record not yet consumed, or to `head`.
+ */
+static void skip_consumed()
+{
+    flash_record_header_t header;
+
+    while (unread < head && read_record_header(unread, &header) && header.state == STATE_CONSUMED)
+    {
+        unread += record_size(header.length);
+    }
+    if (unread > head)
+    {
+        unread = head;
+    }
+}
+
+/**
+ * Erases the sector `sequence` goes to and writes its header. The records of the previous round in that sector
+ * are given up, oldest first.
+ */
+static esp_err_t begin_sector(uint32_t sequence, uint16_t first_record)
+{
+    uint64_t sector_start = (uint64_t)sequence * SECTOR_DATA_SIZE;
+
+    if (sequence >= sector_count)
+    {
+        // the records starting in the erased sector, or running into it
+        uint64_t kept_from = sector_start - capacity();
+        flash_record_header_t header;
+        while (tail < kept_from && read_record_header(tail, &header))
+        {
+            if (tail >= unread && header.state != STATE_CONSUMED)
+            {
+                evicted_records++;
+                pending_records--;
+            }
+            tail += record_size(header.length);
+        }
+        tail = tail < kept_from ? kept_from : tail;
+        unread = unread < tail ? tail : unread;
+    }
+
+    size_t address = (sequence % sector_count) * FLASH_STORE_SECTOR_SIZE;
+    flash_sector_header_t header = {
+        .magic = FLASH_SECTOR_MAGIC,
+        .sequence = sequence,
+        .first_record = first_record,
+        .reserved = 0xffff,
+    };
+    header.crc = sector_header_crc(header);
+
+    esp_err_t err = esp_partition_erase_range(partition, address, FLASH_STORE_SECTOR_SIZE);
+    if (err == ESP_OK)
+    {
+        err = esp_partition_write(partition, address, &header, sizeof(header));
+    }
+
+    return err;
+}
+
+static esp_err_t append_record(uint64_t serial_number, int64_t scan_time_ms, const uint8_t *jpeg, size_t length)
+{
+    if (length > 0 && head - unread + record_size(length) > capacity() * FLASH_STORE_IMAGE_QUOTA_PERCENT / 100)
+    {
+        degraded_records++;
+        ESP_LOGW(TAG, "Spill flash is nearly full, keeping only the attendance of rfid_tag: %" PRIu64, serial_number);
+        length = 0;
+    }
+
+    uint32_t size = record_size(length);
+    if (size > capacity())
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    flash_record_header_t header = {
+        .magic = FLASH_RECORD_MAGIC,
+        .length = length,
+        .state = STATE_PENDING,
+        .serial_number = serial_number,
+        .scan_time_ms = scan_time_ms,
+    };
+    header.crc = record_crc(header, 0, jpeg);
+
+    // the sectors starting within the record are prepared before any of it is written
+    uint64_t end = head + size;
+    uint32_t evicted = evicted_records;
+    for (uint64_t sequence = (head + SECTOR_DATA_SIZE - 1) / SECTOR_DATA_SIZE; sequence * SECTOR_DATA_SIZE < end; sequence++)
+    {
+        uint64_t sector_start = sequence * SECTOR_DATA_SIZE;
+        uint16_t first_record = sector_start == head                   ? 0
+                                : end < sector_start + SECTOR_DATA_SIZE ? (uint16_t)(end - sector_start)
+                                                                        : NO_RECORD;
+
+        esp_err_t err = begin_sector((uint32_t)sequence, first_record);
+        if (err != ESP_OK)
+        {
+            // the ring stays consistent, the next record starts on the sector after
+            ESP_LOGE(TAG, "Couldn't erase spill sector %" PRIu64 " (error : %s)", sequence, esp_err_to_name(err));
+            head = (sequence + 1) * SECTOR_DATA_SIZE;
+            return err;
+        }
+    }
+    if (evicted_records != evicted)
+    {
+        ESP_LOGW(TAG, "Spill flash full, %" PRIu32 " unsent records evicted", evicted_records - evicted);
+    }
+
+    // the header last, a record torn by a power cut is never taken for a valid one
+    esp_err_t err = ring_io(head + sizeof(header), (void *)jpeg, length, true);
+    if (err == ESP_OK && (length & 3) != 0)
+    {
+        static const uint8_t padding[3] = {0};
+        err = ring_io(head + sizeof(header) + length, (void *)padding, 4 - (length & 3), true);
+    }
+    if (err == ESP_OK)
+    {
+        err = ring_io(head, &header, sizeof(header), true);
+    }
+
+    // programmed bytes can't be written again, a failed record is skipped either way
+    uint64_t start = head;
+    head = end;
+    if (err != ESP_OK)
+    {
+        unread = unread == start ? head : unread;
+        return err;
+    }
+
+    pending_records++;
+
+    return ESP_OK;
+}
+
+esp_err_t flash_store_append(uint64_t serial_number, int64_t scan_time_ms, const uint8_t *jpeg, size_t length)
+{
+    if (store_lock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+    esp_err_t ret = append_record(serial_number, scan_time_ms, jpeg, length);
+    xSemaphoreGive(store_lock);
+
+    return ret;
+}
+
+/**
+ * Whether the rest of the sector `position` is in is still erased, records can only be written there if it is.
+ */
+static bool erased_from(uint64_t position)
+{
+    uint64_t sector_end = (position / SECTOR_DATA_SIZE + 1) * SECTOR_DATA_SIZE;
+
+    while (position < sector_end)
+    {
+        size_t n = sector_end - position < VERIFY_BUFFER_SIZE ? sector_end - position : VERIFY_BUFFER_SIZE;
+        if (ESP_OK != ring_io(position, verify_buffer, n, false))
+        {
+            return false;
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            if (verify_buffer[i] != 0xff)
+            {
+                return false;
+            }
+        }
+        position += n;
+    }
+
+    return true;
+}
+
+/**
+ * Finds the oldest and newest sector of the current round and walks the records in between.
+ */
+static void recover()
+{
+    flash_sector_header_t header;
+    uint32_t newest = 0;
+    bool found = false;
+
+    for (uint32_t sector = 0; sector < sector_count; sector++)
+    {
+        if (read_sector_header(sector, &header) && (!found || header.sequence > newest))
+        {
+            newest = header.sequence;
+            found = true;
+        }
+    }
+
+    tail = unread = head = 0;
+    pending_records = 0;
+    if (!found)
+    {
+        ESP_LOGI(TAG, "Spill flash is empty");
+        return;
+    }
+
+    // the sectors before the newest one which are still of this round
+    uint32_t first = newest;
+    while (first > 0 && newest - first + 1 < sector_count && read_sector_header((first - 1) % sector_count, &header) &&
+           header.sequence == first - 1)
+    {
+        first--;
+    }
+
+    uint64_t written_end = (uint64_t)(newest + 1) * SECTOR_DATA_SIZE;
+    tail = written_end;
+    for (uint32_t sequence = first; sequence <= newest; sequence++)
+    {
+        if (read_sector_header(sequence % sector_count, &header) && header.first_record != NO_RECORD)
+        {
+            tail = (uint64_t)sequence * SECTOR_DATA_SIZE + header.first_record;
+            break;
+        }
+    }
+
+    flash_record_header_t record;
+    uint64_t position = tail;
+    unread = UINT64_MAX;
+    while (position < written_end && read_record_header(position, &record) &&
+           record.crc == record_crc(record, position, NULL))
+    {
+        if (record.state != STATE_CONSUMED)
+        {
+            pending_records++;
+            unread = unread < position ? unread : position;
+        }
+        position += record_size(record.length);
+    }
+
+    // a torn record, or whatever stopped the walk, is left behind in a sector nothing more is written to
+    head = position;
+    if (head < written_end && (head / SECTOR_DATA_SIZE < newest || !erased_from(head)))
+    {
+        ESP_LOGW(TAG, "Spill flash: the records after position %" PRIu64 " don't check out, continuing on a new sector", head);
+        head = written_end;
+    }
+    unread = unread == UINT64_MAX ? head : unread;
+
+    ESP_LOGI(TAG, "Spill flash recovered: sectors %" PRIu32 "..%" PRIu32 ", %" PRIu32 " records not yet consumed",
+             first, newest, pending_records);
+}
+
+esp_err_t flash_store_init()
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, FLASH_STORE_PARTITION_SUBTYPE, FLASH_STORE_PARTITION_LABEL);
+    if (partition == NULL)
+    {
+        ESP_LOGE(TAG, "No " FLASH_STORE_PARTITION_LABEL " partition, captures can't be spilled to flash.");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    sector_count = partition->size / FLASH_STORE_SECTOR_SIZE;
+    if (sector_count < 2)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (store_lock == NULL && NULL == (store_lock = xSemaphoreCreateMutex()))
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+    recover();
+    xSemaphoreGive(store_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t flash_store_read_oldest(offline_record_header_t *out_header, uint8_t *jpeg, size_t capacity)
+{
+    flash_record_header_t header;
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    if (store_lock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+
+    while (unread < head)
+    {
+        if (read_record_header(unread, &header))
+        {
+            if (header.length > capacity)
+            {
+                ret = ESP_ERR_INVALID_SIZE;
+                break;
+            }
+            if (ESP_OK == ring_io(unread + sizeof(header), jpeg, header.length, false) &&
+                header.crc == record_crc(header, unread, jpeg))
+            {
+                out_header->length = header.length;
+                out_header->serial_number = header.serial_number;
+                out_header->scan_time_ms = header.scan_time_ms;
+                ret = ESP_OK;
+                break;
+            }
+        }
+
+        // there is no telling where the next record starts, going on from the next sector that has one
+        ESP_LOGE(TAG, "Skipping the unreadable spill record at %" PRIu64, unread);
+        uint64_t sequence = unread / SECTOR_DATA_SIZE + 1;
+        flash_sector_header_t sector_header;
+        unread = head;
+        for (; sequence * SECTOR_DATA_SIZE < head; sequence++)
+        {
+            if (read_sector_header(sequence % sector_count, &sector_header) && sector_header.first_record != NO_RECORD)
+            {
+                unread = sequence * SECTOR_DATA_SIZE + sector_header.first_record;
+                break;
+            }
+        }
+        pending_records = pending_records > 0 ? pending_records - 1 : 0;
+        skip_consumed();
+    }
+
+    xSemaphoreGive(store_lock);
+
+    return ret;
+}
+
+esp_err_t flash_store_consume_oldest()
+{
+    flash_record_header_t header;
+
+    if (store_lock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    if (unread < head && read_record_header(unread, &header))
+    {
+        // clearing bits needs no erase, the record stays in place until its sector comes round again
+        uint32_t state = STATE_CONSUMED;
+        ret = ring_io(unread + offsetof(flash_record_header_t, state), &state, sizeof(state), true);
+        unread += record_size(header.length);
+        pending_records = pending_records > 0 ? pending_records - 1 : 0;
+        skip_consumed();
+    }
+
+    xSemaphoreGive(store_lock);
+
+    return ret;
+}
+
+uint32_t flash_store_backlog()
+{
+    return pending_records;
+}
+
+void flash_store_log_stats()
+{
+    if (store_lock == NULL)
+    {
+        return;
+    }
+
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+    ESP_LOGI(TAG, "Spill flash: %" PRIu64 " of %" PRIu64 " bytes unsent in %" PRIu32 " records, %" PRIu32 " kept without image, %" PRIu32 " evicted",
+             head - unread, capacity(), pending_records, degraded_records, evicted_records);
+    xSemaphoreGive(store_lock);
+}
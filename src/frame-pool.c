@@ -0,0 +1,142 @@
+#include <assert.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_err.h"
+
+// local includes
+
+#include "globals.h"
+#include "frame-pool.h"
+
+// --------------
+
+static frame_slot_t frame_slots[FRAME_POOL_SLOT_COUNT];
+static portMUX_TYPE frame_pool_lock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t frame_pool_init()
+{
+    for (size_t i = 0; i < FRAME_POOL_SLOT_COUNT; i++)
+    {
+        if (frame_slots[i].fb.buf != NULL)
+        {
+            continue; // already initialized
+        }
+
+        // the frames are large, so they can only live in psram
+        uint8_t *storage = heap_caps_malloc(FRAME_POOL_SLOT_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (storage == NULL)
+        {
+            ESP_LOGE(TAG, "Couldn't allocate frame pool slot %zu in psram.", i);
+            return ESP_ERR_NO_MEM;
+        }
+
+        memset(&frame_slots[i], 0, sizeof(frame_slot_t));
+        frame_slots[i].fb.buf = storage;
+        frame_slots[i].capacity = FRAME_POOL_SLOT_SIZE;
+    }
+
+    ESP_LOGI(TAG, "Frame pool ready with %d slots of %d bytes.", FRAME_POOL_SLOT_COUNT, FRAME_POOL_SLOT_SIZE);
+
+    return ESP_OK;
+}
+
+frame_slot_t *frame_pool_claim()
+{
+    frame_slot_t *frame = NULL;
+
+    taskENTER_CRITICAL(&frame_pool_lock);
+    for (size_t i = 0; i < FRAME_POOL_SLOT_COUNT; i++)
+    {
+        if (frame_slots[i].refcount == 0 && frame_slots[i].fb.buf != NULL)
+        {
+            frame = &frame_slots[i];
+            frame->refcount = 1;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&frame_pool_lock);
+
+    if (frame != NULL)
+    {
+        frame->fb.len = 0;
+    }
+
+    return frame;
+}
+
+frame_slot_t *frame_pool_fill(const camera_fb_t *src)
+{
+    if (src == NULL)
+    {
+        return NULL;
+    }
+
+    // claiming the slot under the lock, copying outside of it
+    frame_slot_t *frame = frame_pool_claim();
+    if (frame == NULL)
+    {
+        ESP_LOGE(TAG, "No free frame pool slot, dropping the frame.");
+        return NULL;
+    }
+
+    if (src->len > frame->capacity)
+    {
+        ESP_LOGE(TAG, "The frame of %zu bytes doesn't fit in a frame pool slot of %zu bytes.", src->len, frame->capacity);
+        frame_pool_release(frame);
+        return NULL;
+    }
+
+    // everything but the buffer pointer is taken from the driver's frame
+    uint8_t *storage = frame->fb.buf;
+    memcpy(&frame->fb, src, sizeof(camera_fb_t));
+    frame->fb.buf = storage;
+    memcpy(frame->fb.buf, src->buf, src->len);
+
+    return frame;
+}
+
+void frame_pool_ref(frame_slot_t *frame)
+{
+    if (frame == NULL)
+    {
+        return;
+    }
+
+    taskENTER_CRITICAL(&frame_pool_lock);
+    assert(frame->refcount > 0); // referencing a free slot means it was used after release
+    frame->refcount++;
+    taskEXIT_CRITICAL(&frame_pool_lock);
+}
+
+void frame_pool_release(frame_slot_t *frame)
+{
+    if (frame == NULL)
+    {
+        return;
+    }
+
+    taskENTER_CRITICAL(&frame_pool_lock);
+    assert(frame->refcount > 0);
+    frame->refcount--;
+    taskEXIT_CRITICAL(&frame_pool_lock);
+}
+
+size_t frame_pool_free_slots()
+{
+    size_t free_slots = 0;
+
+    taskENTER_CRITICAL(&frame_pool_lock);
+    for (size_t i = 0; i < FRAME_POOL_SLOT_COUNT; i++)
+    {
+        if (frame_slots[i].refcount == 0 && frame_slots[i].fb.buf != NULL)
+        {
+            free_slots++;
+        }
+    }
+    taskEXIT_CRITICAL(&frame_pool_lock);
+
+    return free_slots;
+}
@@ -0,0 +1,538 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_err.h"
+
+// local includes
+
+#include "frame-quality.h"
+
+// --------------
+
+/*
+ * Only the huffman decoding of the baseline jpeg is done, every block is walked to keep the bitstream in sync
+ * but only the luma coefficients are dequantized and accumulated. There is no idct or color conversion,
+ * which is where most of the time of a full decode goes.
+ */
+
+#define HUFFMAN_FAST_BITS 9 // codes up to this length are decoded with a single table lookup
+#define MAX_COMPONENTS 3
+
+typedef struct huffman_table_t
+{
+    uint16_t fast[1 << HUFFMAN_FAST_BITS]; // (code length << 8) | symbol, 0 when the code is longer than HUFFMAN_FAST_BITS
+    int32_t maxcode[18];                    // largest code of each length, -1 if there is none
+    int32_t valoffset[17];                  // symbol index = code + valoffset[length]
+    uint8_t symbols[256];
+    bool present;
+} huffman_table_t;
+
+typedef struct jpeg_component_t
+{
+    uint8_t id;
+    uint8_t h;
+    uint8_t v;
+    uint8_t quant_table;
+    uint8_t dc_table;
+    uint8_t ac_table;
+    int32_t dc_prediction;
+} jpeg_component_t;
+
+typedef struct bit_reader_t
+{
+    const uint8_t *data;
+    size_t position;
+    size_t length;
+    uint32_t bits; // msb aligned
+    int count;
+    int padding; // of the bits fed in, how many were zeros made up after the end of the segment
+    bool marker_hit;
+} bit_reader_t;
+
+typedef struct jpeg_decoder_t
+{
+    uint16_t quant[4][64]; // in zigzag order, same as the decoded coefficients
+    huffman_table_t dc[4];
+    huffman_table_t ac[4];
+    jpeg_component_t components[MAX_COMPONENTS];
+    uint8_t component_count;
+    uint16_t width;
+    uint16_t height;
+    uint16_t restart_interval;
+    uint8_t h_max;
+    uint8_t v_max;
+} jpeg_decoder_t;
+
+static inline uint16_t read_u16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static bool build_huffman_table(huffman_table_t *table, const uint8_t *counts, const uint8_t *symbols, size_t symbol_count)
+{
+    memset(table, 0, sizeof(huffman_table_t));
+    memcpy(table->symbols, symbols, symbol_count);
+
+    int32_t code = 0;
+    size_t k = 0;
+    for (int length = 1; length <= 16; length++)
+    {
+        table->valoffset[length] = (int32_t)k - code;
+        for (int i = 0; i < counts[length - 1]; i++, k++, code++)
+        {
+            if (length <= HUFFMAN_FAST_BITS)
+            {
+                // every lookup index starting with this code maps to it
+                int shift = HUFFMAN_FAST_BITS - length;
+                for (int fill = 0; fill < (1 << shift); fill++)
+                {
+                    table->fast[(code << shift) | fill] = (uint16_t)((length << 8) | symbols[k]);
+                }
+            }
+        }
+        table->maxcode[length] = counts[length - 1] ? code - 1 : -1;
+        if (code > (1 << length))
+        {
+            return false; // over subscribed table
+        }
+        code <<= 1;
+    }
+    table->maxcode[17] = INT32_MAX; // sentinel
+    table->present = true;
+
+    return true;
+}
+
+static inline void bit_reader_fill(bit_reader_t *reader)
+{
+    while (reader->count <= 24)
+    {
+        uint32_t byte = 0;
+        if (!reader->marker_hit)
+        {
+            const uint8_t *p = &reader->data[reader->position];
+            size_t left = reader->length - reader->position;
+            if (left > 0 && p[0] != 0xFF)
+            {
+                byte = p[0];
+                reader->position++;
+            }
+            else if (left > 1 && p[1] == 0x00)
+            {
+                byte = 0xFF;
+                reader->position += 2; // stuffed byte
+            }
+            else
+            {
+                // a marker or the end of the data ends the entropy coded segment, feeding zeros from here on
+                reader->marker_hit = true;
+            }
+        }
+        if (reader->marker_hit)
+        {
+            reader->padding += 8;
+        }
+        reader->bits |= byte << (24 - reader->count);
+        reader->count += 8;
+    }
+}
+
+static inline void bit_reader_consume(bit_reader_t *reader, int count)
+{
+    reader->bits <<= count;
+    reader->count -= count;
+}
+
+static inline int decode_huffman(bit_reader_t *reader, const huffman_table_t *table)
+{
+    bit_reader_fill(reader);
+
+    uint16_t entry = table->fast[reader->bits >> (32 - HUFFMAN_FAST_BITS)];
+    if (entry)
+    {
+        bit_reader_consume(reader, entry >> 8);
+        return entry & 0xFF;
+    }
+
+    for (int length = HUFFMAN_FAST_BITS + 1; length <= 16; length++)
+    {
+        int32_t code = (int32_t)(reader->bits >> (32 - length));
+        if (code <= table->maxcode[length])
+        {
+            bit_reader_consume(reader, length);
+            return table->symbols[code + table->valoffset[length]];
+        }
+    }
+
+    return -1; // corrupt data
+}
+
+static inline int32_t receive_extend(bit_reader_t *reader, int size)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    bit_reader_fill(reader);
+    int32_t value = (int32_t)(reader->bits >> (32 - size));
+    bit_reader_consume(reader, size);
+
+    // values with a leading zero bit are negative
+    if (value < (1 << (size - 1)))
+    {
+        value += (int32_t)(-1u << size) + 1;
+    }
+
+    return value;
+}
+
+/**
+ * Whether any of the zeros fed in after the end of the segment were decoded, which only happens for a truncated or
+ * corrupt scan.
+ */
+static inline bool bit_reader_overrun(const bit_reader_t *reader)
+{
+    return reader->padding > reader->count;
+}
+
+/**
+ * Returns the marker ending the entropy coded segment, or -1 if the segment wasn't used up to its last byte.
+ * The reader is left past the marker with nothing buffered, to go on with the next restart interval.
+ */
+static int bit_reader_end_marker(bit_reader_t *reader)
+{
+    // only the padding to the byte boundary may be left over
+    if (!reader->marker_hit || bit_reader_overrun(reader) || reader->count - reader->padding >= 8)
+    {
+        return -1;
+    }
+
+    size_t position = reader->position;
+    while (position + 2 < reader->length && reader->data[position] == 0xFF && reader->data[position + 1] == 0xFF)
+    {
+        position++; // fill byte
+    }
+    if (position + 1 >= reader->length || reader->data[position] != 0xFF)
+    {
+        return -1;
+    }
+
+    reader->position = position + 2;
+    reader->bits = 0;
+    reader->count = 0;
+    reader->padding = 0;
+    reader->marker_hit = false;
+
+    return reader->data[position + 1];
+}
+
+/**
+ * Decodes one 8x8 block, accumulating the luma statistics if `quant` is set.
+ */
+static inline bool decode_block(bit_reader_t *reader, jpeg_decoder_t *decoder, jpeg_component_t *component,
+                                const uint16_t *quant, int64_t *dc_sum, uint64_t *ac_energy)
+{
+    int t = decode_huffman(reader, &decoder->dc[component->dc_table]);
+    if (t < 0 || t > 11)
+    {
+        return false;
+    }
+    component->dc_prediction += receive_extend(reader, t);
+
+    if (quant)
+    {
+        *dc_sum += component->dc_prediction * quant[0];
+    }
+
+    int k = 1;
+    const huffman_table_t *ac = &decoder->ac[component->ac_table];
+    while (k < 64)
+    {
+        int rs = decode_huffman(reader, ac);
+        if (rs < 0)
+        {
+            return false;
+        }
+
+        int run = rs >> 4;
+        int size = rs & 15;
+        if (size == 0)
+        {
+            if (run != 15)
+            {
+                break; // end of block
+            }
+            k += 16;
+            continue;
+        }
+
+        k += run;
+        if (k > 63)
+        {
+            return false;
+        }
+
+        int32_t value = receive_extend(reader, size);
+        if (quant)
+        {
+            int32_t dequantized = value * quant[k];
+            *ac_energy += (uint64_t)((int64_t)dequantized * dequantized);
+        }
+        k++;
+    }
+
+    return true;
+}
+
+static esp_err_t decode_scan(jpeg_decoder_t *decoder, const uint8_t *data, size_t length, frame_quality_t *out)
+{
+    bit_reader_t reader = {
+        .data = data,
+        .length = length,
+    };
+
+    int mcu_columns, mcu_rows;
+    if (decoder->component_count == 1)
+    {
+        // non interleaved scans have one block per mcu regardless of the sampling factors
+        decoder->components[0].h = 1;
+        decoder->components[0].v = 1;
+        decoder->h_max = 1;
+        decoder->v_max = 1;
+    }
+    mcu_columns = (decoder->width + 8 * decoder->h_max - 1) / (8 * decoder->h_max);
+    mcu_rows = (decoder->height + 8 * decoder->v_max - 1) / (8 * decoder->v_max);
+
+    int64_t dc_sum = 0;
+    uint64_t ac_energy = 0;
+    uint32_t luma_blocks = 0;
+    uint32_t mcu_total = (uint32_t)(mcu_columns * mcu_rows);
+
+    for (uint32_t mcu = 0; mcu < mcu_total; mcu++)
+    {
+        if (decoder->restart_interval && mcu && mcu % decoder->restart_interval == 0)
+        {
+            int marker = bit_reader_end_marker(&reader);
+            if (marker < 0xD0 || marker > 0xD7) // RSTn
+            {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            for (int c = 0; c < decoder->component_count; c++)
+            {
+                decoder->components[c].dc_prediction = 0;
+            }
+        }
+
+        for (int c = 0; c < decoder->component_count; c++)
+        {
+            jpeg_component_t *component = &decoder->components[c];
+            // the first component is the luma one
+            const uint16_t *quant = c == 0 ? decoder->quant[component->quant_table] : NULL;
+
+            for (int block = 0; block < component->h * component->v; block++)
+            {
+                if (!decode_block(&reader, decoder, component, quant, &dc_sum, &ac_energy))
+                {
+                    return ESP_ERR_INVALID_ARG;
+                }
+            }
+            if (quant)
+            {
+                luma_blocks += component->h * component->v;
+            }
+        }
+
+        if (bit_reader_overrun(&reader))
+        {
+            return ESP_ERR_INVALID_SIZE; // truncated scan
+        }
+    }
+
+    if (luma_blocks == 0 || bit_reader_end_marker(&reader) != 0xD9) // EOI
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // the dequantized dc coefficient is 8 times the mean of the block after the level shift of 128
+    float mean_luma = 128.0f + (float)dc_sum / (8.0f * (float)luma_blocks);
+    float sharpness = sqrtf((float)ac_energy / (float)luma_blocks);
+    float exposure_error = (mean_luma - 128.0f) / 128.0f;
+    float exposure_weight = 1.0f - exposure_error * exposure_error;
+
+    out->mean_luma = mean_luma;
+    out->sharpness = sharpness;
+    out->score = sharpness * (exposure_weight > 0.0f ? exposure_weight : 0.0f);
+    out->luma_blocks = luma_blocks;
+
+    return ESP_OK;
+}
+
+esp_err_t frame_quality_score(const uint8_t *jpeg, size_t jpeg_length, frame_quality_t *out)
+{
+    if (jpeg == NULL || out == NULL || jpeg_length < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // the tables take a few kilobytes, too much for the stack of the camera feed task, so one caller at a time
+    static jpeg_decoder_t decoder;
+    memset(&decoder, 0, sizeof(decoder));
+
+    bool frame_found = false;
+    size_t position = 2;
+
+    while (position + 4 <= jpeg_length)
+    {
+        if (jpeg[position] != 0xFF)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        uint8_t marker = jpeg[position + 1];
+        if (marker == 0xFF)
+        {
+            position++; // fill byte
+            continue;
+        }
+
+        uint16_t segment_length = read_u16(&jpeg[position + 2]);
+        const uint8_t *segment = &jpeg[position + 4];
+        size_t segment_end = position + 2 + segment_length;
+        if (segment_length < 2 || segment_end > jpeg_length)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        switch (marker)
+        {
+        case 0xDB: // DQT
+        {
+            size_t offset = 0;
+            while (offset < segment_length - 2u)
+            {
+                uint8_t precision = segment[offset] >> 4;
+                uint8_t id = segment[offset] & 3;
+                offset++;
+                if (offset + (precision ? 128 : 64) > segment_length - 2u)
+                {
+                    return ESP_ERR_INVALID_SIZE;
+                }
+                for (int i = 0; i < 64; i++)
+                {
+                    decoder.quant[id][i] = precision ? read_u16(&segment[offset + 2 * i]) : segment[offset + i];
+                }
+                offset += precision ? 128 : 64;
+            }
+            break;
+        }
+        case 0xC4: // DHT
+        {
+            size_t offset = 0;
+            while (offset + 17 <= segment_length - 2u)
+            {
+                uint8_t table_class = segment[offset] >> 4;
+                uint8_t id = segment[offset] & 3;
+                const uint8_t *counts = &segment[offset + 1];
+                size_t symbol_count = 0;
+                for (int i = 0; i < 16; i++)
+                {
+                    symbol_count += counts[i];
+                }
+                if (symbol_count > 256 || offset + 17 + symbol_count > segment_length - 2u)
+                {
+                    return ESP_ERR_INVALID_SIZE;
+                }
+                huffman_table_t *table = table_class ? &decoder.ac[id] : &decoder.dc[id];
+                if (!build_huffman_table(table, counts, &segment[offset + 17], symbol_count))
+                {
+                    return ESP_ERR_INVALID_ARG;
+                }
+                offset += 17 + symbol_count;
+            }
+            break;
+        }
+        case 0xC0: // SOF0, baseline
+        case 0xC1: // SOF1, extended sequential with huffman coding
+        {
+            if (segment_length - 2u < 6 || segment_length - 2u < 6 + 3u * segment[5])
+            {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            decoder.height = read_u16(&segment[1]);
+            decoder.width = read_u16(&segment[3]);
+            decoder.component_count = segment[5];
+            if (decoder.component_count == 0 || decoder.component_count > MAX_COMPONENTS || decoder.width == 0 || decoder.height == 0)
+            {
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+            for (int c = 0; c < decoder.component_count; c++)
+            {
+                jpeg_component_t *component = &decoder.components[c];
+                component->id = segment[6 + 3 * c];
+                component->h = segment[7 + 3 * c] >> 4;
+                component->v = segment[7 + 3 * c] & 15;
+                component->quant_table = segment[8 + 3 * c] & 3;
+                if (component->h == 0 || component->v == 0)
+                {
+                    return ESP_ERR_INVALID_ARG;
+                }
+                decoder.h_max = component->h > decoder.h_max ? component->h : decoder.h_max;
+                decoder.v_max = component->v > decoder.v_max ? component->v : decoder.v_max;
+            }
+            frame_found = true;
+            break;
+        }
+        case 0xC2: // progressive
+        case 0xC3: // lossless
+        case 0xC9: // arithmetic coding
+        case 0xCA:
+        case 0xCB:
+            return ESP_ERR_NOT_SUPPORTED;
+        case 0xDD: // DRI
+            if (segment_length - 2u < 2)
+            {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            decoder.restart_interval = read_u16(segment);
+            break;
+        case 0xDA: // SOS
+        {
+            if (segment_length - 2u < 1 + 2u * decoder.component_count)
+            {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            if (!frame_found || segment[0] != decoder.component_count)
+            {
+                // multi scan images are only possible with progressive coding
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+            for (int c = 0; c < decoder.component_count; c++)
+            {
+                jpeg_component_t *component = &decoder.components[c];
+                if (segment[1 + 2 * c] != component->id)
+                {
+                    return ESP_ERR_NOT_SUPPORTED;
+                }
+                component->dc_table = segment[2 + 2 * c] >> 4 & 3;
+                component->ac_table = segment[2 + 2 * c] & 3;
+                if (!decoder.dc[component->dc_table].present || !decoder.ac[component->ac_table].present)
+                {
+                    return ESP_ERR_INVALID_ARG;
+                }
+            }
+            return decode_scan(&decoder, &jpeg[segment_end], jpeg_length - segment_end, out);
+        }
+        case 0xD9: // EOI before any scan
+            return ESP_ERR_INVALID_SIZE;
+        default:
+            break; // APPn, COM and the likes
+        }
+
+        position = segment_end;
+    }
+
+    return ESP_ERR_INVALID_SIZE;
+}
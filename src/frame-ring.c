@@ -0,0 +1,115 @@
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+// local includes
+
+#include "globals.h"
+#include "frame-pool.h"
+#include "frame-ring.h"
+
+// --------------
+
+// only the camera feed task pushes, but the frames can be collected from other tasks
+static frame_slot_t *ring[FRAME_RING_SIZE];
+static size_t ring_head = 0; // index of the oldest frame
+static size_t ring_count = 0;
+static portMUX_TYPE frame_ring_lock = portMUX_INITIALIZER_UNLOCKED;
+
+int64_t frame_timestamp_us(const frame_slot_t *frame)
+{
+    return (int64_t)frame->fb.timestamp.tv_sec * 1000000L + (int64_t)frame->fb.timestamp.tv_usec;
+}
+
+void frame_ring_push(frame_slot_t *frame)
+{
+    if (frame == NULL)
+    {
+        return;
+    }
+
+    frame_slot_t *evicted = NULL;
+
+    taskENTER_CRITICAL(&frame_ring_lock);
+    if (ring_count == FRAME_RING_SIZE)
+    {
+        evicted = ring[ring_head];
+        ring_head = (ring_head + 1) % FRAME_RING_SIZE;
+        ring_count--;
+    }
+    ring[(ring_head + ring_count) % FRAME_RING_SIZE] = frame;
+    ring_count++;
+    taskEXIT_CRITICAL(&frame_ring_lock);
+
+    // releasing outside of the lock, it takes the pool's own lock
+    frame_pool_release(evicted);
+}
+
+bool frame_ring_drop_oldest()
+{
+    frame_slot_t *evicted = NULL;
+
+    taskENTER_CRITICAL(&frame_ring_lock);
+    if (ring_count > 0)
+    {
+        evicted = ring[ring_head];
+        ring_head = (ring_head + 1) % FRAME_RING_SIZE;
+        ring_count--;
+    }
+    taskEXIT_CRITICAL(&frame_ring_lock);
+
+    frame_pool_release(evicted);
+
+    return evicted != NULL;
+}
+
+size_t frame_ring_count_since(int64_t timestamp_us)
+{
+    size_t count = 0;
+
+    taskENTER_CRITICAL(&frame_ring_lock);
+    for (size_t i = 0; i < ring_count; i++)
+    {
+        if (frame_timestamp_us(ring[(ring_head + i) % FRAME_RING_SIZE]) >= timestamp_us)
+        {
+            count++;
+        }
+    }
+    taskEXIT_CRITICAL(&frame_ring_lock);
+
+    return count;
+}
+
+size_t frame_ring_get_around(int64_t timestamp_us, size_t before, size_t after, frame_slot_t **out, size_t out_length)
+{
+    size_t written = 0;
+
+    taskENTER_CRITICAL(&frame_ring_lock);
+
+    // the first frame captured at or after the timestamp splits the ring into before and after
+    size_t split = ring_count;
+    for (size_t i = 0; i < ring_count; i++)
+    {
+        if (frame_timestamp_us(ring[(ring_head + i) % FRAME_RING_SIZE]) >= timestamp_us)
+        {
+            split = i;
+            break;
+        }
+    }
+
+    size_t first = split > before ? split - before : 0;
+    size_t last = split + after < ring_count ? split + after : ring_count; // exclusive
+
+    for (size_t i = first; i < last && written < out_length; i++)
+    {
+        out[written] = ring[(ring_head + i) % FRAME_RING_SIZE];
+        // the pool lock nests inside the ring lock here, the pool never takes the ring lock
+        frame_pool_ref(out[written]);
+        written++;
+    }
+
+    taskEXIT_CRITICAL(&frame_ring_lock);
+
+    return written;
+}
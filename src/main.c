@@ -3,6 +3,7 @@
 */
 
 #include <stdio.h>
+#include <inttypes.h>
 #include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -11,6 +12,9 @@
 #include "esp_flash.h"
 #include "nvs_flash.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_netif.h"
+#include "esp_event.h"
 #include "driver/gpio.h"
 #include "driver/sdmmc_types.h"
 #include "rc522.h"
@@ -26,19 +30,48 @@
 
 #if defined USE_ESP32CAM == 1 // rfid reader and camera both use SPI protocol, so excluding camera when using rfid reader
 #include "camera.h"
-#define ESP32_CAM_LED_BUILTIN_PIN 33
 #define ESP32_CAM_CAMERA_FLASH_PIN 4 // This LED works with inverted logic, so you send a LOW signal to turn it on and a HIGH signal to turn it off.
 #endif
 
 #include "sd-card.h"
 #include "events.h"
+#include "trace.h"
+#include "benchmark.h"
+#include "upload.h"
+#include "connectivity.h"
+#include "offline-store.h"
+#include "flash-store.h"
+#include "attendance-log.h"
+#include "offline-drain.h"
+#include "roster.h"
+#include "roster-sync.h"
+#include "scan-feedback.h"
+#include "boot.h"
 
 // --------------
 
-#define LED_BUILTIN_PIN 2
+// the boot stages, see app_main()
+#define BOOT_NETWORK BIT0
+#define BOOT_ROSTER BIT1
+#define BOOT_SYNC BIT2
+#define BOOT_CAMERA BIT3
+#define BOOT_STORAGE BIT4
+#define BOOT_DRAIN BIT5
+#define BOOT_CAPTURE BIT6 // scans can be captured and stored
+#define BOOT_SCANNER BIT7 // the rc522 reads cards
+#define BOOT_STAGE_COUNT 8
 
 ESP_EVENT_DEFINE_BASE(RFID_A_S_EVENTS);
 
+static boot_stage_t boot_stages[BOOT_STAGE_COUNT];
+
+// set up by the boot stages
+static sdmmc_card_t *card = NULL;
+static rc522_handle_t rc522_scanner = NULL;
+static bool sd_store_ready = false;
+static bool flash_store_ready = false;
+static bool camera_ready = false;
+
 void initialize_nvs(void)
 {
     esp_err_t ret = nvs_flash_init();
@@ -50,6 +83,123 @@ void initialize_nvs(void)
     ESP_ERROR_CHECK(ret);
 }
 
+/**
+ * Wifi only starts connecting here, connectivity and the uploader work without it and catch up once it is there.
+ */
+static esp_err_t boot_network()
+{
+    wifi_init_sta();
+
+    // tracking whether the server is reachable, so scans don't have to find out
+    esp_err_t err = connectivity_init();
+
+    // one uploader task owns the connection to the server and drains the upload queue
+    return err == ESP_OK ? upload_init() : err;
+}
+
+/**
+ * The cards enrolled here, so unknown ones are turned away before they cost a capture.
+ */
+static esp_err_t boot_roster()
+{
+    esp_err_t err = scan_feedback_init();
+
+    // without a roster on the flash every card is let through until one is synced
+    roster_init();
+
+    return err;
+}
+
+static esp_err_t boot_sync()
+{
+    return roster_sync_init();
+}
+
+static esp_err_t boot_camera()
+{
+    // set some delay to clear up before initializing camera (if high power is consumed)
+    // vTaskDelay(1000/portTICK_PERIOD_MS);
+
+    esp_err_t err = camera_init();
+    camera_ready = err == ESP_OK;
+
+    return err;
+}
+
+static esp_err_t boot_storage()
+{
+    init_sd_card(&card);
+
+    sd_store_ready = card != NULL && ESP_OK == offline_store_init();
+    if (card != NULL && !sd_store_ready)
+    {
+        ESP_LOGE(TAG, "Couldn't open the offline store on the sdcard.");
+    }
+
+    if (card != NULL && ESP_OK != attendance_log_init())
+    {
+        ESP_LOGE(TAG, "Couldn't open the attendance log, scans are only recorded with their images.");
+    }
+
+    // the spill flash keeps the captures the sdcard can't
+    flash_store_ready = ESP_OK == flash_store_init();
+
+    if (!sd_store_ready && !flash_store_ready)
+    {
+        ESP_LOGE(TAG, "Neither the sdcard nor the spill flash are usable, captures can't be kept while offline.");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t boot_drain()
+{
+    if (!sd_store_ready && !flash_store_ready)
+    {
+        return ESP_OK;
+    }
+
+    // replaying what was stored while offline, whenever the server is reachable
+    return offline_drain_init();
+}
+
+static esp_err_t boot_capture()
+{
+    if (RUN_BENCHMARKS == 1)
+    {
+        // before the camera feed task takes over the camera
+        run_benchmarks(card);
+    }
+
+    if (!camera_ready)
+    {
+        // the feed task would take frames from a camera that isn't there
+        ESP_LOGE(TAG, "The camera didn't come up, scans aren't captured.");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // the reference to the card should be valid until it is deinitialized
+    // starting the camera feed task
+    if (pdPASS != xTaskCreate(start_camera_feed,
+                              "Camera_Feed_Task",
+                              4096,
+                              card,
+                              CAMERA_FEED_TASK_PRIORITY,
+                              &camera_feed_task_handle))
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t boot_scanner()
+{
+    // initialize rfid stuffs
+    return initialize_rc522(&rc522_scanner);
+}
+
 void app_main(void)
 {
     /* Print chip information */
@@ -79,63 +229,61 @@ void app_main(void)
     ESP_LOGI(TAG, "Initializing nvs\n");
     initialize_nvs();
 
-    // if not connected to wifi
-    // try connecting to wifi
-    ESP_LOGI(TAG, "ESP_WIFI_MODE_STA\n");
-    wifi_init_sta();
-
-    // set some delay to clear up before initializing camera (if high power is consumed)
-    // vTaskDelay(1000/portTICK_PERIOD_MS);
+    // everything below posts to or listens on the default event loop
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
 
-    sdmmc_card_t *card = NULL;
-
-    rc522_handle_t scanner = NULL;
+    // the stages run side by side, nothing waits for the AP, captures are stored until the uplink is there
+    size_t stage_count = 0;
+    boot_stages[stage_count++] = (boot_stage_t){.name = "network", .bit = BOOT_NETWORK, .run = boot_network};
+    boot_stages[stage_count++] = (boot_stage_t){.name = "roster", .bit = BOOT_ROSTER, .run = boot_roster};
+    boot_stages[stage_count++] = (boot_stage_t){.name = "sync", .bit = BOOT_SYNC, .depends_on = BOOT_NETWORK | BOOT_ROSTER, .run = boot_sync};
 
     /** Not using when using rc522 as both use SPI protocol */
     if (USE_ESP32CAM == 1)
     {
-        // initialize spiffs
-        initialize_spiffs();
-
-        // initializing the camera
-        camera_init();
-
-        init_sd_card(&card);
-
-        // the reference to the card should be valid until it is deinitialized
-        // starting the camera feed task
-        xTaskCreate(start_camera_feed,
-                    "Camera_Feed_Task",
-                    4096,
-                    card,
-                    CAMERA_FEED_TASK_PRIORITY,
-                    &camera_feed_task_handle);
+        boot_stages[stage_count++] = (boot_stage_t){.name = "camera", .bit = BOOT_CAMERA, .run = boot_camera};
+        boot_stages[stage_count++] = (boot_stage_t){.name = "storage", .bit = BOOT_STORAGE, .run = boot_storage};
+        boot_stages[stage_count++] = (boot_stage_t){.name = "drain", .bit = BOOT_DRAIN, .depends_on = BOOT_NETWORK | BOOT_STORAGE, .run = boot_drain};
+        // the uploader has to be there to take the captures, not the connection
+        boot_stages[stage_count++] = (boot_stage_t){.name = "capture", .bit = BOOT_CAPTURE, .depends_on = BOOT_NETWORK | BOOT_ROSTER | BOOT_CAMERA | BOOT_STORAGE, .run = boot_capture};
     }
 
     if (USE_RC522 == 1)
     {
-        // initialize rfid stuffs
-        initialize_rc522(&scanner);
+        boot_stages[stage_count++] = (boot_stage_t){.name = "scanner", .bit = BOOT_SCANNER, .depends_on = BOOT_ROSTER, .run = boot_scanner};
     }
 
-    // blinking led every 500ms
-    gpio_set_direction(LED_BUILTIN_PIN, GPIO_MODE_OUTPUT);
-#if defined USE_ESP32CAM == 1
-    if (USE_ESP32CAM == 1)
+    EventBits_t all_stages = 0;
+    for (size_t i = 0; i < stage_count; i++)
     {
-        gpio_set_direction(ESP32_CAM_LED_BUILTIN_PIN, GPIO_MODE_OUTPUT);
-        // gpio_set_direction(ESP32_CAM_CAMERA_FLASH_PIN, GPIO_MODE_OUTPUT);
+        all_stages |= boot_stages[i].bit;
     }
-#endif
+    EventBits_t scan_ready = (USE_ESP32CAM == 1 ? BOOT_CAPTURE : 0) | (USE_RC522 == 1 ? BOOT_SCANNER : 0);
+
+    ESP_ERROR_CHECK(boot_start(boot_stages, stage_count));
 
+    boot_wait(scan_ready, portMAX_DELAY);
+    ESP_LOGI(TAG, "Scan ready %" PRId64 " ms after boot, wifi %s", esp_timer_get_time() / 1000,
+             s_wifi_event_group != NULL && (WIFI_CONNECTED_BIT & xEventGroupGetBits(s_wifi_event_group)) ? "connected" : "still connecting");
+
+    boot_wait(all_stages, portMAX_DELAY);
+    boot_log_stages(boot_stages, stage_count);
+
+    // periodically reporting where the time of each scan goes
+    xTaskCreate(trace_export_task,
+                "Trace_Export_Task",
+                TASK_TRACE_EXPORT_STACK_SIZE,
+                NULL,
+                TRACE_EXPORT_TASK_PRIORITY,
+                NULL);
+
+    // the leds belong to scan_feedback, this loop only mocks a scan every 10 seconds
     uint count = 0;
     while (1) // debug
     {
         count += 1;
-        vTaskDelay(500 / portTICK_PERIOD_MS);
-        gpio_set_level(LED_BUILTIN_PIN, 1);
-        vTaskDelay(500 / portTICK_PERIOD_MS);
-        gpio_set_level(LED_BUILTIN_PIN, 0);
+        vTaskDelay(1000 / portTICK_PERIOD_MS);
 
         // mock rfid scan
         if (USE_ESP32CAM == 1)
@@ -145,22 +293,20 @@ void app_main(void)
             };
 
             rfid_a_s_event_data_t _data = {
-                .tag = &tag};
+                .tag = tag};
 
-            if (count % 10 == 0)
+            if (count % 10 == 0 && ROSTER_UNKNOWN == roster_lookup(tag.serial_number))
+            {
+                ESP_LOGW(TAG, "The mock serial number isn't on the roster, not mocking a scan");
+                scan_feedback_show(false);
+            }
+            else if (count % 10 == 0)
             {
+                scan_feedback_show(true);
                 ESP_LOGI(TAG, "Mocking a rfid scan");
+                _data.scan_id = trace_begin_scan();
                 esp_event_post(RFID_A_S_EVENTS, RFID_A_S_RFID_SCANNED, &_data, sizeof(rfid_a_s_event_data_t), portMAX_DELAY);
             }
         }
-
-        if (USE_ESP32CAM == 1)
-        {
-            // for esp32-cam
-            vTaskDelay(500 / portTICK_PERIOD_MS);
-            gpio_set_level(ESP32_CAM_LED_BUILTIN_PIN, 0); // on
-            vTaskDelay(500 / portTICK_PERIOD_MS);
-            gpio_set_level(ESP32_CAM_LED_BUILTIN_PIN, 1); // off
-        }
     }
 }
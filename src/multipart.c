@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+// local includes
+
+#include "multipart.h"
+
+// --------------
+
+static const char *_CONTENT_DISPOSITION = "Content-Disposition: form-data; name=\"upfile\"; filename=\"%s\"\r\n";
+static const char *_PART_HEADERS = "Content-Type: image/jpeg\r\nrfid-serial-number: %" PRIu64 "\r\nscan-time: %" PRId64 "\r\n\r\n";
+static const char _STREAM_BOUNDARY[] = "\r\n--" MULTIPART_BOUNDARY "\r\n";
+static const char _MULTIPART_FORM_DATA_BODY_END[] = "\r\n--" MULTIPART_BOUNDARY "--\r\n";
+
+int build_multipart_part_header(char *out, size_t out_length, const char *filename, uint64_t serial_number, int64_t scan_time_ms)
+{
+    int written = snprintf(out, out_length, "%s", _STREAM_BOUNDARY); // boundary start
+    if (written < 0 || (size_t)written >= out_length)
+    {
+        return -1;
+    }
+
+    int n = snprintf(out + written, out_length - written, _CONTENT_DISPOSITION, filename); // content disposition with filename
+    if (n < 0 || (size_t)n >= out_length - written)
+    {
+        return -1;
+    }
+    written += n;
+
+    n = snprintf(out + written, out_length - written, _PART_HEADERS, serial_number, scan_time_ms);
+    if (n < 0 || (size_t)n >= out_length - written)
+    {
+        return -1;
+    }
+
+    return written + n;
+}
+
+void multipart_body_init(multipart_body_t *body)
+{
+    body->part_count = 0;
+    body->segment_count = 0;
+    body->content_length = 0;
+}
+
+int multipart_body_add_jpeg(multipart_body_t *body, uint64_t serial_number, int64_t scan_time_ms, const uint8_t *jpeg, size_t length)
+{
+    char filename[48];
+
+    if (body->part_count == MULTIPART_MAX_PARTS || body->segment_count != 2 * body->part_count)
+    {
+        return -1;
+    }
+
+    snprintf(filename, sizeof(filename), "%" PRIu64 "_%" PRId64 ".jpg", serial_number, scan_time_ms);
+
+    char *header = body->headers[body->part_count];
+    int header_length = build_multipart_part_header(header, MULTIPART_PART_HEADER_SIZE, filename, serial_number, scan_time_ms);
+    if (header_length < 0)
+    {
+        return -1;
+    }
+
+    body->segments[body->segment_count++] = (multipart_segment_t){.data = header, .length = header_length};
+    body->segments[body->segment_count++] = (multipart_segment_t){.data = jpeg, .length = length};
+    body->content_length += header_length + length;
+    body->part_count++;
+
+    return 0;
+}
+
+void multipart_body_finish(multipart_body_t *body)
+{
+    size_t length = sizeof(_MULTIPART_FORM_DATA_BODY_END) - 1;
+
+    body->segments[body->segment_count++] = (multipart_segment_t){.data = _MULTIPART_FORM_DATA_BODY_END, .length = length};
+    body->content_length += length;
+}
+
+int multipart_write_segments(const multipart_segment_t *segments, size_t count, multipart_write_fn write, void *context)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const char *data = segments[i].data;
+        size_t left = segments[i].length;
+
+        // an empty segment isn't written at all, a 0 length write could be taken for a closed connection
+        while (left > 0)
+        {
+            int written = write(context, data, left);
+            if (written <= 0)
+            {
+                return -1;
+            }
+            data += written;
+            left -= written;
+        }
+    }
+
+    return 0;
+}
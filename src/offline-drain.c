@@ -0,0 +1,192 @@
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_err.h"
+
+// local includes
+
+#include "globals.h"
+#include "offline-drain.h"
+#include "offline-store.h"
+#include "flash-store.h"
+#include "connectivity.h"
+#include "frame-pool.h"
+#include "upload.h"
+
+// --------------
+
+// the result of the capture handed to the uploader, there is only ever one in flight
+static QueueHandle_t drain_result_queue = NULL;
+
+void offline_drain_on_upload(const rfid_a_s_event_data_t *capture, esp_err_t result)
+{
+    if (drain_result_queue == NULL || !capture->stored)
+    {
+        return;
+    }
+
+    xQueueOverwrite(drain_result_queue, &result);
+}
+
+static uint32_t backlog()
+{
+    return flash_store_backlog() + offline_store_backlog();
+}
+
+/**
+ * Hands the oldest stored capture to the uploader and waits for the result. The spill flash goes first, it is the
+ * smaller store and the first to evict.
+ * Returns ESP_ERR_NOT_FOUND if there was nothing to send, or the frame pool had no slot to spare, and
+ * ESP_ERR_INVALID_SIZE if the oldest capture was dropped.
+ */
+static esp_err_t drain_one(size_t *out_length)
+{
+    offline_record_header_t header;
+    esp_err_t result;
+
+    // the camera's frames come first
+    if (frame_pool_free_slots() <= OFFLINE_DRAIN_MIN_FREE_SLOTS)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    frame_slot_t *frame = frame_pool_claim();
+    if (frame == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    bool from_flash = flash_store_backlog() > 0;
+    esp_err_t (*consume_oldest)() = from_flash ? flash_store_consume_oldest : offline_store_consume_oldest;
+
+    esp_err_t err = from_flash ? flash_store_read_oldest(&header, frame->fb.buf, frame->capacity)
+                               : offline_store_read_oldest(&header, frame->fb.buf, frame->capacity);
+    if (err == ESP_ERR_INVALID_SIZE)
+    {
+        // never was a frame of this device, it would block the backlog forever
+        ESP_LOGE(TAG, "Dropping a stored capture larger than a frame pool slot.");
+        consume_oldest();
+    }
+    if (err != ESP_OK)
+    {
+        frame_pool_release(frame);
+        return err;
+    }
+
+    frame->fb.len = header.length;
+    frame->fb.format = PIXFORMAT_JPEG;
+    frame->fb.width = 0;
+    frame->fb.height = 0;
+
+    rfid_a_s_event_data_t capture = {
+        .tag.serial_number = header.serial_number,
+        .scan_wall_time_ms = header.scan_time_ms,
+        .frame = frame,
+        .stored = true,
+    };
+
+    xQueueReset(drain_result_queue); // a late result of a capture that timed out
+
+    // the reference of the claimed slot is handed over to the uploader
+    if (ESP_OK != (err = upload_enqueue(&capture)))
+    {
+        frame_pool_release(frame);
+        return err;
+    }
+
+    if (pdTRUE != xQueueReceive(drain_result_queue, &result, OFFLINE_DRAIN_UPLOAD_TIMEOUT_MS / portTICK_PERIOD_MS))
+    {
+        result = ESP_ERR_TIMEOUT;
+    }
+
+    if (result == ESP_OK)
+    {
+        *out_length = header.length;
+        return consume_oldest();
+    }
+
+    return result;
+}
+
+void offline_drain_task(void *args)
+{
+    uint32_t drained = 0;
+    uint64_t drained_bytes = 0;
+    int64_t report_start = esp_timer_get_time();
+
+    while (1)
+    {
+        int64_t now = esp_timer_get_time();
+        if (now - report_start >= (int64_t)OFFLINE_DRAIN_REPORT_INTERVAL_MS * 1000)
+        {
+            if (drained > 0 || backlog() > 0)
+            {
+                double seconds = (now - report_start) / 1000000.0;
+                ESP_LOGI(TAG, "Offline backlog: %" PRIu32 " captures left, %" PRIu32 " drained in %.0f s (%.1f/min, %.1f KB/s)",
+                         backlog(), drained, seconds, drained * 60.0 / seconds, drained_bytes / 1024.0 / seconds);
+            }
+            drained = 0;
+            drained_bytes = 0;
+            report_start = now;
+        }
+
+        if (backlog() == 0 || !connectivity_server_reachable())
+        {
+            vTaskDelay(OFFLINE_DRAIN_IDLE_MS / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        // live scans always go first, the uplink is only taken while their queue is empty
+        if (upload_queue_depth() > 0)
+        {
+            vTaskDelay(OFFLINE_DRAIN_PACE_MS / portTICK_PERIOD_MS);
+            continue;
+        }
+
+        size_t length = 0;
+        esp_err_t err = drain_one(&length);
+        if (err == ESP_OK)
+        {
+            drained++;
+            drained_bytes += length;
+            vTaskDelay(OFFLINE_DRAIN_PACE_MS / portTICK_PERIOD_MS);
+        }
+        else if (err == ESP_ERR_NOT_FOUND || err == ESP_ERR_TIMEOUT || err == ESP_ERR_INVALID_SIZE)
+        {
+            // nothing to send right now, the upload queue filled up in between, or a capture was dropped
+            vTaskDelay(OFFLINE_DRAIN_PACE_MS / portTICK_PERIOD_MS);
+        }
+        else
+        {
+            ESP_LOGW(TAG, "Couldn't upload a stored capture (error : %s), retrying later.", esp_err_to_name(err));
+            vTaskDelay(OFFLINE_DRAIN_RETRY_MS / portTICK_PERIOD_MS);
+        }
+    }
+
+    vTaskDelete(NULL);
+}
+
+esp_err_t offline_drain_init()
+{
+    drain_result_queue = xQueueCreate(1, sizeof(esp_err_t));
+    if (drain_result_queue == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (pdPASS != xTaskCreate(offline_drain_task,
+                              "Offline_Drain_Task",
+                              TASK_OFFLINE_DRAIN_STACK_SIZE,
+                              NULL,
+                              OFFLINE_DRAIN_TASK_PRIORITY,
+                              NULL))
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
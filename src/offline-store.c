@@ -0,0 +1,787 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include "sys/stat.h"
+#include "unistd.h"
+
+#include "driver/sdmmc_types.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_rom_crc.h"
+#include "esp_log.h"
+#include "esp_err.h"
+
+// local includes
+
+#include "globals.h"
+#include "offline-store.h"
+#include "sd-card.h"
+#include "flash-store.h"
+#include "sd-writer.h"
+
+// --------------
+
+#define SEGMENT_EXTENSION "log"
+#define INDEX_EXTENSION "idx"
+#define SEGMENT_PATH_LENGTH 32     // /sdcard/log/0000002a.log, 8.3 names work without long filename support
+#define VERIFY_BUFFER_SIZE 4096
+
+/**
+ * The oldest record not yet consumed, by its position in the index.
+ */
+typedef struct offline_checkpoint_t
+{
+    uint32_t segment;
+    uint32_t record;
+    uint32_t crc; // of the fields above
+} offline_checkpoint_t;
+
+static SemaphoreHandle_t store_lock = NULL;
+static bool store_ready = false; // the log is readable, even while no segment is open for writing
+static FILE *segment_file = NULL; // NULL while creating the next segment fails (a full card), retried on every append
+static sd_writer_t segment_writer; // all writes to `segment_file` go through it
+static FILE *index_file = NULL;
+static uint32_t oldest_segment = 0;
+static uint32_t current_segment = 0;
+static uint32_t write_offset = 0;    // where the next record of the current segment goes
+static uint32_t current_records = 0; // records in the current segment
+static offline_checkpoint_t checkpoint;
+static uint32_t backlog_records = 0;
+static uint32_t unsynced_records = 0; // appended since the last sync, see OFFLINE_STORE_SYNC_INTERVAL
+
+// only used with `store_lock` held (or before the store is up)
+static uint8_t verify_buffer[VERIFY_BUFFER_SIZE];
+
+static void segment_path(uint32_t segment, const char *extension, char *out, size_t out_length)
+{
+    snprintf(out, out_length, OFFLINE_STORE_ROOT "/%08" PRIx32 ".%s", segment, extension);
+}
+
+static uint32_t record_size(uint32_t length)
+{
+    return sizeof(offline_record_header_t) + ((length + 3) & ~3u);
+}
+
+static uint32_t index_entry_crc(offline_index_entry_t entry)
+{
+    entry.entry_crc = 0;
+    return esp_rom_crc32_le(0, (const uint8_t *)&entry, sizeof(entry));
+}
+
+static uint32_t record_crc(offline_record_header_t header, const uint8_t *jpeg, size_t length)
+{
+    header.crc = 0;
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&header, sizeof(header));
+    return esp_rom_crc32_le(crc, jpeg, length);
+}
+
+/**
+ * Reads the record at `offset` and checks it belongs to `segment` and its crc matches.
+ */
+static bool verify_record(FILE *f, uint32_t segment, uint32_t offset, offline_record_header_t *out)
+{
+    offline_record_header_t header;
+
+    if (offset + sizeof(header) > OFFLINE_SEGMENT_SIZE ||
+        0 != fseek(f, offset, SEEK_SET) ||
+        1 != fread(&header, sizeof(header), 1, f))
+    {
+        return false;
+    }
+
+    if (header.magic != OFFLINE_RECORD_MAGIC || header.segment != segment ||
+        header.length > OFFLINE_SEGMENT_SIZE - offset - sizeof(header))
+    {
+        return false;
+    }
+
+    offline_record_header_t crc_header = header;
+    crc_header.crc = 0;
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&crc_header, sizeof(crc_header));
+
+    for (uint32_t done = 0; done < header.length;)
+    {
+        size_t length = header.length - done < VERIFY_BUFFER_SIZE ? header.length - done : VERIFY_BUFFER_SIZE;
+        if (length != fread(verify_buffer, 1, length, f))
+        {
+            return false;
+        }
+        crc = esp_rom_crc32_le(crc, verify_buffer, length);
+        done += length;
+    }
+
+    if (crc != header.crc)
+    {
+        return false;
+    }
+
+    *out = header;
+    return true;
+}
+
+static esp_err_t append_index_entry(const offline_record_header_t *header, uint32_t offset, bool sync)
+{
+    offline_index_entry_t entry = {
+        .offset = offset,
+        .length = header->length,
+        .serial_number = header->serial_number,
+        .scan_time_ms = header->scan_time_ms,
+        .crc = header->crc,
+    };
+    entry.entry_crc = index_entry_crc(entry);
+
+    if (1 != fwrite(&entry, sizeof(entry), 1, index_file))
+    {
+        return ESP_FAIL;
+    }
+    if (sync)
+    {
+        if (0 != fflush(index_file))
+        {
+            return ESP_FAIL;
+        }
+        fsync(fileno(index_file));
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Puts the records appended since the last sync on the card, segment first so an index entry never points past
+ * what was written.
+ */
+static esp_err_t sync_segment()
+{
+    if (unsynced_records == 0)
+    {
+        return ESP_OK;
+    }
+
+    if (ESP_OK != sd_writer_flush(&segment_writer, true) || 0 != fflush(index_file))
+    {
+        return ESP_FAIL;
+    }
+    fsync(fileno(index_file));
+    unsynced_records = 0;
+
+    return ESP_OK;
+}
+
+/**
+ * Creates the segment with all of its clusters allocated up front, so appending never has to grow the file,
+ * along with its empty index.
+ */
+static esp_err_t create_segment(uint32_t segment)
+{
+    char path[SEGMENT_PATH_LENGTH];
+
+    segment_path(segment, SEGMENT_EXTENSION, path, sizeof(path));
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        ESP_LOGE(TAG, "Couldn't create segment %s", path);
+        return ESP_FAIL;
+    }
+
+    bool allocated = !OFFLINE_STORE_PREALLOCATE || ESP_OK == sd_writer_preallocate(f, OFFLINE_SEGMENT_SIZE);
+    fclose(f);
+    if (!allocated)
+    {
+        ESP_LOGE(TAG, "Couldn't allocate %d bytes for segment %s", OFFLINE_SEGMENT_SIZE, path);
+        unlink(path);
+        return ESP_FAIL;
+    }
+
+    segment_file = fopen(path, "r+b");
+
+    char index_filepath[SEGMENT_PATH_LENGTH];
+    segment_path(segment, INDEX_EXTENSION, index_filepath, sizeof(index_filepath));
+    index_file = fopen(index_filepath, "wb");
+
+    if (segment_file == NULL || index_file == NULL ||
+        ESP_OK != sd_writer_open(&segment_writer, segment_file, OFFLINE_STORE_WRITE_BUFFER_SIZE))
+    {
+        // not left half made, the next attempt starts over with the same segment
+        ESP_LOGE(TAG, "Couldn't open segment %s", path);
+        if (segment_file != NULL)
+        {
+            fclose(segment_file);
+            segment_file = NULL;
+        }
+        if (index_file != NULL)
+        {
+            fclose(index_file);
+            index_file = NULL;
+        }
+        unlink(path);
+        unlink(index_filepath);
+        return ESP_FAIL;
+    }
+
+    current_segment = segment;
+    write_offset = 0;
+    current_records = 0;
+
+    ESP_LOGI(TAG, "Offline store segment %08" PRIx32 " created", segment);
+
+    return ESP_OK;
+}
+
+static void close_segment()
+{
+    if (segment_file != NULL)
+    {
+        sync_segment();
+        sd_writer_close(&segment_writer);
+        fclose(segment_file);
+        segment_file = NULL;
+        unsynced_records = 0;
+    }
+    if (index_file != NULL)
+    {
+        fclose(index_file);
+        index_file = NULL;
+    }
+}
+
+/**
+ * Reopens the segment after a reboot, cutting back the index to the records that check out and indexing any
+ * record written after the last index entry.
+ */
+static esp_err_t recover_segment(uint32_t segment)
+{
+    char segment_filepath[SEGMENT_PATH_LENGTH];
+    char index_filepath[SEGMENT_PATH_LENGTH];
+    offline_index_entry_t entry;
+    offline_record_header_t header;
+    uint32_t count = 0;
+    uint32_t offset = 0;
+
+    segment_path(segment, SEGMENT_EXTENSION, segment_filepath, sizeof(segment_filepath));
+    segment_path(segment, INDEX_EXTENSION, index_filepath, sizeof(index_filepath));
+
+    segment_file = fopen(segment_filepath, "r+b");
+    if (segment_file == NULL)
+    {
+        return ESP_FAIL;
+    }
+
+    // the entries up to the first torn one
+    FILE *f = fopen(index_filepath, "rb");
+    if (f != NULL)
+    {
+        while (1 == fread(&entry, sizeof(entry), 1, f) && entry.entry_crc == index_entry_crc(entry) &&
+               entry.offset == offset)
+        {
+            offset = entry.offset + record_size(entry.length);
+            count++;
+        }
+
+        // the records are written before their entries, but the card may not have kept them
+        while (count > 0)
+        {
+            fseek(f, (count - 1) * sizeof(entry), SEEK_SET);
+            if (1 == fread(&entry, sizeof(entry), 1, f) && verify_record(segment_file, segment, entry.offset, &header))
+            {
+                break;
+            }
+            count--;
+            offset = entry.offset;
+        }
+        fclose(f);
+    }
+
+    if (0 != truncate(index_filepath, count * sizeof(entry)))
+    {
+        // the index doesn't exist yet
+        FILE *created = fopen(index_filepath, "wb");
+        if (created != NULL)
+        {
+            fclose(created);
+        }
+    }
+
+    index_file = fopen(index_filepath, "ab");
+    if (index_file == NULL)
+    {
+        return ESP_FAIL;
+    }
+
+    // records which made it to the card without their index entry
+    uint32_t indexed = count;
+    while (verify_record(segment_file, segment, offset, &header))
+    {
+        if (ESP_OK != append_index_entry(&header, offset, true))
+        {
+            return ESP_FAIL;
+        }
+        offset += record_size(header.length);
+        count++;
+    }
+
+    if (ESP_OK != sd_writer_open(&segment_writer, segment_file, OFFLINE_STORE_WRITE_BUFFER_SIZE))
+    {
+        return ESP_FAIL;
+    }
+
+    current_segment = segment;
+    write_offset = offset;
+    current_records = count;
+
+    ESP_LOGI(TAG, "Offline store segment %08" PRIx32 " recovered: %" PRIu32 " records (%" PRIu32 " reindexed), %" PRIu32 " bytes used",
+             segment, count, count - indexed, offset);
+
+    return ESP_OK;
+}
+
+/**
+ * Finds the oldest and the newest segment, both 0 if there are none.
+ */
+static void find_segments(uint32_t *oldest, uint32_t *newest)
+{
+    *oldest = 0;
+    *newest = 0;
+
+    DIR *dir = opendir(OFFLINE_STORE_ROOT);
+    if (dir == NULL)
+    {
+        return;
+    }
+
+    struct dirent *ent;
+    while (NULL != (ent = readdir(dir)))
+    {
+        // without long filename support fatfs reports the names in upper case
+        char *extension = strchr(ent->d_name, '.');
+        if (extension == NULL || 0 != strcasecmp(extension + 1, SEGMENT_EXTENSION))
+        {
+            continue;
+        }
+
+        uint32_t segment = strtoul(ent->d_name, NULL, 16);
+        if (segment == 0)
+        {
+            continue;
+        }
+
+        *oldest = (*oldest == 0 || segment < *oldest) ? segment : *oldest;
+        *newest = segment > *newest ? segment : *newest;
+    }
+
+    closedir(dir);
+}
+
+static uint32_t checkpoint_crc(const offline_checkpoint_t *c)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)c, offsetof(offline_checkpoint_t, crc));
+}
+
+static esp_err_t save_checkpoint()
+{
+    checkpoint.crc = checkpoint_crc(&checkpoint);
+
+    FILE *f = fopen(OFFLINE_CHECKPOINT_PATH, "wb");
+    if (f == NULL)
+    {
+        return ESP_FAIL;
+    }
+
+    bool written = 1 == fwrite(&checkpoint, sizeof(checkpoint), 1, f) && 0 == fflush(f);
+    fsync(fileno(f));
+    fclose(f);
+
+    return written ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * The number of records in the segment, going by its index.
+ */
+static uint32_t segment_records(uint32_t segment)
+{
+    if (segment == current_segment)
+    {
+        return current_records;
+    }
+
+    char path[SEGMENT_PATH_LENGTH];
+    struct stat st;
+    segment_path(segment, INDEX_EXTENSION, path, sizeof(path));
+    if (0 != stat(path, &st))
+    {
+        return 0;
+    }
+
+    return st.st_size / sizeof(offline_index_entry_t);
+}
+
+static void load_checkpoint()
+{
+    FILE *f = fopen(OFFLINE_CHECKPOINT_PATH, "rb");
+    bool valid = false;
+
+    if (f != NULL)
+    {
+        valid = 1 == fread(&checkpoint, sizeof(checkpoint), 1, f) && checkpoint.crc == checkpoint_crc(&checkpoint) &&
+                checkpoint.segment >= oldest_segment && checkpoint.segment <= current_segment;
+        fclose(f);
+    }
+
+    if (!valid)
+    {
+        // nothing consumed yet (or the checkpoint was lost, resending is better than losing records)
+        checkpoint.segment = oldest_segment;
+        checkpoint.record = 0;
+    }
+
+    backlog_records = 0;
+    for (uint32_t segment = checkpoint.segment; segment <= current_segment; segment++)
+    {
+        backlog_records += segment_records(segment);
+    }
+    backlog_records = backlog_records > checkpoint.record ? backlog_records - checkpoint.record : 0;
+}
+
+esp_err_t offline_store_init()
+{
+    if (store_lock == NULL && NULL == (store_lock = xSemaphoreCreateMutex()))
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+
+    close_segment();
+    store_ready = false;
+
+    struct stat st;
+    if (0 != stat(OFFLINE_STORE_ROOT, &st))
+    {
+        int mk_ret = mkdir(OFFLINE_STORE_ROOT, 0775);
+        ESP_LOGI(TAG, "mkdir %s returned %d", OFFLINE_STORE_ROOT, mk_ret);
+    }
+
+    uint32_t newest;
+    find_segments(&oldest_segment, &newest);
+
+    esp_err_t ret;
+    if (newest == 0)
+    {
+        oldest_segment = 1;
+        ret = create_segment(1);
+    }
+    else
+    {
+        ret = recover_segment(newest);
+    }
+
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Couldn't open the offline store under " OFFLINE_STORE_ROOT);
+        close_segment();
+    }
+    else
+    {
+        store_ready = true;
+        load_checkpoint();
+        ESP_LOGI(TAG, "Offline store backlog: %" PRIu32 " records from segment %08" PRIx32 " record %" PRIu32,
+                 backlog_records, checkpoint.segment, checkpoint.record);
+    }
+
+    xSemaphoreGive(store_lock);
+
+    return ret;
+}
+
+static esp_err_t append_record(uint64_t serial_number, int64_t scan_time_ms, const uint8_t *jpeg, size_t length)
+{
+    static const uint8_t padding[3] = {0};
+
+    if (!store_ready)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint32_t size = record_size(length);
+    if (size > OFFLINE_SEGMENT_SIZE)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // the current segment is full, or creating the next one failed before and is tried again
+    if (segment_file == NULL || write_offset + size > OFFLINE_SEGMENT_SIZE)
+    {
+        close_segment();
+        esp_err_t ret = create_segment(current_segment + 1);
+        if (ret != ESP_OK)
+        {
+            return ret;
+        }
+    }
+
+    offline_record_header_t header = {
+        .magic = OFFLINE_RECORD_MAGIC,
+        .segment = current_segment,
+        .length = length,
+        .serial_number = serial_number,
+        .scan_time_ms = scan_time_ms,
+    };
+    header.crc = record_crc(header, jpeg, length);
+
+    // a failed write leaves `write_offset` where it was, the next record overwrites the torn one
+    if (ESP_OK != sd_writer_seek(&segment_writer, write_offset) ||
+        ESP_OK != sd_writer_write(&segment_writer, &header, sizeof(header)) ||
+        ESP_OK != sd_writer_write(&segment_writer, jpeg, length) ||
+        ESP_OK != sd_writer_write(&segment_writer, padding, size - sizeof(header) - length))
+    {
+        return ESP_FAIL;
+    }
+
+    bool sync = unsynced_records + 1 >= OFFLINE_STORE_SYNC_INTERVAL;
+    if (sync && ESP_OK != sd_writer_flush(&segment_writer, true))
+    {
+        return ESP_FAIL;
+    }
+
+    // once synced the record is on the card, without its index entry it would still be found on recovery
+    esp_err_t ret = append_index_entry(&header, write_offset, sync);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    unsynced_records = sync ? 0 : unsynced_records + 1;
+    write_offset += size;
+    current_records++;
+    backlog_records++;
+
+    return ESP_OK;
+}
+
+esp_err_t offline_store_append(uint64_t serial_number, int64_t scan_time_ms, const uint8_t *jpeg, size_t length)
+{
+    if (jpeg == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+    if (!OFFLINE_STORE_USE_SEGMENT_LOG)
+    {
+        ret = save_image_to_sdcard(jpeg, length, serial_number);
+    }
+    else if (store_lock != NULL)
+    {
+        xSemaphoreTake(store_lock, portMAX_DELAY);
+        ret = append_record(serial_number, scan_time_ms, jpeg, length);
+        xSemaphoreGive(store_lock);
+    }
+
+    if (ret == ESP_OK)
+    {
+        return ESP_OK;
+    }
+
+    // no card, or a full or failing one: the spill flash keeps the capture until it is sent
+    if (ret != ESP_ERR_INVALID_STATE)
+    {
+        ESP_LOGW(TAG, "Couldn't store the capture on the sdcard (error : %s), spilling it to flash.", esp_err_to_name(ret));
+    }
+
+    return flash_store_append(serial_number, scan_time_ms, jpeg, length);
+}
+
+static void delete_segment(uint32_t segment)
+{
+    char path[SEGMENT_PATH_LENGTH];
+
+    segment_path(segment, SEGMENT_EXTENSION, path, sizeof(path));
+    unlink(path);
+    segment_path(segment, INDEX_EXTENSION, path, sizeof(path));
+    unlink(path);
+
+    oldest_segment = segment + 1;
+    ESP_LOGI(TAG, "Offline store segment %08" PRIx32 " consumed and deleted", segment);
+}
+
+/**
+ * Moves the checkpoint into the next segment for as long as the one it is in is exhausted.
+ * The current segment is only deleted while it is closed, which frees its space for the next one on a full card.
+ * Returns whether it moved.
+ */
+static bool skip_exhausted_segments()
+{
+    bool moved = false;
+
+    while ((checkpoint.segment < current_segment || (checkpoint.segment == current_segment && segment_file == NULL)) &&
+           checkpoint.record >= segment_records(checkpoint.segment))
+    {
+        delete_segment(checkpoint.segment);
+        checkpoint.segment++;
+        checkpoint.record = 0;
+        moved = true;
+    }
+
+    return moved;
+}
+
+/**
+ * Moves the checkpoint past the oldest record.
+ */
+static void advance_checkpoint()
+{
+    checkpoint.record++;
+    if (backlog_records > 0)
+    {
+        backlog_records--;
+    }
+
+    skip_exhausted_segments();
+}
+
+static bool read_index_entry(uint32_t segment, uint32_t record, offline_index_entry_t *out)
+{
+    char path[SEGMENT_PATH_LENGTH];
+    segment_path(segment, INDEX_EXTENSION, path, sizeof(path));
+
+    // the current segment's index is open for appending only
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        return false;
+    }
+
+    bool valid = 0 == fseek(f, record * sizeof(*out), SEEK_SET) && 1 == fread(out, sizeof(*out), 1, f) &&
+                 out->entry_crc == index_entry_crc(*out);
+    fclose(f);
+
+    return valid;
+}
+
+static esp_err_t read_record(uint32_t segment, const offline_index_entry_t *entry, offline_record_header_t *out_header,
+                             uint8_t *jpeg, size_t capacity)
+{
+    if (entry->length > capacity)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    FILE *f = segment_file;
+    if (segment != current_segment || segment_file == NULL)
+    {
+        char path[SEGMENT_PATH_LENGTH];
+        segment_path(segment, SEGMENT_EXTENSION, path, sizeof(path));
+        if (NULL == (f = fopen(path, "rb")))
+        {
+            return ESP_ERR_NOT_FOUND;
+        }
+    }
+
+    offline_record_header_t header;
+    bool valid = 0 == fseek(f, entry->offset, SEEK_SET) && 1 == fread(&header, sizeof(header), 1, f) &&
+                 header.magic == OFFLINE_RECORD_MAGIC && header.segment == segment && header.length == entry->length &&
+                 header.crc == entry->crc && header.length == fread(jpeg, 1, header.length, f);
+
+    if (f != segment_file)
+    {
+        fclose(f);
+    }
+
+    if (!valid || header.crc != record_crc(header, jpeg, header.length))
+    {
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    *out_header = header;
+    return ESP_OK;
+}
+
+esp_err_t offline_store_read_oldest(offline_record_header_t *out_header, uint8_t *jpeg, size_t capacity)
+{
+    offline_index_entry_t entry;
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    if (store_lock == NULL || !store_ready)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+
+    // the index and the segment are read through their own handles, which only see what was synced
+    if (checkpoint.segment == current_segment && segment_file != NULL && ESP_OK != sync_segment())
+    {
+        ESP_LOGE(TAG, "Couldn't sync segment %08" PRIx32, current_segment);
+    }
+
+    // a reboot may have come between consuming the last record of a segment and deleting it
+    uint32_t skipped = skip_exhausted_segments() ? 1 : 0;
+    while (checkpoint.record < segment_records(checkpoint.segment))
+    {
+        if (read_index_entry(checkpoint.segment, checkpoint.record, &entry))
+        {
+            ret = read_record(checkpoint.segment, &entry, out_header, jpeg, capacity);
+            if (ret == ESP_OK || ret == ESP_ERR_INVALID_SIZE)
+            {
+                break;
+            }
+        }
+
+        ESP_LOGE(TAG, "Skipping the unreadable record %" PRIu32 " of segment %08" PRIx32, checkpoint.record, checkpoint.segment);
+        advance_checkpoint();
+        skipped++;
+        ret = ESP_ERR_NOT_FOUND;
+    }
+
+    if (skipped > 0)
+    {
+        save_checkpoint();
+    }
+
+    xSemaphoreGive(store_lock);
+
+    return ret;
+}
+
+esp_err_t offline_store_consume_oldest()
+{
+    if (store_lock == NULL || !store_ready)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    if (checkpoint.record < segment_records(checkpoint.segment))
+    {
+        advance_checkpoint();
+        ret = save_checkpoint();
+    }
+
+    xSemaphoreGive(store_lock);
+
+    return ret;
+}
+
+uint32_t offline_store_backlog()
+{
+    return backlog_records;
+}
+
+void offline_store_log_stats()
+{
+    if (store_lock == NULL)
+    {
+        return;
+    }
+
+    xSemaphoreTake(store_lock, portMAX_DELAY);
+    ESP_LOGI(TAG, "Offline store: segments %08" PRIx32 "..%08" PRIx32 ", %" PRIu32 " records and %" PRIu32 " of %d bytes in the current one, "
+                  "%" PRIu32 " records not yet consumed",
+             oldest_segment, current_segment, current_records, write_offset, OFFLINE_SEGMENT_SIZE, backlog_records);
+    xSemaphoreGive(store_lock);
+}
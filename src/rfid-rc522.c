@@ -1,4 +1,5 @@
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <inttypes.h>
 #include "rc522.h"
 
@@ -7,6 +8,10 @@
 #include "globals.h"
 #include "rfid-rc522.h"
 #include "events.h"
+#include "trace.h"
+#include "scan-debounce.h"
+#include "roster.h"
+#include "scan-feedback.h"
 
 //---------------
 
@@ -26,10 +31,28 @@ static void rc522_handler(void *arg, esp_event_base_t base, int32_t event_id, vo
     case RC522_EVENT_TAG_SCANNED:
     {
         rc522_tag_t *tag = (rc522_tag_t *)data->ptr;
+
+        // a card held on the reader is read again every poll, only its first read makes a capture
+        if (!scan_debounce_accept(tag->serial_number, esp_timer_get_time()))
+        {
+            ESP_LOGD(TAG, "Tag read again (sn: %" PRIu64 "), ignored", tag->serial_number);
+            break;
+        }
+
+        // answering on the led right away, the server only hears of enrolled cards
+        roster_status_t status = roster_lookup(tag->serial_number);
+        scan_feedback_show(status != ROSTER_UNKNOWN);
+        if (status == ROSTER_UNKNOWN)
+        {
+            ESP_LOGW(TAG, "Tag not on the roster (sn: %" PRIu64 "), rejected", tag->serial_number);
+            break;
+        }
+
         ESP_LOGI(TAG, "Tag scanned (sn: %" PRIu64 ")", tag->serial_number);
 
         rfid_a_s_event_data_t _data = {
-            .tag = tag,
+            .tag = *tag,
+            .scan_id = trace_begin_scan(),
         };
 
         esp_event_post(RFID_A_S_EVENTS, RFID_A_S_RFID_SCANNED, &_data, sizeof(rfid_a_s_event_data_t), portMAX_DELAY);
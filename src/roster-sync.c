@@ -0,0 +1,266 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_http_client.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_err.h"
+#include "cJSON.h"
+
+// local includes
+
+#include "globals.h"
+#include "roster.h"
+#include "roster-sync.h"
+#include "connectivity.h"
+
+// --------------
+
+typedef struct serial_list_t
+{
+    uint64_t *serials;
+    uint32_t count;
+    uint32_t capacity;
+} serial_list_t;
+
+/**
+ * What the pages of one sync agree on, taken from the first one.
+ */
+typedef struct roster_delta_t
+{
+    uint32_t version;
+    uint32_t total; // changes over all pages
+    bool full;
+    serial_list_t adds;
+    serial_list_t removes;
+} roster_delta_t;
+
+static esp_err_t append_serials(serial_list_t *list, const cJSON *array)
+{
+    const cJSON *item;
+
+    if (!cJSON_IsArray(array))
+    {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    cJSON_ArrayForEach(item, array)
+    {
+        char *end;
+        if (!cJSON_IsString(item) || item->valuestring[0] == '\0')
+        {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+        uint64_t serial = strtoull(item->valuestring, &end, 10);
+        if (*end != '\0')
+        {
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+
+        if (list->count == list->capacity)
+        {
+            uint32_t capacity = list->capacity ? list->capacity * 2 : ROSTER_SYNC_PAGE_SIZE;
+            uint64_t *serials = heap_caps_realloc(list->serials, capacity * sizeof(uint64_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+            if (serials == NULL)
+            {
+                return ESP_ERR_NO_MEM;
+            }
+            list->serials = serials;
+            list->capacity = capacity;
+        }
+        list->serials[list->count++] = serial;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Adds a page of the response to the delta, the first page decides the version the others must lead to.
+ */
+static esp_err_t read_page(const cJSON *root, bool first, roster_delta_t *delta)
+{
+    const cJSON *version = cJSON_GetObjectItem(root, "version");
+    const cJSON *total = cJSON_GetObjectItem(root, "total");
+    const cJSON *full = cJSON_GetObjectItem(root, "full");
+    if (!cJSON_IsNumber(version) || !cJSON_IsNumber(total) || !cJSON_IsBool(full))
+    {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    if (first)
+    {
+        delta->version = (uint32_t)version->valuedouble;
+        delta->total = (uint32_t)total->valuedouble;
+        delta->full = cJSON_IsTrue(full);
+    }
+    else if (delta->version != (uint32_t)version->valuedouble || delta->total != (uint32_t)total->valuedouble)
+    {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    esp_err_t ret = append_serials(&delta->adds, cJSON_GetObjectItem(root, "add"));
+    if (ret == ESP_OK)
+    {
+        ret = append_serials(&delta->removes, cJSON_GetObjectItem(root, "remove"));
+    }
+
+    return ret;
+}
+
+static esp_err_t parse_page(const char *json, size_t length, bool first, roster_delta_t *delta, uint32_t *out_changes)
+{
+    uint32_t before = delta->adds.count + delta->removes.count;
+
+    cJSON *root = cJSON_ParseWithLength(json, length);
+    if (root == NULL)
+    {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    esp_err_t ret = read_page(root, first, delta);
+    cJSON_Delete(root);
+
+    *out_changes = delta->adds.count + delta->removes.count - before;
+
+    return ret;
+}
+
+static esp_err_t fetch_page(esp_http_client_handle_t client, uint32_t since, uint32_t to, uint32_t offset,
+                            char *buffer, size_t *out_length)
+{
+    char url[128];
+
+    snprintf(url, sizeof(url), "http://" SERVER_ADDRESS "/roster?since=%" PRIu32 "&to=%" PRIu32 "&offset=%" PRIu32 "&limit=%d",
+             since, to, offset, ROSTER_SYNC_PAGE_SIZE);
+    esp_http_client_set_url(client, url);
+
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err != ESP_OK)
+    {
+        connectivity_report(false);
+        return err;
+    }
+
+    int64_t content_length = esp_http_client_fetch_headers(client);
+    if (content_length < 0)
+    {
+        connectivity_report(false);
+        return ESP_FAIL;
+    }
+    if (content_length >= ROSTER_SYNC_RESPONSE_SIZE || esp_http_client_get_status_code(client) != 200)
+    {
+        ESP_LOGE(TAG, "Roster request failed with status %d (%" PRId64 " bytes)", esp_http_client_get_status_code(client), content_length);
+        esp_http_client_close(client);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    int length = esp_http_client_read_response(client, buffer, ROSTER_SYNC_RESPONSE_SIZE - 1);
+    if (length < 0 || !esp_http_client_is_complete_data_received(client))
+    {
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+
+    connectivity_report(true);
+    *out_length = length;
+
+    return ESP_OK;
+}
+
+esp_err_t roster_sync()
+{
+    roster_delta_t delta = {0};
+    uint32_t since = roster_version();
+    uint32_t received = 0;
+    size_t length = 0;
+    esp_err_t ret = ESP_OK;
+
+    char *buffer = heap_caps_malloc(ROSTER_SYNC_RESPONSE_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (buffer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_http_client_config_t config = {
+        .url = "http://" SERVER_ADDRESS "/roster",
+        .method = HTTP_METHOD_GET,
+        .disable_auto_redirect = true,
+        .keep_alive_enable = true,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL)
+    {
+        free(buffer);
+        return ESP_FAIL;
+    }
+
+    // the first page pins the version, the server clamps UINT32_MAX to its latest one
+    for (bool first = true; first || received < delta.total; first = false)
+    {
+        uint32_t changes = 0;
+        if (ESP_OK != (ret = fetch_page(client, since, first ? UINT32_MAX : delta.version, received, buffer, &length)) ||
+            ESP_OK != (ret = parse_page(buffer, length, first, &delta, &changes)))
+        {
+            break;
+        }
+        if (changes == 0 && received < delta.total)
+        {
+            ret = ESP_ERR_INVALID_RESPONSE; // the server stopped short
+            break;
+        }
+        received += changes;
+    }
+
+    esp_http_client_cleanup(client);
+    free(buffer);
+
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Couldn't sync the roster from version %" PRIu32 " (error : %s)", since, esp_err_to_name(ret));
+    }
+    else if (delta.full || delta.version != since)
+    {
+        ret = roster_apply(since, delta.version, delta.full, delta.adds.serials, delta.adds.count,
+                           delta.removes.serials, delta.removes.count);
+    }
+
+    free(delta.adds.serials);
+    free(delta.removes.serials);
+
+    return ret;
+}
+
+esp_err_t roster_sync_init()
+{
+    if (pdPASS != xTaskCreate(roster_sync_task,
+                              "Roster_Sync_Task",
+                              TASK_ROSTER_SYNC_STACK_SIZE,
+                              NULL,
+                              ROSTER_SYNC_TASK_PRIORITY,
+                              NULL))
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+void roster_sync_task(void *args)
+{
+    while (1)
+    {
+        uint32_t delay_ms = ROSTER_SYNC_RETRY_MS;
+        if (connectivity_server_reachable() && ESP_OK == roster_sync())
+        {
+            delay_ms = ROSTER_SYNC_INTERVAL_MS;
+        }
+
+        vTaskDelay(delay_ms / portTICK_PERIOD_MS);
+    }
+
+    vTaskDelete(NULL);
+}
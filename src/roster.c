@@ -0,0 +1,386 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_partition.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "esp_log.h"
+#include "esp_err.h"
+
+// local includes
+
+#include "globals.h"
+#include "roster.h"
+
+// --------------
+
+#define ROSTER_ERASE_SIZE 4096 // the erase unit of the flash
+
+_Static_assert(sizeof(roster_image_header_t) == 24, "the serials after the header must stay 8 byte aligned");
+
+typedef struct roster_table_t
+{
+    uint32_t version;
+    uint32_t count;
+    uint64_t *serials; // ascending
+} roster_table_t;
+
+static const esp_partition_t *partition = NULL;
+static SemaphoreHandle_t table_lock = NULL; // held for a search or a swap, the new roster is built outside of it
+static roster_table_t table = {0};          // only ever replaced by the sync task, it reads it without the lock
+static bool loaded = false;
+static int slot_in_use = -1; // the slot `table` was loaded from or written to, the next roster goes to the other
+static uint16_t slot_sequence = 0; // the `sequence` of the slot in use
+static uint32_t enrolled_lookups = 0;
+static uint32_t unknown_lookups = 0;
+
+bool roster_contains(const uint64_t *serials, uint32_t count, uint64_t serial_number)
+{
+    if (count == 0)
+    {
+        return false;
+    }
+
+    // halving without an early exit, the comparison compiles to a conditional move instead of a branch
+    const uint64_t *base = serials;
+    while (count > 1)
+    {
+        uint32_t half = count / 2;
+        base = base[half] <= serial_number ? base + half : base;
+        count -= half;
+    }
+
+    return *base == serial_number;
+}
+
+static uint32_t header_crc(const roster_image_header_t *header)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)header, offsetof(roster_image_header_t, crc));
+}
+
+static uint64_t *allocate_serials(uint32_t count)
+{
+    size_t length = count ? count * sizeof(uint64_t) : sizeof(uint64_t);
+    uint64_t *serials = heap_caps_malloc(length, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+
+    return serials != NULL ? serials : malloc(length);
+}
+
+static bool read_slot_header(int slot, roster_image_header_t *out)
+{
+    return ESP_OK == esp_partition_read(partition, slot * ROSTER_SLOT_SIZE, out, sizeof(*out)) &&
+           out->magic == ROSTER_MAGIC && out->format_version == ROSTER_FORMAT_VERSION &&
+           out->crc == header_crc(out) && out->count <= ROSTER_SLOT_CAPACITY;
+}
+
+static esp_err_t load_slot(int slot, const roster_image_header_t *header)
+{
+    size_t length = (size_t)header->count * sizeof(uint64_t);
+    uint64_t *serials = allocate_serials(header->count);
+    if (serials == NULL)
+    {
+        ESP_LOGE(TAG, "No memory for a roster of %" PRIu32 " serials.", header->count);
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (ESP_OK != esp_partition_read(partition, slot * ROSTER_SLOT_SIZE + sizeof(*header), serials, length) ||
+        header->serials_crc != esp_rom_crc32_le(0, (const uint8_t *)serials, length))
+    {
+        ESP_LOGE(TAG, "The roster in slot %d is corrupt.", slot);
+        free(serials);
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    // the search relies on the order, a roster written by hand might not have it
+    for (uint32_t i = 1; i < header->count; i++)
+    {
+        if (serials[i - 1] >= serials[i])
+        {
+            ESP_LOGE(TAG, "The roster in slot %d isn't sorted at %" PRIu32 ".", slot, i);
+            free(serials);
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    table = (roster_table_t){
+        .version = header->version,
+        .count = header->count,
+        .serials = serials,
+    };
+    loaded = true;
+    slot_in_use = slot;
+    slot_sequence = header->sequence;
+
+    return ESP_OK;
+}
+
+/**
+ * Whether slot `a` was written after slot `b`. The sequence wraps, the two slots are never more than one write apart.
+ * Slots of the same sequence, images written by tools/roster-image.c, go by the roster version.
+ */
+static bool written_after(const roster_image_header_t *a, const roster_image_header_t *b)
+{
+    int16_t ahead = (int16_t)(a->sequence - b->sequence);
+
+    return ahead != 0 ? ahead > 0 : a->version > b->version;
+}
+
+/**
+ * Erases the slot and writes the serials before the header, so a write cut short leaves no valid header behind.
+ */
+static esp_err_t write_slot(int slot, uint16_t sequence, const roster_table_t *roster)
+{
+    size_t length = (size_t)roster->count * sizeof(uint64_t);
+    size_t address = slot * ROSTER_SLOT_SIZE;
+    size_t erase_length = (sizeof(roster_image_header_t) + length + ROSTER_ERASE_SIZE - 1) / ROSTER_ERASE_SIZE * ROSTER_ERASE_SIZE;
+
+    roster_image_header_t header = {
+        .magic = ROSTER_MAGIC,
+        .format_version = ROSTER_FORMAT_VERSION,
+        .sequence = sequence,
+        .version = roster->version,
+        .count = roster->count,
+        .serials_crc = esp_rom_crc32_le(0, (const uint8_t *)roster->serials, length),
+    };
+    header.crc = header_crc(&header);
+
+    esp_err_t err = esp_partition_erase_range(partition, address, erase_length);
+    if (err == ESP_OK && length > 0)
+    {
+        err = esp_partition_write(partition, address + sizeof(header), roster->serials, length);
+    }
+    if (err == ESP_OK)
+    {
+        err = esp_partition_write(partition, address, &header, sizeof(header));
+    }
+
+    return err;
+}
+
+static uint32_t read_synced_version()
+{
+    nvs_handle_t handle;
+    uint32_t version = 0;
+
+    if (ESP_OK == nvs_open(ROSTER_NVS_NAMESPACE, NVS_READONLY, &handle))
+    {
+        nvs_get_u32(handle, ROSTER_NVS_VERSION_KEY, &version);
+        nvs_close(handle);
+    }
+
+    return version;
+}
+
+static esp_err_t write_synced_version(uint32_t version)
+{
+    nvs_handle_t handle;
+
+    esp_err_t err = nvs_open(ROSTER_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK)
+    {
+        err = nvs_set_u32(handle, ROSTER_NVS_VERSION_KEY, version);
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+
+    return err;
+}
+
+esp_err_t roster_init()
+{
+    roster_image_header_t headers[2];
+    bool valid[2];
+
+    if (table_lock == NULL && NULL == (table_lock = xSemaphoreCreateMutex()))
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ROSTER_PARTITION_SUBTYPE, ROSTER_PARTITION_LABEL);
+    if (partition == NULL || partition->size < 2 * ROSTER_SLOT_SIZE)
+    {
+        ESP_LOGE(TAG, "No " ROSTER_PARTITION_LABEL " partition of two slots, synced rosters can't be kept.");
+        partition = NULL;
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    int64_t start = esp_timer_get_time();
+
+    for (int slot = 0; slot < 2; slot++)
+    {
+        valid[slot] = read_slot_header(slot, &headers[slot]);
+    }
+
+    // the slot written last first, the other one is what it was built from
+    int newest = valid[1] && (!valid[0] || written_after(&headers[1], &headers[0])) ? 1 : 0;
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    for (int i = 0; i < 2 && err != ESP_OK; i++)
+    {
+        int slot = i == 0 ? newest : 1 - newest;
+        if (valid[slot])
+        {
+            err = load_slot(slot, &headers[slot]);
+        }
+    }
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "The " ROSTER_PARTITION_LABEL " partition holds no roster, every card is let through until one is synced.");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ESP_LOGI(TAG, "Roster version %" PRIu32 ": %" PRIu32 " serials loaded from slot %d in %" PRId64 " ms",
+             table.version, table.count, slot_in_use, (esp_timer_get_time() - start) / 1000);
+
+    uint32_t synced_version = read_synced_version();
+    if (synced_version > table.version)
+    {
+        // the newer roster was lost on its way to the flash, the sync picks up from the one loaded
+        ESP_LOGW(TAG, "Roster version %" PRIu32 " was synced but never stored.", synced_version);
+    }
+
+    return ESP_OK;
+}
+
+uint32_t roster_version()
+{
+    return table.version;
+}
+
+roster_status_t roster_lookup(uint64_t serial_number)
+{
+    roster_status_t status = ROSTER_UNAVAILABLE;
+
+    if (table_lock == NULL)
+    {
+        return status;
+    }
+
+    xSemaphoreTake(table_lock, portMAX_DELAY);
+    if (loaded)
+    {
+        status = roster_contains(table.serials, table.count, serial_number) ? ROSTER_ENROLLED : ROSTER_UNKNOWN;
+        if (status == ROSTER_ENROLLED)
+        {
+            enrolled_lookups++;
+        }
+        else
+        {
+            unknown_lookups++;
+        }
+    }
+    xSemaphoreGive(table_lock);
+
+    return status;
+}
+
+static int compare_serials(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+esp_err_t roster_apply(uint32_t from_version, uint32_t to_version, bool full,
+                       uint64_t *adds, uint32_t add_count, uint64_t *removes, uint32_t remove_count)
+{
+    if (table_lock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!full && from_version != table.version)
+    {
+        ESP_LOGE(TAG, "Roster changes from version %" PRIu32 " don't apply to version %" PRIu32 ".", from_version, table.version);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    qsort(adds, add_count, sizeof(uint64_t), compare_serials);
+    qsort(removes, remove_count, sizeof(uint64_t), compare_serials);
+
+    const uint64_t *old = table.serials;
+    uint32_t old_count = full ? 0 : table.count;
+    if ((size_t)old_count + add_count > ROSTER_SLOT_CAPACITY)
+    {
+        ESP_LOGE(TAG, "A roster of %" PRIu32 " serials doesn't fit a slot.", old_count + add_count);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    roster_table_t next = {
+        .version = to_version,
+        .serials = allocate_serials(old_count + add_count),
+    };
+    if (next.serials == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // merging the two sorted lists, dropping duplicates and whatever was removed
+    uint32_t i = 0;
+    uint32_t j = 0;
+    while (i < old_count || j < add_count)
+    {
+        uint64_t serial = j == add_count || (i < old_count && old[i] <= adds[j]) ? old[i++] : adds[j++];
+        if ((next.count > 0 && next.serials[next.count - 1] == serial) || roster_contains(removes, remove_count, serial))
+        {
+            continue;
+        }
+        next.serials[next.count++] = serial;
+    }
+
+    xSemaphoreTake(table_lock, portMAX_DELAY);
+    roster_table_t previous = table;
+    table = next;
+    loaded = true;
+    xSemaphoreGive(table_lock);
+
+    free(previous.serials);
+
+    ESP_LOGI(TAG, "Roster version %" PRIu32 " -> %" PRIu32 ": %" PRIu32 " added, %" PRIu32 " removed, %" PRIu32 " serials",
+             previous.version, next.version, add_count, remove_count, next.count);
+
+    if (partition == NULL)
+    {
+        return ESP_OK;
+    }
+
+    int slot = slot_in_use == 0 ? 1 : 0;
+    uint16_t sequence = slot_sequence + 1;
+    esp_err_t err = write_slot(slot, sequence, &next);
+    if (err != ESP_OK)
+    {
+        // the other slot still holds the previous roster, the next boot starts from there
+        ESP_LOGE(TAG, "Couldn't store roster version %" PRIu32 " (error : %s)", next.version, esp_err_to_name(err));
+        return ESP_OK;
+    }
+    slot_in_use = slot;
+    slot_sequence = sequence;
+
+    if (ESP_OK != (err = write_synced_version(next.version)))
+    {
+        ESP_LOGE(TAG, "Couldn't store the roster version in nvs (error : %s)", esp_err_to_name(err));
+    }
+
+    return ESP_OK;
+}
+
+void roster_log_stats()
+{
+    if (!loaded)
+    {
+        return;
+    }
+
+    xSemaphoreTake(table_lock, portMAX_DELAY);
+    ESP_LOGI(TAG, "Roster version %" PRIu32 " (%" PRIu32 " serials): %" PRIu32 " enrolled cards scanned, %" PRIu32 " unknown rejected",
+             table.version, table.count, enrolled_lookups, unknown_lookups);
+    xSemaphoreGive(table_lock);
+}
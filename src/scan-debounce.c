@@ -0,0 +1,91 @@
+#include <inttypes.h>
+
+#include "esp_log.h"
+
+// local includes
+
+#include "globals.h"
+#include "scan-debounce.h"
+
+// --------------
+
+/**
+ * A slot of the open addressing table, serial number 0 marks a slot never used.
+ * Slots whose window has passed are reused, so the table never needs clearing.
+ */
+typedef struct debounce_entry_t
+{
+    uint64_t serial_number;
+    int64_t last_read_us;
+    uint32_t suppressed; // reads dropped since the tag was last accepted
+} debounce_entry_t;
+
+static debounce_entry_t table[SCAN_DEBOUNCE_TABLE_SIZE];
+static uint32_t accepted_reads = 0;
+static uint32_t suppressed_reads = 0;
+
+static uint32_t slot_of(uint64_t serial_number)
+{
+    // fibonacci hashing, serials of one batch of cards tend to differ only in their low bits
+    return (uint32_t)((serial_number * 0x9e3779b97f4a7c15ULL) >> 32) & (SCAN_DEBOUNCE_TABLE_SIZE - 1);
+}
+
+bool scan_debounce_accept(uint64_t serial_number, int64_t now_us)
+{
+    const int64_t window_us = (int64_t)SCAN_DEBOUNCE_WINDOW_MS * 1000;
+    debounce_entry_t *free_entry = NULL;
+    uint32_t slot = slot_of(serial_number);
+
+    if (serial_number == 0)
+    {
+        accepted_reads++;
+        return true;
+    }
+
+    for (uint32_t probe = 0; probe < SCAN_DEBOUNCE_TABLE_SIZE; probe++)
+    {
+        debounce_entry_t *entry = &table[(slot + probe) & (SCAN_DEBOUNCE_TABLE_SIZE - 1)];
+
+        if (entry->serial_number == serial_number)
+        {
+            bool repeated = now_us - entry->last_read_us < window_us;
+            entry->last_read_us = now_us;
+            if (repeated)
+            {
+                entry->suppressed++;
+                suppressed_reads++;
+                return false;
+            }
+            entry->suppressed = 0;
+            accepted_reads++;
+            return true;
+        }
+
+        bool expired = entry->serial_number == 0 || now_us - entry->last_read_us >= window_us;
+        if (expired && free_entry == NULL)
+        {
+            free_entry = entry;
+        }
+        if (entry->serial_number == 0)
+        {
+            break; // the tag would have been put here or before
+        }
+    }
+
+    // with every slot inside its window the tag can't be tracked, it is let through
+    if (free_entry != NULL)
+    {
+        free_entry->serial_number = serial_number;
+        free_entry->last_read_us = now_us;
+        free_entry->suppressed = 0;
+    }
+
+    accepted_reads++;
+    return true;
+}
+
+void scan_debounce_log_stats()
+{
+    ESP_LOGI(TAG, "Scan debounce: %" PRIu32 " reads accepted, %" PRIu32 " suppressed (window %d ms)",
+             accepted_reads, suppressed_reads, SCAN_DEBOUNCE_WINDOW_MS);
+}
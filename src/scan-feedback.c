@@ -0,0 +1,76 @@
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_err.h"
+
+// local includes
+
+#include "globals.h"
+#include "scan-feedback.h"
+
+// --------------
+
+static esp_timer_handle_t blink_timer = NULL;
+static portMUX_TYPE blink_lock = portMUX_INITIALIZER_UNLOCKED;
+static int remaining_toggles = 0; // led changes left in the current pattern
+static uint64_t toggle_interval_us = 0;
+static bool led_on = false;
+
+static void set_led(bool on)
+{
+    led_on = on;
+    gpio_set_level(SCAN_FEEDBACK_LED_PIN, on ? SCAN_FEEDBACK_LED_ON_LEVEL : !SCAN_FEEDBACK_LED_ON_LEVEL);
+}
+
+static void blink_step(void *args)
+{
+    taskENTER_CRITICAL(&blink_lock);
+    bool more = remaining_toggles > 0;
+    if (more)
+    {
+        remaining_toggles--;
+        set_led(!led_on);
+    }
+    more = remaining_toggles > 0;
+    taskEXIT_CRITICAL(&blink_lock);
+
+    if (more)
+    {
+        esp_timer_start_once(blink_timer, toggle_interval_us);
+    }
+}
+
+esp_err_t scan_feedback_init()
+{
+    const esp_timer_create_args_t args = {
+        .callback = blink_step,
+        .name = "scan_feedback",
+    };
+
+    gpio_set_direction(SCAN_FEEDBACK_LED_PIN, GPIO_MODE_OUTPUT);
+    set_led(false);
+
+    return esp_timer_create(&args, &blink_timer);
+}
+
+void scan_feedback_show(bool enrolled)
+{
+    if (blink_timer == NULL)
+    {
+        return;
+    }
+
+    // a newer scan cuts the pattern of the previous one short
+    esp_timer_stop(blink_timer);
+
+    taskENTER_CRITICAL(&blink_lock);
+    toggle_interval_us = (enrolled ? SCAN_FEEDBACK_ENROLLED_MS : SCAN_FEEDBACK_UNKNOWN_MS) * 1000ULL;
+    remaining_toggles = enrolled ? 1 : SCAN_FEEDBACK_UNKNOWN_BLINKS * 2 - 1;
+    set_led(true);
+    taskEXIT_CRITICAL(&blink_lock);
+
+    esp_timer_start_once(blink_timer, toggle_interval_us);
+}
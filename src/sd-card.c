@@ -4,6 +4,15 @@
 #include "sys/stat.h"
 #include "sys/time.h"
 #include "unistd.h"
+#include <dirent.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 
 #include "sdmmc_cmd.h"
 
@@ -22,6 +31,26 @@
 
 #define MOUNT_POINT "/sdcard"
 #define IMAGES_FOLDER "images"
+#define IMAGES_SHARD_PATH_LENGTH 32                          // /sdcard/images/20261017
+#define IMAGES_HOUR_PATH_LENGTH (IMAGES_SHARD_PATH_LENGTH + 3) // and /14
+
+/**
+ * The directory images of the current day go to, kept in ram so saving an image doesn't look it up every time.
+ * Only the current day is cached, images are always saved with the current time.
+ */
+typedef struct images_shard_t
+{
+    int day;        // yyyymmdd, 0 until the first image is saved
+    int hour;       // of `hour_path`, -1 if it isn't created yet
+    bool hourly;    // the day has more than SD_IMAGES_HOUR_SHARD_THRESHOLD images and is split by hour
+    uint32_t files; // entries in the day directory
+    char day_path[IMAGES_SHARD_PATH_LENGTH];
+    char hour_path[IMAGES_HOUR_PATH_LENGTH];
+} images_shard_t;
+
+static SemaphoreHandle_t images_lock = NULL;
+static bool images_folder_created = false;
+static images_shard_t images_shard = {.hour = -1};
 
 esp_err_t init_sd_card(sdmmc_card_t **out)
 {
@@ -45,6 +74,12 @@ esp_err_t init_sd_card(sdmmc_card_t **out)
     gpio_set_pull_mode(12, GPIO_PULLUP_ONLY); // D2, needed in 4-line mode only
     gpio_set_pull_mode(13, GPIO_PULLUP_ONLY); // D3, needed in 4- and 1-line modes
 
+    images_lock = xSemaphoreCreateMutex();
+    if (images_lock == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
     sdmmc_host_t host = SDSPI_HOST_DEFAULT();
 
     spi_bus_config_t bus_cfg = {
@@ -101,9 +136,85 @@ esp_err_t deinit_sd_card(sdmmc_card_t *card)
     return ret;
 }
 
+static void create_directory(const char *path)
+{
+    // mkdir finds an existing directory with the same single lookup access() would take
+    if (0 != mkdir(path, 0775) && errno != EEXIST)
+    {
+        ESP_LOGE(TAG, "mkdir %s failed (errno %d)", path, errno);
+    }
+}
+
+static uint32_t count_entries(const char *path)
+{
+    uint32_t count = 0;
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+    {
+        return 0;
+    }
+
+    while (NULL != readdir(dir))
+    {
+        count++;
+    }
+    closedir(dir);
+
+    return count;
+}
+
+/**
+ * The directory for an image saved at `now`, created if it doesn't exist yet.
+ * The entries of a day are counted once per boot, after that the count is kept up to date here.
+ */
+static esp_err_t get_images_shard(const struct tm *now, char *out_path, size_t out_path_length)
+{
+    if (images_lock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(images_lock, portMAX_DELAY);
+
+    int day = (now->tm_year + 1900) * 10000 + (now->tm_mon + 1) * 100 + now->tm_mday;
+    if (day != images_shard.day)
+    {
+        snprintf(images_shard.day_path, sizeof(images_shard.day_path), "%s/%08d", get_images_folder(), day);
+        create_directory(images_shard.day_path);
+        images_shard.day = day;
+        images_shard.hour = -1;
+        images_shard.files = count_entries(images_shard.day_path);
+        images_shard.hourly = images_shard.files >= SD_IMAGES_HOUR_SHARD_THRESHOLD;
+        ESP_LOGI(TAG, "Saving images to %s (%" PRIu32 " entries)", images_shard.day_path, images_shard.files);
+    }
+
+    if (!images_shard.hourly)
+    {
+        images_shard.files++;
+        images_shard.hourly = images_shard.files >= SD_IMAGES_HOUR_SHARD_THRESHOLD;
+        snprintf(out_path, out_path_length, "%s", images_shard.day_path);
+    }
+    else
+    {
+        if (now->tm_hour != images_shard.hour)
+        {
+            snprintf(images_shard.hour_path, sizeof(images_shard.hour_path), "%s/%02u", images_shard.day_path,
+                     (unsigned)now->tm_hour % 24);
+            create_directory(images_shard.hour_path);
+            images_shard.hour = now->tm_hour;
+        }
+        snprintf(out_path, out_path_length, "%s", images_shard.hour_path);
+    }
+
+    xSemaphoreGive(images_lock);
+
+    return ESP_OK;
+}
+
 /**
- * Get time in microseconds and use it to construct file name
- * The out_filepath must be a valid buffer in which filepath is stored (length of 50 char might include all cases)
+ * Get time in microseconds and use it to construct file name, in the directory of the current day (and hour, see
+ * SD_IMAGES_HOUR_SHARD_THRESHOLD).
+ * The out_filepath must be a valid buffer in which filepath is stored (IMAGE_FILEPATH_LENGTH includes all cases)
  */
 esp_err_t get_new_image_filepath(uint64_t img_identifier, char *extension, char *out_filepath, size_t out_filepath_length)
 {
@@ -116,14 +227,24 @@ esp_err_t get_new_image_filepath(uint64_t img_identifier, char *extension, char
     struct timeval tv_now;
     gettimeofday(&tv_now, NULL);
     int64_t time_us = (int64_t)tv_now.tv_sec * 1000000L + (int64_t)tv_now.tv_usec;
-    //                                      /sdcard/images/<rfid_tag>_<time_us>.jpg
-    snprintf(out_filepath, out_filepath_length, "%s/%" PRIu64 "_%" PRIu64 "%s", get_images_folder(), img_identifier, time_us, extension);
+
+    struct tm now;
+    char shard[IMAGES_HOUR_PATH_LENGTH];
+    localtime_r(&tv_now.tv_sec, &now);
+    esp_err_t ret = get_images_shard(&now, shard, sizeof(shard));
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    //                                      /sdcard/images/<yyyymmdd>[/<hh>]/<rfid_tag>_<time_us>.jpg
+    snprintf(out_filepath, out_filepath_length, "%s/%" PRIu64 "_%" PRIu64 "%s", shard, img_identifier, time_us, extension);
 
     return ESP_OK;
 }
 
 /**
- * Creates the /sdcard/images directory is it doesn't exists
+ * Creates the /sdcard/images directory is it doesn't exists (once per boot)
  * returns the images folder path.
  *
  */
@@ -131,11 +252,10 @@ char *get_images_folder()
 {
     char *images_folder = MOUNT_POINT "/" IMAGES_FOLDER;
 
-    // checking if file exists
-    if (0 != access(images_folder, F_OK))
+    if (!images_folder_created)
     {
-        int mk_ret = mkdir(images_folder, 0775);
-        ESP_LOGI(TAG, "mkdir %s returned %d", images_folder, mk_ret);
+        create_directory(images_folder);
+        images_folder_created = true;
     }
 
     // todo: check necessary read/write permissions
@@ -143,38 +263,49 @@ char *get_images_folder()
     return images_folder;
 }
 
-esp_err_t write_to_file_path(const char *path, char *data)
+esp_err_t write_to_file_path(const char *path, const uint8_t *data, size_t length)
 {
     ESP_LOGI(TAG, "Opening file %s", path);
-    FILE *f = fopen(path, "w");
+    FILE *f = fopen(path, "wb");
     if (f == NULL)
     {
         ESP_LOGE(TAG, "Failed to open file for writing");
         return ESP_FAIL;
     }
-    fprintf(f, data);
-    fclose(f);
+
+    // binary data, which may well contain NULs
+    size_t written = fwrite(data, 1, length, f);
+    if (0 != fclose(f) || written != length)
+    {
+        ESP_LOGE(TAG, "Failed to write %zu bytes to %s", length, path);
+        return ESP_FAIL;
+    }
     ESP_LOGI(TAG, "File written");
 
     return ESP_OK;
 }
 
-esp_err_t save_image_to_sdcard(uint8_t *image_buffer, int64_t rfid_serial_number)
+esp_err_t save_image_to_sdcard(const uint8_t *image_buffer, size_t length, int64_t rfid_serial_number)
 {
     // create filename combining the rfid_tag and current timestamp
     char full_img_filepath[IMAGE_FILEPATH_LENGTH];
-    get_new_image_filepath(rfid_serial_number, ".jpg", full_img_filepath, IMAGE_FILEPATH_LENGTH);
+    esp_err_t ret = get_new_image_filepath(rfid_serial_number, ".jpg", full_img_filepath, IMAGE_FILEPATH_LENGTH);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
 
     // checking if the image already exist
     struct stat st;
 
     if (stat(full_img_filepath, &st) == 0)
+    {
         ESP_LOGE(TAG, "The image %s already exists.", full_img_filepath);
-    return ESP_FAIL;
+        return ESP_FAIL;
+    }
 
-    esp_err_t ret = ESP_OK;
     // else we can write the new image
-    if (ESP_OK == (ret = write_to_file_path(full_img_filepath, (char *)image_buffer)))
+    if (ESP_OK == (ret = write_to_file_path(full_img_filepath, image_buffer, length)))
     {
         ESP_LOGI(TAG, "Successfully saved image %s.", full_img_filepath);
     }
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unistd.h"
+
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_err.h"
+
+// local includes
+
+#include "globals.h"
+#include "sd-writer.h"
+
+// --------------
+
+static esp_err_t write_at(sd_writer_t *writer, uint32_t offset, const void *data, size_t length)
+{
+    int64_t start = esp_timer_get_time();
+
+    bool written = 0 == fseek(writer->f, offset, SEEK_SET) && length == fwrite(data, 1, length, writer->f);
+
+    int64_t elapsed = esp_timer_get_time() - start;
+    writer->stats.writes++;
+    writer->stats.write_us += elapsed;
+    writer->stats.worst_write_us = elapsed > writer->stats.worst_write_us ? elapsed : writer->stats.worst_write_us;
+
+    if (!written)
+    {
+        return ESP_FAIL;
+    }
+    writer->stats.bytes += length;
+
+    return ESP_OK;
+}
+
+/**
+ * Where the chunk starting at `offset` ends, on the next alignment boundary the buffer can reach.
+ */
+static uint32_t chunk_end(const sd_writer_t *writer, uint32_t offset)
+{
+    uint32_t end = (offset + writer->capacity) / SD_WRITER_ALIGNMENT * SD_WRITER_ALIGNMENT;
+
+    return end > offset ? end : offset + writer->capacity;
+}
+
+static esp_err_t flush_buffer(sd_writer_t *writer)
+{
+    if (writer->used == 0)
+    {
+        return ESP_OK;
+    }
+
+    esp_err_t ret = write_at(writer, writer->offset, writer->buffer, writer->used);
+    if (ret != ESP_OK)
+    {
+        // keeping the data, the caller decides whether to retry or to give up on it
+        return ret;
+    }
+
+    writer->offset += writer->used;
+    writer->used = 0;
+
+    return ESP_OK;
+}
+
+esp_err_t sd_writer_open(sd_writer_t *writer, FILE *f, size_t buffer_size)
+{
+    if (writer == NULL || f == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(writer, 0, sizeof(sd_writer_t));
+    writer->f = f;
+    writer->offset = ftell(f);
+
+    // every write already is a large one, stdio would only add a copy
+    setvbuf(f, NULL, _IONBF, 0);
+
+    if (buffer_size > 0)
+    {
+        writer->buffer = heap_caps_malloc(buffer_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (writer->buffer == NULL)
+        {
+            ESP_LOGE(TAG, "Couldn't allocate a %zu bytes sd write buffer in psram.", buffer_size);
+            return ESP_ERR_NO_MEM;
+        }
+        writer->capacity = buffer_size;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t sd_writer_seek(sd_writer_t *writer, uint32_t offset)
+{
+    if (offset == writer->offset + writer->used)
+    {
+        return ESP_OK;
+    }
+
+    esp_err_t ret = flush_buffer(writer);
+    if (ret == ESP_OK)
+    {
+        writer->offset = offset;
+    }
+
+    return ret;
+}
+
+esp_err_t sd_writer_write(sd_writer_t *writer, const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    esp_err_t ret;
+
+    if (writer->capacity == 0)
+    {
+        if (ESP_OK == (ret = write_at(writer, writer->offset, data, length)))
+        {
+            writer->offset += length;
+        }
+        return ret;
+    }
+
+    while (length > 0)
+    {
+        uint32_t position = writer->offset + writer->used;
+        size_t room = chunk_end(writer, writer->offset) - position;
+
+        if (writer->used == 0 && length >= room)
+        {
+            // a whole chunk, straight from the caller's buffer
+            if (ESP_OK != (ret = write_at(writer, position, bytes, room)))
+            {
+                return ret;
+            }
+            writer->offset += room;
+        }
+        else
+        {
+            room = room < length ? room : length;
+            memcpy(writer->buffer + writer->used, bytes, room);
+            writer->used += room;
+
+            if (writer->offset + writer->used == chunk_end(writer, writer->offset) &&
+                ESP_OK != (ret = flush_buffer(writer)))
+            {
+                return ret;
+            }
+        }
+
+        bytes += room;
+        length -= room;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t sd_writer_flush(sd_writer_t *writer, bool sync)
+{
+    esp_err_t ret = flush_buffer(writer);
+    if (ret != ESP_OK || !sync)
+    {
+        return ret;
+    }
+
+    int64_t start = esp_timer_get_time();
+
+    fflush(writer->f);
+    ret = 0 == fsync(fileno(writer->f)) ? ESP_OK : ESP_FAIL;
+
+    int64_t elapsed = esp_timer_get_time() - start;
+    writer->stats.syncs++;
+    writer->stats.sync_us += elapsed;
+    writer->stats.worst_sync_us = elapsed > writer->stats.worst_sync_us ? elapsed : writer->stats.worst_sync_us;
+
+    return ret;
+}
+
+esp_err_t sd_writer_close(sd_writer_t *writer)
+{
+    if (writer->f == NULL)
+    {
+        return ESP_OK;
+    }
+
+    esp_err_t ret = sd_writer_flush(writer, true);
+
+    free(writer->buffer);
+    writer->buffer = NULL;
+    writer->capacity = 0;
+    writer->used = 0;
+    writer->f = NULL;
+
+    return ret;
+}
+
+esp_err_t sd_writer_preallocate(FILE *f, size_t size)
+{
+    long position = ftell(f);
+
+    // writing the last byte has fatfs allocate the whole cluster chain
+    bool allocated = 0 == fseek(f, size - 1, SEEK_SET) && EOF != fputc(0, f) && 0 == fflush(f);
+    fsync(fileno(f));
+    fseek(f, position, SEEK_SET);
+
+    return allocated ? ESP_OK : ESP_FAIL;
+}
@@ -0,0 +1,315 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_http_client.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_err.h"
+
+// local includes
+
+#include "globals.h"
+#include "trace.h"
+#include "wifi.h"
+#include "scan-debounce.h"
+#include "roster.h"
+
+// --------------
+
+/*
+ * Timestamps are kept as the lower 32 bits of `esp_timer_get_time()`, the differences stay correct across the
+ * wrap around (~71 minutes) as long as a scan takes less than that.
+ */
+typedef struct trace_entry_t
+{
+    uint32_t time_us;
+    uint32_t scan_id;
+    uint8_t stage;
+} trace_entry_t;
+
+typedef struct trace_percentiles_t
+{
+    uint32_t count;
+    uint32_t p50;
+    uint32_t p95;
+    uint32_t p99;
+} trace_percentiles_t;
+
+static trace_entry_t trace_ring[TRACE_RING_SIZE];
+static uint32_t trace_next = 0; // total number of stamps, the ring index is this modulo TRACE_RING_SIZE
+static uint32_t trace_last_scan_id = 0;
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// scratch space for the statistics, which are only computed by one task at a time
+static trace_entry_t snapshot[TRACE_RING_SIZE];
+static int16_t snapshot_start[TRACE_RING_SIZE];    // index of the scan's first stamp
+static int16_t snapshot_previous[TRACE_RING_SIZE]; // index of the scan's previous stamp
+static uint32_t durations[TRACE_RING_SIZE];
+
+static const char *trace_stage_names[TRACE_STAGE_COUNT] = {
+    [TRACE_STAGE_RFID_SCANNED] = "rfid_scanned",
+    [TRACE_STAGE_SCAN_HANDLED] = "scan_handled",
+    [TRACE_STAGE_FRAME_SELECTED] = "frame_selected",
+    [TRACE_STAGE_UPLOAD_QUEUED] = "upload_queued",
+    [TRACE_STAGE_HTTP_OPENED] = "http_opened",
+    [TRACE_STAGE_HTTP_PREAMBLE] = "http_preamble",
+    [TRACE_STAGE_HTTP_IMAGE] = "http_image",
+    [TRACE_STAGE_HTTP_DONE] = "http_done",
+    [TRACE_STAGE_SD_SAVED] = "sd_saved",
+};
+
+const char *trace_stage_name(trace_stage_t stage)
+{
+    return stage < TRACE_STAGE_COUNT ? trace_stage_names[stage] : "unknown";
+}
+
+uint32_t trace_begin_scan()
+{
+    uint32_t scan_id;
+
+    taskENTER_CRITICAL(&trace_lock);
+    trace_last_scan_id++;
+    if (trace_last_scan_id == 0)
+    {
+        trace_last_scan_id = 1; // 0 means untraced
+    }
+    scan_id = trace_last_scan_id;
+    taskEXIT_CRITICAL(&trace_lock);
+
+    trace_stamp(scan_id, TRACE_STAGE_RFID_SCANNED);
+
+    return scan_id;
+}
+
+void trace_stamp(uint32_t scan_id, trace_stage_t stage)
+{
+    if (scan_id == 0 || stage >= TRACE_STAGE_COUNT)
+    {
+        return;
+    }
+
+    uint32_t now = (uint32_t)esp_timer_get_time();
+
+    taskENTER_CRITICAL(&trace_lock);
+    trace_entry_t *entry = &trace_ring[trace_next % TRACE_RING_SIZE];
+    entry->time_us = now;
+    entry->scan_id = scan_id;
+    entry->stage = stage;
+    trace_next++;
+    taskEXIT_CRITICAL(&trace_lock);
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Copies the ring oldest first and links every stamp to the first and the previous stamp of its scan.
+ * Returns the number of stamps copied.
+ */
+static size_t take_snapshot()
+{
+    size_t count;
+
+    taskENTER_CRITICAL(&trace_lock);
+    count = trace_next < TRACE_RING_SIZE ? trace_next : TRACE_RING_SIZE;
+    uint32_t first = trace_next - count;
+    for (size_t i = 0; i < count; i++)
+    {
+        snapshot[i] = trace_ring[(first + i) % TRACE_RING_SIZE];
+    }
+    taskEXIT_CRITICAL(&trace_lock);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        snapshot_start[i] = -1;
+        snapshot_previous[i] = -1;
+        for (int j = (int)i - 1; j >= 0; j--)
+        {
+            if (snapshot[j].scan_id != snapshot[i].scan_id)
+            {
+                continue;
+            }
+            if (snapshot_previous[i] < 0)
+            {
+                snapshot_previous[i] = (int16_t)j;
+            }
+            if (snapshot[j].stage == TRACE_STAGE_RFID_SCANNED)
+            {
+                snapshot_start[i] = (int16_t)j;
+                break;
+            }
+        }
+    }
+
+    return count;
+}
+
+static trace_percentiles_t percentiles_of(size_t count, trace_stage_t stage, const int16_t *reference)
+{
+    trace_percentiles_t result = {0};
+    size_t n = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (snapshot[i].stage == stage && reference[i] >= 0)
+        {
+            durations[n++] = snapshot[i].time_us - snapshot[reference[i]].time_us;
+        }
+    }
+
+    if (n == 0)
+    {
+        return result;
+    }
+
+    qsort(durations, n, sizeof(uint32_t), compare_u32);
+
+    result.count = n;
+    result.p50 = durations[(n - 1) * 50 / 100];
+    result.p95 = durations[(n - 1) * 95 / 100];
+    result.p99 = durations[(n - 1) * 99 / 100];
+
+    return result;
+}
+
+void trace_dump()
+{
+    size_t count = take_snapshot();
+
+    ESP_LOGI(TAG, "Scan trace over the last %zu stamps (us)", count);
+    ESP_LOGI(TAG, "%-16s %6s | %10s %10s %10s | %10s %10s %10s", "stage", "count",
+             "scan p50", "scan p95", "scan p99", "step p50", "step p95", "step p99");
+
+    for (int stage = TRACE_STAGE_SCAN_HANDLED; stage < TRACE_STAGE_COUNT; stage++)
+    {
+        trace_percentiles_t since_scan = percentiles_of(count, stage, snapshot_start);
+        trace_percentiles_t since_previous = percentiles_of(count, stage, snapshot_previous);
+        if (since_previous.count == 0)
+        {
+            continue;
+        }
+
+        ESP_LOGI(TAG, "%-16s %6" PRIu32 " | %10" PRIu32 " %10" PRIu32 " %10" PRIu32 " | %10" PRIu32 " %10" PRIu32 " %10" PRIu32,
+                 trace_stage_name(stage), since_previous.count,
+                 since_scan.p50, since_scan.p95, since_scan.p99,
+                 since_previous.p50, since_previous.p95, since_previous.p99);
+    }
+}
+
+int trace_to_json(char *out, size_t out_length)
+{
+    size_t count = take_snapshot();
+    size_t written = 0;
+    int n;
+
+#define JSON_APPEND(...)                                                   \
+    do                                                                     \
+    {                                                                      \
+        n = snprintf(out + written, out_length - written, __VA_ARGS__);    \
+        if (n < 0 || (size_t)n >= out_length - written)                    \
+        {                                                                  \
+            return -1;                                                     \
+        }                                                                  \
+        written += n;                                                      \
+    } while (0)
+
+    JSON_APPEND("{\"stamps\":%zu,\"stages\":[", count);
+
+    bool first = true;
+    for (int stage = TRACE_STAGE_SCAN_HANDLED; stage < TRACE_STAGE_COUNT; stage++)
+    {
+        trace_percentiles_t since_scan = percentiles_of(count, stage, snapshot_start);
+        trace_percentiles_t since_previous = percentiles_of(count, stage, snapshot_previous);
+        if (since_previous.count == 0)
+        {
+            continue;
+        }
+
+        JSON_APPEND("%s{\"stage\":\"%s\",\"count\":%" PRIu32 ","
+                    "\"since_scan_us\":{\"p50\":%" PRIu32 ",\"p95\":%" PRIu32 ",\"p99\":%" PRIu32 "},"
+                    "\"since_previous_us\":{\"p50\":%" PRIu32 ",\"p95\":%" PRIu32 ",\"p99\":%" PRIu32 "}}",
+                    first ? "" : ",", trace_stage_name(stage), since_previous.count,
+                    since_scan.p50, since_scan.p95, since_scan.p99,
+                    since_previous.p50, since_previous.p95, since_previous.p99);
+        first = false;
+    }
+
+    JSON_APPEND("]}");
+
+#undef JSON_APPEND
+
+    return (int)written;
+}
+
+esp_err_t trace_post_json()
+{
+    char *json = malloc(TRACE_JSON_BUFFER_SIZE);
+    if (json == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    int json_length = trace_to_json(json, TRACE_JSON_BUFFER_SIZE);
+    if (json_length < 0)
+    {
+        ESP_LOGE(TAG, "The trace statistics don't fit in %d bytes.", TRACE_JSON_BUFFER_SIZE);
+        free(json);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp_http_client_config_t config = {
+        .url = "http://" SERVER_ADDRESS "/trace",
+        .method = HTTP_METHOD_POST,
+        .disable_auto_redirect = true,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL)
+    {
+        free(json);
+        return ESP_FAIL;
+    }
+
+    esp_http_client_set_header(client, "Content-Type", "application/json");
+    esp_http_client_set_post_field(client, json, json_length);
+
+    esp_err_t err = esp_http_client_perform(client);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Couldn't post the trace statistics (error : %s)", esp_err_to_name(err));
+    }
+
+    esp_http_client_cleanup(client);
+    free(json);
+
+    return err;
+}
+
+void trace_export_task(void *args)
+{
+    while (1)
+    {
+        vTaskDelay(TRACE_EXPORT_INTERVAL_MS / portTICK_PERIOD_MS);
+
+        trace_dump();
+        scan_debounce_log_stats();
+        roster_log_stats();
+        wifi_log_stats();
+
+        if (WIFI_CONNECTED_BIT & xEventGroupGetBits(s_wifi_event_group))
+        {
+            trace_post_json();
+        }
+    }
+
+    vTaskDelete(NULL);
+}
@@ -4,10 +4,16 @@
 #include <ctype.h>
 #include <math.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
 #include "esp_http_client.h"
 #include "esp_timer.h"
 #include "esp_camera.h"
 #include "esp_tls.h"
+#include "esp_mac.h"
+#include "mbedtls/sha256.h"
 #include "esp_err.h"
 #include "esp_log.h"
 
@@ -18,20 +24,68 @@
 #include "globals.h"
 #include "events.h"
 #include "upload.h"
+#include "multipart.h"
+#include "frame-pool.h"
+#include "trace.h"
+#include "offline-store.h"
+#include "attendance-log.h"
+#include "offline-drain.h"
+#include "connectivity.h"
 // --------------
 
-#define HTTP_POST_REQUEST_BODY_SIZE 512   // allocate this on heap
-#define HTTP_POST_REQUEST_HEADER_SIZE 512 // allocate header on heap
-#define PART_BOUNDARY "123456789000000000000987654321"
-static const char *_STREAM_CONTENT_TYPE = "multipart/form-data; boundary=" PART_BOUNDARY;
-static const char *_CONTENT_DISPOSITION = "form-data; name=\"upfile\"; filename=\"%s\"; ";
-static const char *_STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
-static const char *_MULTIPART_FORM_DATA_BODY_END = "\r\n--" PART_BOUNDARY "--\r\n";
+_Static_assert(UPLOAD_BATCH_MAX_COUNT <= MULTIPART_MAX_PARTS, "a batch is sent as one multipart body");
+
+typedef struct upload_connection_stats_t
+{
+    uint32_t connects;       // requests which had to open a new connection
+    uint32_t reused;         // requests sent on an already open connection
+    int64_t connect_time_us; // total time spent connecting
+} upload_connection_stats_t;
+
+/*
+ * Running averages (ewma, weight 1/UPLOAD_BATCH_EWMA_WEIGHT) of the last requests, from which the batch size is picked.
+ */
+typedef struct upload_link_estimate_t
+{
+    int64_t rtt_us;      // last byte written until the response headers arrived
+    int64_t us_per_kb;   // time to write one kilobyte of the request
+    int64_t image_bytes; // size of an image
+} upload_link_estimate_t;
+
+static esp_http_client_handle_t persistent_client = NULL;
+static QueueHandle_t upload_queue = NULL;
+static upload_connection_stats_t connection_stats;
+static upload_link_estimate_t link_estimate;
+static bool connection_opened; // set by HTTP_EVENT_ON_CONNECTED during `esp_http_client_open()`
+static int64_t connected_at;
+
+// Declared with size (MAX_HTTP_OUTPUT_BUFFER + 1) to prevent out of bound access when
+// it is used by functions like strlen(). The buffer should only be used upto size MAX_HTTP_OUTPUT_BUFFER
+static char response_buffer[MAX_HTTP_OUTPUT_BUFFER + 1];
+
+#if UPLOAD_MODE == UPLOAD_MODE_MULTIPART
+// only the uploader task builds requests, so the body can live here instead of on the heap
+static multipart_body_t request_body;
+#endif
+
+// the station mac, sent with raw uploads so the server can tell the readers apart
+static char device_id[13];
+
+// jpegs encoded for the batch's frames which the camera didn't deliver as jpeg, freed after the request
+static uint8_t *encoded_jpegs[UPLOAD_BATCH_MAX_COUNT];
+
+// the captures of the request being sent
+static rfid_a_s_event_data_t batch[UPLOAD_BATCH_MAX_COUNT];
+
+// a capture taken off the queue which didn't fit in the byte budget of the previous batch
+static rfid_a_s_event_data_t carried_capture;
+static bool has_carried_capture = false;
+
+static char *output_buffer; // Buffer to store response of http request from event handler
+static int output_len;      // Stores number of bytes read
 
 static esp_err_t _http_event_handler(esp_http_client_event_t *evt)
 {
-    static char *output_buffer; // Buffer to store response of http request from event handler
-    static int output_len;      // Stores number of bytes read
     switch (evt->event_id)
     {
     case HTTP_EVENT_ERROR:
@@ -39,6 +93,8 @@ static esp_err_t _http_event_handler(esp_http_client_event_t *evt)
         break;
     case HTTP_EVENT_ON_CONNECTED:
         ESP_LOGD(TAG, "HTTP_EVENT_ON_CONNECTED");
+        connection_opened = true;
+        connected_at = esp_timer_get_time();
         break;
     case HTTP_EVENT_HEADER_SENT:
         ESP_LOGD(TAG, "HTTP_EVENT_HEADER_SENT");
@@ -132,187 +188,593 @@ static esp_err_t _http_event_handler(esp_http_client_event_t *evt)
     return ESP_OK;
 }
 
-esp_err_t send_crlf(esp_http_client_handle_t client)
+static int http_write(void *context, const char *data, size_t length)
+{
+    return esp_http_client_write((esp_http_client_handle_t)context, data, length);
+}
+
+/**
+ * The connection to the server is kept open across uploads (HTTP/1.1 keep-alive), and only reopened
+ * once it turns out to be broken. Only the uploader task uses it.
+ */
+static esp_http_client_handle_t get_persistent_client()
+{
+    if (persistent_client != NULL)
+    {
+        return persistent_client;
+    }
+
+    /**
+     * NOTE: All the configuration parameters for http_client must be spefied either in URL or as host and path parameters.
+     * If host and path parameters are not set, query parameter will be ignored. In such cases,
+     * query parameter should be specified in URL.
+     *
+     * If URL as well as host and path parameters are specified, values of host and path will be considered.
+     */
+    esp_http_client_config_t config = {
+        .url = "http://" SERVER_ADDRESS "/post",
+        .method = HTTP_METHOD_POST,
+        .event_handler = _http_event_handler,
+        .user_data = response_buffer, // Pass address of the buffer to get response
+        .disable_auto_redirect = true,
+        .keep_alive_enable = true, // tcp keep-alive, to notice a dead server between scans
+    };
+    persistent_client = esp_http_client_init(&config);
+
+    return persistent_client;
+}
+
+static void stamp_batch(size_t count, trace_stage_t stage)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        trace_stamp(batch[i].scan_id, stage);
+    }
+}
+
+static void free_encoded_jpegs(size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        free(encoded_jpegs[i]);
+        encoded_jpegs[i] = NULL;
+    }
+}
+
+/**
+ * The jpeg of the capture `batch[i]`, encoded into `encoded_jpegs[i]` if the camera didn't deliver a jpeg.
+ */
+static esp_err_t capture_jpeg(size_t i, const uint8_t **out_jpeg, size_t *out_length)
 {
-    if ( -1 == esp_http_client_write(client, "\r\n", 2) ) {
+    camera_fb_t *fb = &batch[i].frame->fb;
+
+    if (fb->format == PIXFORMAT_JPEG)
+    {
+        *out_jpeg = fb->buf;
+        *out_length = fb->len;
+        return ESP_OK;
+    }
+
+    if (!frame2jpg(fb, 80, &encoded_jpegs[i], out_length))
+    {
+        ESP_LOGE(TAG, "Couldn't encode frame buffer.");
         return ESP_FAIL;
     }
+    *out_jpeg = encoded_jpegs[i];
 
     return ESP_OK;
-};
+}
 
-void upload_jpeg_task(void *args)
+/**
+ * Folds the timings of a finished request into the link estimate.
+ */
+static void update_link_estimate(int64_t write_us, int64_t rtt_us, size_t bytes, size_t count)
 {
-    u8_t retry = 0;
-    rfid_a_s_event_data_t *event_data = (rfid_a_s_event_data_t *)args;
+    int64_t us_per_kb = write_us * 1024 / (bytes > 0 ? bytes : 1);
+    int64_t image_bytes = bytes / count;
+
+    if (link_estimate.image_bytes == 0)
+    {
+        // the first measurement
+        link_estimate.rtt_us = rtt_us;
+        link_estimate.us_per_kb = us_per_kb;
+        link_estimate.image_bytes = image_bytes;
+        return;
+    }
 
-    // generic filename for now
-    const char *filename = "capture.jpg";
+    link_estimate.rtt_us += (rtt_us - link_estimate.rtt_us) / UPLOAD_BATCH_EWMA_WEIGHT;
+    link_estimate.us_per_kb += (us_per_kb - link_estimate.us_per_kb) / UPLOAD_BATCH_EWMA_WEIGHT;
+    link_estimate.image_bytes += (image_bytes - link_estimate.image_bytes) / UPLOAD_BATCH_EWMA_WEIGHT;
+}
 
-    // if the control reaches this part, the tag and frame buffer should never be null
-    // todo: remove at production
-    assert(event_data->tag != NULL);
-    assert(event_data->fb != NULL);
+/**
+ * The number of captures worth sending in one request. The round trip is paid once per request, so the batch
+ * grows until sending its images takes UPLOAD_BATCH_RTT_FACTOR times as long as the round trip.
+ * On a fast link this stays at 1, and nothing waits for a batch to fill up either way.
+ */
+static size_t upload_batch_limit()
+{
+#if UPLOAD_MODE == UPLOAD_MODE_RAW_JPEG
+    // a raw request carries a single image
+    return 1;
+#else
+    int64_t image_us = link_estimate.image_bytes * link_estimate.us_per_kb / 1024;
+    if (image_us <= 0)
+    {
+        // nothing measured yet
+        return 1;
+    }
 
-    // copying the required passed in data as we are unsure of their lifetimes
-    camera_fb_t *fb = malloc(sizeof(camera_fb_t));
-    memcpy(fb, event_data->fb, sizeof(camera_fb_t));
+    int64_t limit = (UPLOAD_BATCH_RTT_FACTOR * link_estimate.rtt_us + image_us - 1) / image_us;
 
-    uint64_t serial_number = event_data->tag->serial_number;
+    return limit < 1 ? 1 : (limit > UPLOAD_BATCH_MAX_COUNT ? UPLOAD_BATCH_MAX_COUNT : limit);
+#endif
+}
 
-    // all the required data are already copied
-    // so freeing the memory used by args
-    free(args);
+/**
+ * Opens a request of `content_length` bytes, reusing the connection if it is still open.
+ */
+static esp_err_t open_request(esp_http_client_handle_t client, size_t count, size_t content_length)
+{
+    // clearing the response of the previous request
+    memset(response_buffer, 0, MAX_HTTP_OUTPUT_BUFFER + 1);
+    output_len = 0;
+
+    // reuses the connection if it is still open, otherwise connects (HTTP_EVENT_ON_CONNECTED)
+    connection_opened = false;
+    int64_t open_start = esp_timer_get_time();
+    esp_err_t err = esp_http_client_open(client, content_length); // sends the Content-Length header
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    if (connection_opened)
+    {
+        connection_stats.connects++;
+        connection_stats.connect_time_us += connected_at - open_start;
+    }
+    else
+    {
+        connection_stats.reused++;
+    }
+    stamp_batch(count, TRACE_STAGE_HTTP_OPENED);
+
+    return ESP_OK;
+}
+
+/**
+ * Reads the whole response to a request whose body was written from `write_start` on, so the connection can be reused.
+ */
+static esp_err_t finish_request(esp_http_client_handle_t client, size_t count, size_t content_length, int64_t write_start)
+{
+    int64_t write_end = esp_timer_get_time();
+
+    // the response has to be read completely, or it would be taken as the response of the next request
+    if (esp_http_client_fetch_headers(client) < 0)
+    {
+        return ESP_FAIL;
+    }
+    int64_t response_start = esp_timer_get_time();
 
+    int response_length;
+    esp_http_client_flush_response(client, &response_length);
+
+    int status = esp_http_client_get_status_code(client);
+    ESP_LOGI(TAG, "HTTP POST Status = %d, content_length = %d", status, response_length);
+
+    if (!esp_http_client_is_complete_data_received(client))
+    {
+        return ESP_FAIL;
+    }
+
+    if (status < 200 || status >= 300)
+    {
+        return ESP_FAIL;
+    }
+
+    update_link_estimate(write_end - write_start, response_start - write_end, content_length, count);
+
+    return ESP_OK;
+}
+
+#if UPLOAD_MODE == UPLOAD_MODE_RAW_JPEG
+
+/**
+ * Sends the single capture in `batch` as the body of an image/jpeg request, its metadata in the headers.
+ */
+static esp_err_t upload_batch(esp_http_client_handle_t client, size_t count, size_t *out_bytes)
+{
     esp_err_t err;
-    size_t fb_len; // to store the exact jpeg length
-    int64_t fr_start;
+    char serial_number_str[24];
+    char scan_time_str[24];
+    char sha256_hex[2 * 32 + 1];
+    uint8_t sha256[32];
+    const uint8_t *jpeg;
+    size_t length;
+
+    if (ESP_OK != (err = capture_jpeg(0, &jpeg, &length)))
+    {
+        return err;
+    }
+    multipart_segment_t image = {.data = jpeg, .length = length};
+    *out_bytes = length;
 
-    size_t hlen;
-    char chunk_len_hex[10];
+    // hardware accelerated, a 40KB jpeg takes well under a millisecond
+    mbedtls_sha256(jpeg, length, sha256, 0);
+    for (size_t i = 0; i < sizeof(sha256); i++)
+    {
+        snprintf(&sha256_hex[2 * i], 3, "%02x", sha256[i]);
+    }
 
-    // Declare local_response_buffer with size (MAX_HTTP_OUTPUT_BUFFER + 1) to prevent out of bound access when
-    // it is used by functions like strlen(). The buffer should only be used upto size MAX_HTTP_OUTPUT_BUFFER
-    char local_response_buffer[MAX_HTTP_OUTPUT_BUFFER + 1];
+    snprintf(serial_number_str, sizeof(serial_number_str), "%" PRIu64, batch[0].tag.serial_number);
+    snprintf(scan_time_str, sizeof(scan_time_str), "%" PRId64, batch[0].scan_wall_time_ms);
+    esp_http_client_set_header(client, "Content-Type", "image/jpeg");
+    esp_http_client_set_header(client, "rfid-serial-number", serial_number_str);
+    esp_http_client_set_header(client, "scan-time", scan_time_str);
+    esp_http_client_set_header(client, "device-id", device_id);
+    esp_http_client_set_header(client, "content-sha256", sha256_hex);
 
-    char *header = calloc(HTTP_POST_REQUEST_HEADER_SIZE + 1, sizeof(char));
-    char *body = calloc(HTTP_POST_REQUEST_BODY_SIZE + 1, sizeof(char));
-    char *temp_buffer = calloc(128 + 1, sizeof(char));
+    if (ESP_OK == (err = open_request(client, count, image.length)))
+    {
+        int64_t write_start = esp_timer_get_time();
+        trace_stamp(batch[0].scan_id, TRACE_STAGE_HTTP_PREAMBLE);
 
-    while (1)
+        if (0 != multipart_write_segments(&image, 1, http_write, client))
+        {
+            ESP_LOGE(TAG, "Couldn't write frame buffer.");
+            err = ESP_FAIL;
+        }
+        else
+        {
+            trace_stamp(batch[0].scan_id, TRACE_STAGE_HTTP_IMAGE);
+            err = finish_request(client, count, image.length, write_start);
+        }
+    }
+    free_encoded_jpegs(count);
+
+    return err;
+}
+
+#else
+
+/**
+ * Describes the batch as one multipart body, pointing at the frames where they are. Frames the camera didn't deliver
+ * as jpeg are encoded first, the length of the body has to be known before the request is opened.
+ * The jpeg bytes of the batch are added to `out_bytes`.
+ */
+static esp_err_t build_body(size_t count, size_t *out_bytes)
+{
+    multipart_body_init(&request_body);
+
+    for (size_t i = 0; i < count; i++)
     {
-        err = ESP_OK;
+        const uint8_t *jpeg;
+        size_t length;
 
-        // clearing the buffer
-        memset(local_response_buffer, 0, MAX_HTTP_OUTPUT_BUFFER + 1);
-        memset(header, 0, HTTP_POST_REQUEST_HEADER_SIZE);
-        memset(body, 0, HTTP_POST_REQUEST_BODY_SIZE);
-        memset(temp_buffer, 0, 128);
+        if (ESP_OK != capture_jpeg(i, &jpeg, &length) ||
+            0 != multipart_body_add_jpeg(&request_body, batch[i].tag.serial_number, batch[i].scan_wall_time_ms, jpeg, length))
+        {
+            return ESP_FAIL;
+        }
+        *out_bytes += length;
+    }
+    multipart_body_finish(&request_body);
 
-        // upload to server
-        ESP_LOGI(TAG, "Uploading jpeg to server: " SERVER_ADDRESS);
+    return ESP_OK;
+}
 
-        fb_len = 0;
-        fr_start = esp_timer_get_time();
-        ESP_LOGI(TAG, "The rfid tag: %" PRIu64, serial_number);
-
-        /**
-         * NOTE: All the configuration parameters for http_client must be spefied either in URL or as host and path parameters.
-         * If host and path parameters are not set, query parameter will be ignored. In such cases,
-         * query parameter should be specified in URL.
-         *
-         * If URL as well as host and path parameters are specified, values of host and path will be considered.
-         */
-        esp_http_client_config_t config = {
-            .url = "http://" SERVER_ADDRESS "/post",
-            .method = HTTP_METHOD_POST,
-            .event_handler = _http_event_handler,
-            .user_data = local_response_buffer, // Pass address of local buffer to get response
-            .disable_auto_redirect = true,
-        };
-        esp_http_client_handle_t client = esp_http_client_init(&config);
-
-        // if the frame buffer is a nullptr, we cannot proceed for upload
-        // same for client == null
-        if (!fb || !client)
+/**
+ * Sends `request_body` with the captures in `batch`.
+ */
+static esp_err_t send_body(esp_http_client_handle_t client, size_t count)
+{
+    esp_err_t err;
+    char serial_number_str[24];
+
+    // every part carries its own serial, the one of the request is the first part's, for older servers
+    snprintf(serial_number_str, sizeof(serial_number_str), "%" PRIu64, batch[0].tag.serial_number);
+    esp_http_client_set_header(client, "rfid-serial-number", serial_number_str);
+    esp_http_client_set_header(client, "Content-Type", MULTIPART_CONTENT_TYPE);
+
+    if (ESP_OK != (err = open_request(client, count, request_body.content_length)))
+    {
+        return err;
+    }
+
+    // the header and the jpeg of every part straight from where they are, then the closing boundary
+    int64_t write_start = esp_timer_get_time();
+    for (size_t i = 0; i < count; i++)
+    {
+        if (0 != multipart_write_segments(&request_body.segments[2 * i], 1, http_write, client))
         {
-            esp_http_client_cleanup(client);
-            break;
+            return ESP_FAIL;
         }
+        trace_stamp(batch[i].scan_id, TRACE_STAGE_HTTP_PREAMBLE);
 
-        // some header
-        sprintf(temp_buffer, "%" PRIu64 "", serial_number);
-        esp_http_client_set_header(client, "rfid-serial-number", temp_buffer);
-        esp_http_client_set_header(client, "Content-Type", _STREAM_CONTENT_TYPE);
+        if (0 != multipart_write_segments(&request_body.segments[2 * i + 1], 1, http_write, client))
+        {
+            ESP_LOGE(TAG, "Couldn't write frame buffer.");
+            return ESP_FAIL;
+        }
+        trace_stamp(batch[i].scan_id, TRACE_STAGE_HTTP_IMAGE);
+    }
 
-        // setup to send data as chunk
-        esp_http_client_open(client, -1); // write_len=-1 sets header "Transfer-Encoding: chunked" and method to POST
+    if (0 != multipart_write_segments(&request_body.segments[2 * count], 1, http_write, client))
+    {
+        return ESP_FAIL;
+    }
 
-        // start body
-        strcpy(body, _STREAM_BOUNDARY);                       // boundary start
-        sprintf(temp_buffer, _CONTENT_DISPOSITION, filename); // contentent disposition with filename
-        strcat(body, temp_buffer);                            // concatenating to the body
-        sprintf(temp_buffer, "Content-Type: application/octet-stream\r\n\r\n");
-        strcat(body, temp_buffer);
+    return finish_request(client, count, request_body.content_length, write_start);
+}
 
-        ESP_LOGI(TAG, "The sent body is %s", body);
+/**
+ * Sends the captures in `batch` as the parts of one multipart request with a known Content-Length.
+ */
+static esp_err_t upload_batch(esp_http_client_handle_t client, size_t count, size_t *out_bytes)
+{
+    *out_bytes = 0;
 
-        // the length of body in hex
-        hlen = snprintf(chunk_len_hex, sizeof(chunk_len_hex), "%X", strlen(body));
-        esp_http_client_write(client, strcat(chunk_len_hex, "\r\n"), hlen + 2); // assuming hlen < 8
+    esp_err_t err = build_body(count, out_bytes);
+    if (err == ESP_OK)
+    {
+        err = send_body(client, count);
+    }
+    free_encoded_jpegs(count);
 
-        // send body
-        esp_http_client_write(client, body, HTTP_POST_REQUEST_BODY_SIZE);
-        err = send_crlf(client);
-        if (err == ESP_OK)
+    return err;
+}
+
+#endif
+
+void upload_log_connection_stats()
+{
+    uint32_t requests = connection_stats.connects + connection_stats.reused;
+    if (requests == 0 || connection_stats.connects == 0)
+    {
+        return;
+    }
+
+    // every reused connection saved one connect, on average as long as the ones measured
+    int64_t average_connect_us = connection_stats.connect_time_us / connection_stats.connects;
+    ESP_LOGI(TAG, "HTTP connection reused for %" PRIu32 " of %" PRIu32 " requests (%" PRIu32 "%%), %" PRIu32 " reconnects, "
+                  "average connect %" PRId64 " ms, saved ~%" PRId64 " ms",
+             connection_stats.reused, requests, connection_stats.reused * 100 / requests, connection_stats.connects,
+             average_connect_us / 1000, average_connect_us * connection_stats.reused / 1000);
+}
+
+/**
+ * Uploads the batch, retrying over a fresh connection on failure.
+ * Falls back to the offline store once the retries are used up.
+ */
+static void upload_captures(size_t count)
+{
+    u8_t retry = 0;
+
+    esp_err_t err = ESP_FAIL;
+    size_t bytes; // the exact length of the jpegs sent
+    int64_t fr_start;
+
+    // the server went away while these were queued, no point in waiting for the timeouts
+    while (connectivity_server_reachable())
+    {
+        // upload to server
+        ESP_LOGI(TAG, "Uploading %zu jpeg(s) to server: " SERVER_ADDRESS, count);
+
+        bytes = 0;
+        fr_start = esp_timer_get_time();
+
+        esp_http_client_handle_t client = get_persistent_client();
+
+        // we cannot proceed for upload if client == null
+        if (!client)
         {
-            if (fb->format == PIXFORMAT_JPEG)
-            {
-                fb_len = fb->len;
-                // the length of frame buffer in hex
-                hlen = snprintf(chunk_len_hex, sizeof(chunk_len_hex), "%X", fb_len);
-                esp_http_client_write(client, strcat(chunk_len_hex, "\r\n"), hlen + 2); // assuming hlen < 8
-                if (-1 == esp_http_client_write(client, (char *)fb->buf, fb_len))
-                { // the frame buffer
-                    ESP_LOGE(TAG, "Couldn't write frame buffer.");
-                }
-            }
-            else
-            {
-                uint8_t *jpeg_buffer;
-                if (ESP_OK == err && frame2jpg(fb, 80, &jpeg_buffer, &fb_len))
-                {
-                    // the length of frame buffer in hex
-                    hlen = snprintf(chunk_len_hex, sizeof(chunk_len_hex), "%X", fb_len);
-                    esp_http_client_write(client, strcat(chunk_len_hex, "\r\n"), hlen + 2); // assuming hlen < 8
-                    if (-1 == esp_http_client_write(client, (char *)jpeg_buffer, fb_len))
-                    { // the frame buffer
-                        ESP_LOGE(TAG, "Couldn't write frame buffer.");
-                    }
-                }
-            }
-            send_crlf(client);
+            break;
         }
-        // the length of stream boundary in hex
-        hlen = snprintf(chunk_len_hex, sizeof(chunk_len_hex), "%X", strlen(_STREAM_BOUNDARY));
-        esp_http_client_write(client, strcat(chunk_len_hex, "\r\n"), hlen + 2); // assuming hlen < 8
-        esp_http_client_write(client, _MULTIPART_FORM_DATA_BODY_END, strlen(_MULTIPART_FORM_DATA_BODY_END));
-        send_crlf(client);
-
-        // end
-        esp_http_client_write(client, "0\r\n", 3);
-        err = send_crlf(client);  // send \r\n
-        // // converting fb_len to string
-        // char fb_len_str[(size_t)((ceil(log10(fb_len)) + 1) * sizeof(char))];
-        // sprintf(fb_len_str, "%zu", fb_len);
-
-        // esp_http_client_set_header(client, "Content-Length", fb_len_str);
-        // err = esp_http_client_perform(client);
-        
+
+        err = upload_batch(client, count, &bytes);
+
         if (err == ESP_OK)
         {
-            ESP_LOGI(TAG, "HTTP POST Status = %d, content_length = %" PRId64,
-                     esp_http_client_get_status_code(client),
-                     esp_http_client_get_content_length(client));
             int64_t fr_end = esp_timer_get_time();
-            ESP_LOGI(TAG, "JPG: %luKB %lums", (uint32_t)(fb_len / 1024), (uint32_t)((fr_end - fr_start) / 1000));
+            connectivity_report(true);
+            stamp_batch(count, TRACE_STAGE_HTTP_DONE);
+            ESP_LOGI(TAG, "JPG: %zu x %luKB %lums, rtt %lums, next batch up to %zu", count,
+                     (uint32_t)(bytes / count / 1024), (uint32_t)((fr_end - fr_start) / 1000),
+                     (uint32_t)(link_estimate.rtt_us / 1000), upload_batch_limit());
+            upload_log_connection_stats();
 
             break;
         }
         else
         {
             ESP_LOGE(TAG, "HTTP POST request failed: %s", esp_err_to_name(err));
+
+            // the connection is in an unknown state, the next attempt reconnects
+            esp_http_client_close(client);
+
             retry += 1;
 
             if (retry > UPLOAD_RETRY_COUNT)
+            {
+                connectivity_report(false);
                 break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        offline_drain_on_upload(&batch[i], err);
+    }
+
+    if (err == ESP_OK)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!batch[i].stored)
+            {
+                attendance_log_record(&batch[i], ATTENDANCE_UPLOADED, batch[i].frame->fb.len);
+            }
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t serial_number = batch[i].tag.serial_number;
+
+        // captures replayed from the store are still in there
+        if (batch[i].stored)
+        {
+            continue;
+        }
+
+        ESP_LOGI(TAG, "Upload failed, saving image offline.");
+        if (ESP_OK != offline_store_append(serial_number, batch[i].scan_wall_time_ms, batch[i].frame->fb.buf, batch[i].frame->fb.len))
+        {
+            ESP_LOGE(TAG, "Couldn't save image for rfid_tag: %" PRIu64 " offline.", serial_number);
+            attendance_log_record(&batch[i], ATTENDANCE_IMAGE_LOST, 0);
+        }
+        else
+        {
+            attendance_log_record(&batch[i], ATTENDANCE_STORED, batch[i].frame->fb.len);
+        }
+        trace_stamp(batch[i].scan_id, TRACE_STAGE_SD_SAVED);
+    }
+}
+
+/**
+ * Fills `batch` with the first capture (waiting for one) followed by whatever is already queued, up to the
+ * current batch limit and UPLOAD_BATCH_MAX_BYTES. Returns the number of captures taken.
+ */
+static size_t take_batch()
+{
+    size_t count = 0;
+    size_t bytes = 0;
+    size_t limit = upload_batch_limit();
+
+    if (has_carried_capture)
+    {
+        batch[count++] = carried_capture;
+        has_carried_capture = false;
+    }
+    else if (pdTRUE != xQueueReceive(upload_queue, &batch[count], portMAX_DELAY))
+    {
+        return 0;
+    }
+    else
+    {
+        count++;
+    }
+    bytes += batch[0].frame->fb.len;
+
+    // only what is already waiting, a lone scan is never held back
+    while (count < limit && pdTRUE == xQueueReceive(upload_queue, &batch[count], 0))
+    {
+        if (bytes + batch[count].frame->fb.len > UPLOAD_BATCH_MAX_BYTES)
+        {
+            carried_capture = batch[count];
+            has_carried_capture = true;
+            break;
+        }
+        bytes += batch[count].frame->fb.len;
+        count++;
+    }
+
+    return count;
+}
+
+/**
+ * Logs the stack left over whenever it reached a new low, the deepest paths (connecting, the offline fallback) only
+ * run now and then.
+ */
+static void log_stack_high_water_mark()
+{
+    static UBaseType_t lowest = UINT32_MAX;
+
+    UBaseType_t left = uxTaskGetStackHighWaterMark(NULL); // in bytes on esp-idf
+    if (left >= lowest)
+    {
+        return;
+    }
+    lowest = left;
+
+    if (left < UPLOADER_STACK_LOW_WATER)
+    {
+        ESP_LOGW(TAG, "Uploader stack: %u of %u bytes never used", (unsigned)left, (unsigned)TASK_UPLOADER_STACK_SIZE);
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Uploader stack: %u of %u bytes never used", (unsigned)left, (unsigned)TASK_UPLOADER_STACK_SIZE);
+    }
+}
+
+void uploader_task(void *args)
+{
+    while (1)
+    {
+        size_t count = take_batch();
+
+        if (count > 0)
+        {
+            upload_captures(count);
+            log_stack_high_water_mark();
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            // the references handed over by `upload_enqueue()`
+            frame_pool_release(batch[i].frame);
         }
-        esp_http_client_close(client);
-        esp_http_client_cleanup(client);
     }
-    free(fb); // clearing the frame buffer that we created
-    free(header);
-    free(body);
-    free(temp_buffer);
+
     vTaskDelete(NULL);
 }
+
+esp_err_t upload_enqueue(const rfid_a_s_event_data_t *capture)
+{
+    if (upload_queue == NULL || capture == NULL || capture->frame == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // never blocking the caller (the photo task), a full queue means the uplink can't keep up
+    if (pdTRUE != xQueueSend(upload_queue, capture, 0))
+    {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return ESP_OK;
+}
+
+size_t upload_queue_depth()
+{
+    return upload_queue == NULL ? 0 : uxQueueMessagesWaiting(upload_queue);
+}
+
+esp_err_t upload_init()
+{
+    uint8_t mac[6];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    snprintf(device_id, sizeof(device_id), "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+    upload_queue = xQueueCreate(UPLOAD_QUEUE_SIZE, sizeof(rfid_a_s_event_data_t));
+    if (upload_queue == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (pdPASS != xTaskCreatePinnedToCore(uploader_task,
+                                          "Uploader_Task",
+                                          TASK_UPLOADER_STACK_SIZE,
+                                          NULL,
+                                          UPLOADER_TASK_PRIORITY,
+                                          NULL,
+                                          UPLOADER_TASK_CORE_AFFINITY))
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
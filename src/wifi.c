@@ -7,6 +7,7 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 #include <string.h>
+#include <inttypes.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
@@ -14,6 +15,9 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "nvs.h"
 #include "esp_netif_sntp.h"
 
 #include "lwip/err.h"
@@ -29,40 +33,244 @@
 /* FreeRTOS event group to signal when we are connected*/
 EventGroupHandle_t s_wifi_event_group;
 
-static int s_retry_num = 0;
+// what the event handler tells the supervisor, as bits of its task notification
+#define WIFI_NOTIFY_STARTED BIT0
+#define WIFI_NOTIFY_DISCONNECTED BIT1
+#define WIFI_NOTIFY_GOT_IP BIT2
+
+/**
+ * The AP of the last connection, kept in nvs so a reboot joins it again without scanning every channel.
+ */
+typedef struct wifi_cached_ap_t
+{
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_cached_ap_t;
+
+typedef struct wifi_stats_t
+{
+    uint32_t attempts;
+    uint32_t fast_attempts;  // on the cached AP, without a scan
+    uint32_t fast_connects;
+    uint32_t connects;
+    uint32_t disconnects;
+    uint8_t last_reason;     // wifi_err_reason_t of the last disconnect
+    int64_t offline_us;      // without an ip, since boot
+    int64_t longest_outage_us;
+    int64_t outage_start_us; // 0 while connected
+    int8_t rssi;             // of the last sample
+    int8_t rssi_min;
+    int32_t rssi_sum;
+    uint32_t rssi_samples;
+} wifi_stats_t;
+
+static TaskHandle_t supervisor_task_handle = NULL;
+static wifi_cached_ap_t cached_ap;
+static bool cached_ap_valid = false;
+static bool cached_ap_dirty = false; // connected to another AP, it is stored by the supervisor
+static bool fast_attempt = false;    // whether the attempt in flight is on the cached AP
+static wifi_stats_t stats = {.rssi_min = INT8_MAX};
+
+static void notify_supervisor(uint32_t bits)
+{
+    if (supervisor_task_handle != NULL)
+    {
+        xTaskNotify(supervisor_task_handle, bits, eSetBits);
+    }
+}
 
 static void event_handler(void *arg, esp_event_base_t event_base,
                           int32_t event_id, void *event_data)
 {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
     {
-        esp_wifi_connect();
+        notify_supervisor(WIFI_NOTIFY_STARTED);
     }
-    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED)
     {
-        if (s_retry_num < EXAMPLE_ESP_MAXIMUM_RETRY)
+        wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+
+        if (!cached_ap_valid || event->channel != cached_ap.channel || 0 != memcmp(event->bssid, cached_ap.bssid, sizeof(cached_ap.bssid)))
         {
-            esp_wifi_connect();
-            s_retry_num++;
-            ESP_LOGI(TAG, "retry to connect to the AP");
+            memcpy(cached_ap.bssid, event->bssid, sizeof(cached_ap.bssid));
+            cached_ap.channel = event->channel;
+            cached_ap_valid = true;
+            cached_ap_dirty = true;
         }
-        else
+        stats.fast_connects += fast_attempt;
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
+    {
+        wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+
+        // the captures go to the sdcard until the connection is back
+        if (WIFI_CONNECTED_BIT & xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT))
         {
-            xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+            stats.disconnects++;
+            stats.outage_start_us = esp_timer_get_time();
         }
-        ESP_LOGI(TAG, "connect to the AP fail");
+        stats.last_reason = event->reason;
+
+        ESP_LOGI(TAG, "connect to the AP fail (reason %d)", event->reason);
+        notify_supervisor(WIFI_NOTIFY_DISCONNECTED);
     }
     else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
     {
         ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-        ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
-        s_retry_num = 0;
+        ESP_LOGI(TAG, "got ip:" IPSTR " %" PRId64 " ms after boot", IP2STR(&event->ip_info.ip), esp_timer_get_time() / 1000);
+
+        // also sent for a dhcp renew that changes the ip, without an outage before it
+        if (stats.outage_start_us != 0)
+        {
+            int64_t outage_us = esp_timer_get_time() - stats.outage_start_us;
+            stats.offline_us += outage_us;
+            stats.longest_outage_us = outage_us > stats.longest_outage_us ? outage_us : stats.longest_outage_us;
+            stats.outage_start_us = 0;
+            stats.connects++;
+        }
 
         // // try to sync time on wifi connected
         // esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG("pool.ntp.org");
         // esp_netif_sntp_init(&config);
 
+        xEventGroupClearBits(s_wifi_event_group, WIFI_FAIL_BIT);
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+        notify_supervisor(WIFI_NOTIFY_GOT_IP);
+    }
+}
+
+static void load_cached_ap()
+{
+    nvs_handle_t handle;
+    size_t length = sizeof(cached_ap);
+
+    if (ESP_OK == nvs_open(WIFI_NVS_NAMESPACE, NVS_READONLY, &handle))
+    {
+        cached_ap_valid = ESP_OK == nvs_get_blob(handle, WIFI_NVS_AP_KEY, &cached_ap, &length) && length == sizeof(cached_ap);
+        nvs_close(handle);
+    }
+}
+
+static void store_cached_ap()
+{
+    nvs_handle_t handle;
+
+    if (ESP_OK == nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &handle))
+    {
+        if (ESP_OK == nvs_set_blob(handle, WIFI_NVS_AP_KEY, &cached_ap, sizeof(cached_ap)))
+        {
+            nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+}
+
+static void sample_rssi()
+{
+    wifi_ap_record_t ap;
+
+    if (ESP_OK == esp_wifi_sta_get_ap_info(&ap))
+    {
+        stats.rssi = ap.rssi;
+        stats.rssi_min = ap.rssi < stats.rssi_min ? ap.rssi : stats.rssi_min;
+        stats.rssi_sum += ap.rssi;
+        stats.rssi_samples++;
+    }
+}
+
+/**
+ * Starts an attempt on the cached AP while the last few ones there haven't failed, otherwise on whichever AP of the
+ * ssid a scan of all channels finds.
+ */
+static void start_attempt(uint32_t failures)
+{
+    wifi_config_t config;
+
+    fast_attempt = cached_ap_valid && failures < WIFI_FAST_RECONNECT_ATTEMPTS;
+
+    if (ESP_OK == esp_wifi_get_config(WIFI_IF_STA, &config))
+    {
+        config.sta.bssid_set = fast_attempt;
+        config.sta.channel = fast_attempt ? cached_ap.channel : 0;
+        config.sta.scan_method = fast_attempt ? WIFI_FAST_SCAN : WIFI_ALL_CHANNEL_SCAN;
+        if (fast_attempt)
+        {
+            memcpy(config.sta.bssid, cached_ap.bssid, sizeof(cached_ap.bssid));
+        }
+        esp_wifi_set_config(WIFI_IF_STA, &config);
+    }
+
+    stats.attempts++;
+    stats.fast_attempts += fast_attempt;
+    esp_wifi_connect();
+}
+
+void wifi_supervisor_task(void *args)
+{
+    uint32_t failures = 0; // attempts since the last connection
+    uint32_t backoff_ms = WIFI_RECONNECT_MIN_MS;
+    uint32_t events;
+
+    while (1)
+    {
+        // woken by the event handler, otherwise sampling the link every so often
+        events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, WIFI_RSSI_SAMPLE_INTERVAL_MS / portTICK_PERIOD_MS);
+
+        if (WIFI_CONNECTED_BIT & xEventGroupGetBits(s_wifi_event_group))
+        {
+            failures = 0;
+            backoff_ms = WIFI_RECONNECT_MIN_MS;
+            if (cached_ap_dirty)
+            {
+                cached_ap_dirty = false;
+                store_cached_ap();
+            }
+            sample_rssi();
+            continue;
+        }
+
+        // only a started station or a failed attempt leads to the next one, the driver reports every failure
+        if (!(events & (WIFI_NOTIFY_STARTED | WIFI_NOTIFY_DISCONNECTED)))
+        {
+            continue;
+        }
+
+        if (failures > 0)
+        {
+            // anywhere in the upper half of the backoff, so readers that lost the AP together don't retry together
+            uint32_t delay_ms = backoff_ms / 2 + esp_random() % (backoff_ms / 2 + 1);
+            ESP_LOGI(TAG, "retry to connect to the AP in %" PRIu32 " ms (attempt %" PRIu32 ")", delay_ms, failures + 1);
+            vTaskDelay(delay_ms / portTICK_PERIOD_MS);
+            backoff_ms = backoff_ms * 2 < WIFI_RECONNECT_MAX_MS ? backoff_ms * 2 : WIFI_RECONNECT_MAX_MS;
+        }
+
+        if (failures == EXAMPLE_ESP_MAXIMUM_RETRY)
+        {
+            ESP_LOGI(TAG, "Failed to connect to SSID:%s, still retrying", EXAMPLE_ESP_WIFI_SSID);
+            xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
+        }
+
+        start_attempt(failures);
+        failures++;
+    }
+
+    vTaskDelete(NULL);
+}
+
+void wifi_log_stats()
+{
+    int64_t offline_us = stats.offline_us + (stats.outage_start_us ? esp_timer_get_time() - stats.outage_start_us : 0);
+
+    ESP_LOGI(TAG, "Wifi: %" PRIu32 " connections from %" PRIu32 " attempts (%" PRIu32 " of %" PRIu32 " on the cached AP), "
+                  "%" PRIu32 " disconnects (last reason %d), offline %" PRId64 " s, longest %" PRId64 " s",
+             stats.connects, stats.attempts, stats.fast_connects, stats.fast_attempts, stats.disconnects,
+             stats.last_reason, offline_us / 1000000, stats.longest_outage_us / 1000000);
+
+    if (stats.rssi_samples > 0)
+    {
+        ESP_LOGI(TAG, "Wifi rssi: %d dBm, average %" PRId32 " dBm, lowest %d dBm",
+                 stats.rssi, stats.rssi_sum / (int32_t)stats.rssi_samples, stats.rssi_min);
     }
 }
 
@@ -70,9 +278,17 @@ void wifi_init_sta(void)
 {
     s_wifi_event_group = xEventGroupCreate();
 
-    ESP_ERROR_CHECK(esp_netif_init());
+    load_cached_ap();
+    stats.outage_start_us = esp_timer_get_time(); // not connected yet
+
+    // started before the station, so it gets WIFI_EVENT_STA_START
+    xTaskCreate(wifi_supervisor_task,
+                "Wifi_Supervisor_Task",
+                TASK_WIFI_SUPERVISOR_STACK_SIZE,
+                NULL,
+                WIFI_SUPERVISOR_TASK_PRIORITY,
+                &supervisor_task_handle);
 
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
     esp_netif_create_default_wifi_sta();
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
@@ -110,30 +326,6 @@ void wifi_init_sta(void)
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
     ESP_ERROR_CHECK(esp_wifi_start());
 
+    // the connection comes up in the background, WIFI_CONNECTED_BIT tells when it is there
     ESP_LOGI(TAG, "wifi_init_sta finished.");
-
-    /* Waiting until either the connection is established (WIFI_CONNECTED_BIT) or connection failed for the maximum
-     * number of re-tries (WIFI_FAIL_BIT). The bits are set by event_handler() (see above) */
-    EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
-                                           WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
-                                           pdFALSE,
-                                           pdFALSE,
-                                           portMAX_DELAY);
-
-    /* xEventGroupWaitBits() returns the bits before the call returned, hence we can test which event actually
-     * happened. */
-    if (bits & WIFI_CONNECTED_BIT)
-    {
-        ESP_LOGI(TAG, "connected to ap SSID:%s password:%s",
-                 EXAMPLE_ESP_WIFI_SSID, EXAMPLE_ESP_WIFI_PASS);
-    }
-    else if (bits & WIFI_FAIL_BIT)
-    {
-        ESP_LOGI(TAG, "Failed to connect to SSID:%s, password:%s",
-                 EXAMPLE_ESP_WIFI_SSID, EXAMPLE_ESP_WIFI_PASS);
-    }
-    else
-    {
-        ESP_LOGE(TAG, "UNEXPECTED EVENT");
-    }
 }
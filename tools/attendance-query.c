@@ -0,0 +1,319 @@
+/*
+ * Answers "who was present between T1 and T2" from the attendance log the device writes to the sdcard
+ * (/sdcard/attend.dat, see include/attendance-format.h).
+ *
+ *     cc -O2 -I include -o attendance-query tools/attendance-query.c
+ *     ./attendance-query attend.dat "2026-10-05 07:30" "2026-10-05 09:00"
+ *     ./attendance-query attend.dat 1791185400000 1791190800000   # ms since the epoch work too
+ *
+ * Times are UTC. The log is mapped, not read, and scanned once, which takes milliseconds for a year of records.
+ * A year of made up records to try it on:
+ *
+ *     ./attendance-query --generate year.dat
+ */
+
+#define _GNU_SOURCE // timegm
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "attendance-format.h"
+
+#define GENERATE_DAYS 250    // school days in a year
+#define GENERATE_STUDENTS 800
+#define GENERATE_FIRST_DAY_S 1788220800 // 2026-09-01 00:00 UTC
+
+typedef struct presence_t
+{
+    uint64_t serial_number;
+    uint32_t scans;
+    int64_t first_ms;
+    int64_t last_ms;
+    uint8_t last_outcome;
+} presence_t;
+
+static const char *outcome_names[ATTENDANCE_OUTCOME_COUNT] = {
+    [ATTENDANCE_UPLOADED] = "uploaded",
+    [ATTENDANCE_STORED] = "stored",
+    [ATTENDANCE_IMAGE_LOST] = "image lost",
+};
+
+static uint32_t crc32_table[256];
+
+static void crc32_init()
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+        {
+            c = (c >> 1) ^ (0xedb88320 & -(c & 1));
+        }
+        crc32_table[i] = c;
+    }
+}
+
+/**
+ * The same as `esp_rom_crc32_le()` on the device.
+ */
+static uint32_t crc32_le(uint32_t crc, const uint8_t *data, size_t length)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc = crc32_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static int64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool parse_time(const char *text, int64_t *out_ms)
+{
+    struct tm t = {0};
+    char *end;
+
+    long long ms = strtoll(text, &end, 10);
+    if (*end == '\0' && end != text)
+    {
+        *out_ms = ms;
+        return true;
+    }
+
+    end = strptime(text, "%Y-%m-%d %H:%M", &t);
+    if (end == NULL)
+    {
+        end = strptime(text, "%Y-%m-%d", &t);
+    }
+    if (end == NULL || *end != '\0')
+    {
+        return false;
+    }
+
+    *out_ms = (int64_t)timegm(&t) * 1000;
+    return true;
+}
+
+static void format_time(int64_t ms, char *out, size_t out_length)
+{
+    time_t seconds = ms / 1000;
+    struct tm t;
+    gmtime_r(&seconds, &t);
+    strftime(out, out_length, "%Y-%m-%d %H:%M:%S", &t);
+}
+
+static int compare_presence(const void *a, const void *b)
+{
+    uint64_t x = ((const presence_t *)a)->serial_number;
+    uint64_t y = ((const presence_t *)b)->serial_number;
+    return (x > y) - (x < y);
+}
+
+static int generate(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    attendance_log_header_t header = {
+        .magic = ATTENDANCE_LOG_MAGIC,
+        .version = ATTENDANCE_LOG_VERSION,
+        .record_size = sizeof(attendance_record_t),
+        .created_ms = (int64_t)GENERATE_FIRST_DAY_S * 1000,
+    };
+    header.crc = crc32_le(0, (const uint8_t *)&header, offsetof(attendance_log_header_t, crc));
+    fwrite(&header, sizeof(header), 1, f);
+
+    // every student in the morning between 7:30 and 8:30 and out in the afternoon, in scan order
+    uint32_t scan_id = 0;
+    size_t records = 0;
+    for (int day = 0; day < GENERATE_DAYS; day++)
+    {
+        int64_t day_ms = ((int64_t)GENERATE_FIRST_DAY_S + (int64_t)(day / 5 * 7 + day % 5) * 86400) * 1000;
+        for (int half = 0; half < 2; half++)
+        {
+            int64_t start_ms = day_ms + (half == 0 ? 7 * 3600 + 1800 : 15 * 3600) * 1000LL;
+            for (int i = 0; i < GENERATE_STUDENTS; i++)
+            {
+                attendance_record_t record = {
+                    .serial_number = 911101686122ULL + (uint64_t)((i * 7919) % GENERATE_STUDENTS),
+                    .wall_time_ms = start_ms + (int64_t)i * 3600 * 1000 / GENERATE_STUDENTS,
+                    .monotonic_us = ((int64_t)i * 3600 * 1000 / GENERATE_STUDENTS) * 1000,
+                    .scan_id = ++scan_id,
+                    .outcome = (uint8_t)(i % 50 == 0 ? ATTENDANCE_STORED : ATTENDANCE_UPLOADED),
+                    .image_length = 40 * 1024,
+                };
+                record.crc = crc32_le(0, (const uint8_t *)&record, offsetof(attendance_record_t, crc));
+                fwrite(&record, sizeof(record), 1, f);
+                records++;
+            }
+        }
+    }
+
+    if (0 != fclose(f))
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    printf("%zu records written to %s\n", records, path);
+
+    return 0;
+}
+
+static int query(const char *path, int64_t from_ms, int64_t to_ms)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || 0 != fstat(fd, &st))
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    if ((size_t)st.st_size < sizeof(attendance_log_header_t))
+    {
+        fprintf(stderr, "%s: too short for an attendance log\n", path);
+        return 1;
+    }
+
+    const uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    const attendance_log_header_t *header = (const attendance_log_header_t *)map;
+    if (header->magic != ATTENDANCE_LOG_MAGIC || header->version != ATTENDANCE_LOG_VERSION ||
+        header->record_size != sizeof(attendance_record_t) ||
+        header->crc != crc32_le(0, map, offsetof(attendance_log_header_t, crc)))
+    {
+        fprintf(stderr, "%s: not an attendance log of version %d\n", path, ATTENDANCE_LOG_VERSION);
+        return 1;
+    }
+
+    int64_t start = now_us();
+
+    // every record is looked at, scans from before the clock was set break the time order
+    const attendance_record_t *records = (const attendance_record_t *)(map + sizeof(attendance_log_header_t));
+    size_t count = (st.st_size - sizeof(attendance_log_header_t)) / sizeof(attendance_record_t);
+    presence_t *present = malloc((count ? count : 1) * sizeof(presence_t));
+    size_t matched = 0;
+    size_t corrupt = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const attendance_record_t *record = &records[i];
+        if (record->wall_time_ms < from_ms || record->wall_time_ms > to_ms)
+        {
+            continue;
+        }
+        if (record->crc != crc32_le(0, (const uint8_t *)record, offsetof(attendance_record_t, crc)))
+        {
+            corrupt++;
+            continue;
+        }
+        present[matched++] = (presence_t){
+            .serial_number = record->serial_number,
+            .scans = 1,
+            .first_ms = record->wall_time_ms,
+            .last_ms = record->wall_time_ms,
+            .last_outcome = record->outcome,
+        };
+    }
+
+    // one line per serial, the scans of a serial are merged
+    qsort(present, matched, sizeof(presence_t), compare_presence);
+    size_t people = 0;
+    for (size_t i = 0; i < matched; i++)
+    {
+        presence_t *p = &present[people];
+        if (people > 0 && present[people - 1].serial_number == present[i].serial_number)
+        {
+            p = &present[people - 1];
+            p->scans++;
+            if (present[i].first_ms < p->first_ms)
+            {
+                p->first_ms = present[i].first_ms;
+            }
+            if (present[i].last_ms >= p->last_ms)
+            {
+                p->last_ms = present[i].last_ms;
+                p->last_outcome = present[i].last_outcome;
+            }
+            continue;
+        }
+        *p = present[i];
+        people++;
+    }
+
+    int64_t elapsed = now_us() - start;
+
+    char first[32];
+    char last[32];
+    printf("%-20s %6s  %-19s  %-19s  %s\n", "serial", "scans", "first", "last", "last image");
+    for (size_t i = 0; i < people; i++)
+    {
+        format_time(present[i].first_ms, first, sizeof(first));
+        format_time(present[i].last_ms, last, sizeof(last));
+        printf("%-20" PRIu64 " %6" PRIu32 "  %s  %s  %s\n", present[i].serial_number, present[i].scans, first, last,
+               present[i].last_outcome < ATTENDANCE_OUTCOME_COUNT ? outcome_names[present[i].last_outcome] : "?");
+    }
+
+    fprintf(stderr, "%zu present, %zu scans of %zu records (%zu corrupt) in %.2f ms\n",
+            people, matched, count, corrupt, elapsed / 1000.0);
+
+    free(present);
+    munmap((void *)map, st.st_size);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int64_t from_ms;
+    int64_t to_ms;
+
+    crc32_init();
+
+    if (argc == 3 && 0 == strcmp(argv[1], "--generate"))
+    {
+        return generate(argv[2]);
+    }
+
+    if (argc != 4)
+    {
+        fprintf(stderr, "usage: %s <log> <from> <to>\n"
+                        "       %s --generate <log>\n"
+                        "times as \"YYYY-MM-DD[ HH:MM]\" (UTC) or ms since the epoch\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+
+    if (!parse_time(argv[2], &from_ms) || !parse_time(argv[3], &to_ms))
+    {
+        fprintf(stderr, "couldn't parse the times\n");
+        return 1;
+    }
+
+    return query(argv[1], from_ms, to_ms);
+}
@@ -0,0 +1,85 @@
+/*
+ * Runs the benchmarks of src/benchmark.c on the host, so a regression in the encoding, the queue and event glue or
+ * the storage paths shows up before a build reaches the devices. The esp-idf parts are replaced by tools/host:
+ * FreeRTOS tasks and queues on pthreads, the default event loop on a thread of its own, a camera handing out the
+ * given jpeg.
+ *
+ *     cc -O2 -pthread -I include -I tools/host -DBENCHMARK_SCRATCH_FOLDER='"/tmp/benchmark"' -o benchmark-host \
+ *         tools/benchmark-host.c tools/host/esp-host.c src/benchmark.c src/multipart.c src/frame-quality.c \
+ *         src/frame-pool.c src/sd-writer.c src/sd-card.c src/roster.c -lm
+ *     ./benchmark-host capture.jpg
+ *
+ * The sdcard benchmarks write to BENCHMARK_SCRATCH_FOLDER, on the host disk, which tells about the code but not
+ * about a card. Without a jpeg the frame is noise and the frame pool and scorer benchmarks are skipped, the same as
+ * on a device without a camera.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_camera.h"
+#include "esp_event.h"
+#include "esp_err.h"
+
+// local includes
+
+#include "benchmark.h"
+#include "events.h"
+#include "frame-pool.h"
+
+// --------------
+
+ESP_EVENT_DEFINE_BASE(RFID_A_S_EVENTS);
+
+static uint8_t *read_file(const char *path, size_t *length)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    rewind(file);
+
+    uint8_t *data = malloc(*length);
+    if (data == NULL || fread(data, 1, *length, file) != *length)
+    {
+        fprintf(stderr, "%s: couldn't read\n", path);
+        exit(1);
+    }
+    fclose(file);
+
+    return data;
+}
+
+int main(int argc, char **argv)
+{
+    static sdmmc_card_t card; // stands in for a mounted card, the paths go to the host filesystem
+    uint8_t *jpeg = NULL;
+    size_t jpeg_length = 0;
+
+    if (argc > 2)
+    {
+        fprintf(stderr, "usage: %s [jpeg]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 2)
+    {
+        jpeg = read_file(argv[1], &jpeg_length);
+        host_camera_set_frame(jpeg, jpeg_length);
+    }
+
+    if (ESP_OK != esp_event_loop_create_default() || ESP_OK != frame_pool_init())
+    {
+        fprintf(stderr, "couldn't set up the event loop and the frame pool\n");
+        return 1;
+    }
+
+    run_benchmarks(&card);
+
+    free(jpeg);
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * Scores jpegs with src/frame-quality.c the way the camera feed task picks the frame of a burst, and times it.
+ * Every image is also scored cut off at 90%, 60% and 40% of its length, like a frame buffer that wasn't filled,
+ * those have to be rejected.
+ *
+ *     cc -O2 -I include -I tools/host -o frame-quality-bench tools/frame-quality-bench.c src/frame-quality.c -lm
+ *     ./frame-quality-bench captures/scan-*.jpg
+ *
+ * Prints the score and the frames per second of every variant. Exits with 1 if a truncated frame was scored, or an
+ * intact one wasn't.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "esp_err.h"
+#include "frame-quality.h"
+
+#define BENCH_TIME_US 200000
+
+static const int cuts_percent[] = {100, 90, 60, 40};
+
+static int64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint8_t *read_file(const char *path, size_t *length)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    rewind(file);
+
+    uint8_t *data = malloc(*length);
+    if (data == NULL || fread(data, 1, *length, file) != *length)
+    {
+        fprintf(stderr, "%s: couldn't read\n", path);
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+
+    return data;
+}
+
+/**
+ * Scores the first `length` bytes of `jpeg` over and over for BENCH_TIME_US, returns the frames per second.
+ */
+static double bench(const uint8_t *jpeg, size_t length)
+{
+    frame_quality_t quality;
+    int frames = 0;
+
+    int64_t start = now_us();
+    int64_t elapsed;
+    do
+    {
+        frame_quality_score(jpeg, length, &quality);
+        frames++;
+        elapsed = now_us() - start;
+    } while (elapsed < BENCH_TIME_US);
+
+    return frames * 1000000.0 / elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    bool failed = false;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <jpeg>...\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-32s %4s %8s %-22s %8s %8s %8s\n", "image", "cut", "bytes", "result", "score", "luma", "frames/s");
+
+    for (int i = 1; i < argc; i++)
+    {
+        size_t length;
+        uint8_t *jpeg = read_file(argv[i], &length);
+        if (jpeg == NULL)
+        {
+            failed = true;
+            continue;
+        }
+
+        for (size_t c = 0; c < sizeof(cuts_percent) / sizeof(cuts_percent[0]); c++)
+        {
+            size_t cut_length = length * cuts_percent[c] / 100;
+            frame_quality_t quality = {0};
+            esp_err_t err = frame_quality_score(jpeg, cut_length, &quality);
+
+            bool intact = cuts_percent[c] == 100;
+            bool wrong = intact ? err != ESP_OK : err == ESP_OK;
+            failed |= wrong;
+
+            printf("%-32s %3d%% %8zu %-22s %8.1f %8.1f %8.0f%s\n", argv[i], cuts_percent[c], cut_length,
+                   esp_err_to_name(err), quality.score, quality.mean_luma, bench(jpeg, cut_length),
+                   wrong ? (intact ? "  <- not scored" : "  <- truncated but scored") : "");
+        }
+
+        free(jpeg);
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "esp_err.h"
+#include "driver/sdmmc_types.h"
+
+/*
+ * The spi bus and the sdspi host as far as `init_sd_card()` uses them, which always fails on the host.
+ */
+
+#define SPI2_HOST 1
+
+typedef struct spi_bus_config_t
+{
+    int mosi_io_num;
+    int miso_io_num;
+    int sclk_io_num;
+    int quadwp_io_num;
+    int quadhd_io_num;
+    int max_transfer_sz;
+} spi_bus_config_t;
+
+typedef struct sdspi_device_config_t
+{
+    int host_id;
+    int gpio_cs;
+} sdspi_device_config_t;
+
+#define SDSPI_HOST_DEFAULT() ((sdmmc_host_t){.slot = SPI2_HOST})
+#define SDSPI_DEVICE_CONFIG_DEFAULT() ((sdspi_device_config_t){.host_id = SPI2_HOST, .gpio_cs = -1})
+
+esp_err_t spi_bus_initialize(int host_id, const spi_bus_config_t *bus_config, int dma_channel);
+esp_err_t spi_bus_free(int host_id);
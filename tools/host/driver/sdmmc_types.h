@@ -0,0 +1,15 @@
+#pragma once
+
+/*
+ * The sdcard types, on the host the "card" is whatever directory the paths point at.
+ */
+
+typedef struct sdmmc_host_t
+{
+    int slot;
+} sdmmc_host_t;
+
+typedef struct sdmmc_card_t
+{
+    sdmmc_host_t host;
+} sdmmc_card_t;
@@ -0,0 +1,516 @@
+/*
+ * What the headers in tools/host declare: FreeRTOS tasks and queues on pthreads, the default event loop, a camera
+ * handing out one jpeg, and no sdcard, flash or nvs to be found. Linked into the host builds of the portable
+ * sources, see tools/benchmark-host.c.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "driver/gpio.h"
+#include "driver/sdmmc_host.h"
+#include "esp_camera.h"
+#include "esp_event.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "esp_vfs_fat.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "sdmmc_cmd.h"
+
+#define EVENT_LOOP_QUEUE_SIZE 32
+#define EVENT_HANDLER_COUNT 16
+
+// ------------- tasks
+
+typedef struct task_start_t
+{
+    TaskFunction_t task;
+    void *parameters;
+} task_start_t;
+
+static void *run_task(void *args)
+{
+    task_start_t start = *(task_start_t *)args;
+    free(args);
+
+    start.task(start.parameters);
+
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *created_task)
+{
+    pthread_t thread;
+    task_start_t *start = malloc(sizeof(task_start_t));
+    if (start == NULL)
+    {
+        return pdFAIL;
+    }
+    start->task = task;
+    start->parameters = parameters;
+
+    if (0 != pthread_create(&thread, NULL, run_task, start))
+    {
+        free(start);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+
+    if (created_task != NULL)
+    {
+        *created_task = (TaskHandle_t)(uintptr_t)thread;
+    }
+
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+    return xTaskCreate(task, name, stack_depth, parameters, priority, created_task);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL)
+    {
+        pthread_exit(NULL);
+    }
+    abort(); // deleting another task isn't supported
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = {.tv_sec = ticks / 1000, .tv_nsec = (long)(ticks % 1000) * 1000000};
+    while (0 != nanosleep(&ts, &ts) && errno == EINTR)
+    {
+    }
+}
+
+TickType_t xTaskGetTickCount()
+{
+    return (TickType_t)(esp_timer_get_time() / 1000);
+}
+
+// ------------- queues
+
+struct host_queue_t
+{
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint8_t *items;
+    UBaseType_t item_size;
+    UBaseType_t length;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+static struct timespec deadline_after(TickType_t ticks)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    if (ticks != portMAX_DELAY)
+    {
+        deadline.tv_sec += ticks / 1000;
+        deadline.tv_nsec += (long)(ticks % 1000) * 1000000;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+    }
+
+    return deadline;
+}
+
+/**
+ * Waits for `cond` once, with the lock held. Returns false once the ticks ran out.
+ */
+static bool queue_wait(QueueHandle_t queue, pthread_cond_t *cond, TickType_t ticks_to_wait, const struct timespec *deadline)
+{
+    if (ticks_to_wait == 0)
+    {
+        return false;
+    }
+    if (ticks_to_wait == portMAX_DELAY)
+    {
+        pthread_cond_wait(cond, &queue->lock);
+        return true;
+    }
+
+    return ETIMEDOUT != pthread_cond_timedwait(cond, &queue->lock, deadline);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    QueueHandle_t queue = calloc(1, sizeof(struct host_queue_t));
+    if (queue == NULL)
+    {
+        return NULL;
+    }
+    queue->items = malloc(length * item_size + 1);
+    if (queue->items == NULL)
+    {
+        free(queue);
+        return NULL;
+    }
+    queue->length = length;
+    queue->item_size = item_size;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_cond_destroy(&queue->not_full);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = deadline_after(ticks_to_wait);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length)
+    {
+        if (!queue_wait(queue, &queue->not_full, ticks_to_wait, &deadline) && queue->count == queue->length)
+        {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFALSE;
+        }
+    }
+
+    if (queue->item_size > 0)
+    {
+        UBaseType_t tail = (queue->head + queue->count) % queue->length;
+        memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+    }
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = deadline_after(ticks_to_wait);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0)
+    {
+        if (!queue_wait(queue, &queue->not_empty, ticks_to_wait, &deadline) && queue->count == 0)
+        {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFALSE;
+        }
+    }
+
+    if (queue->item_size > 0)
+    {
+        memcpy(buffer, queue->items + queue->head * queue->item_size, queue->item_size);
+    }
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+
+    return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    SemaphoreHandle_t mutex = xQueueCreate(1, 0);
+    if (mutex != NULL)
+    {
+        xSemaphoreGive(mutex);
+    }
+
+    return mutex;
+}
+
+// ------------- the default event loop
+
+typedef struct event_t
+{
+    esp_event_base_t base;
+    int32_t id;
+    void *data; // a copy, freed once the handlers ran
+} event_t;
+
+typedef struct event_handler_entry_t
+{
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void *args;
+} event_handler_entry_t;
+
+static QueueHandle_t event_queue = NULL;
+static event_handler_entry_t event_handlers[EVENT_HANDLER_COUNT];
+static pthread_mutex_t event_handlers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void event_loop_task(void *args)
+{
+    event_t event;
+
+    while (pdTRUE == xQueueReceive(event_queue, &event, portMAX_DELAY))
+    {
+        // the handlers are copied out, so they can (un)register others while they run
+        event_handler_entry_t handlers[EVENT_HANDLER_COUNT];
+        pthread_mutex_lock(&event_handlers_lock);
+        memcpy(handlers, event_handlers, sizeof(handlers));
+        pthread_mutex_unlock(&event_handlers_lock);
+
+        for (size_t i = 0; i < EVENT_HANDLER_COUNT; i++)
+        {
+            if (handlers[i].handler != NULL &&
+                (handlers[i].base == ESP_EVENT_ANY_BASE || handlers[i].base == event.base) &&
+                (handlers[i].id == ESP_EVENT_ANY_ID || handlers[i].id == event.id))
+            {
+                handlers[i].handler(handlers[i].args, event.base, event.id, event.data);
+            }
+        }
+        free(event.data);
+    }
+}
+
+esp_err_t esp_event_loop_create_default()
+{
+    if (event_queue != NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    event_queue = xQueueCreate(EVENT_LOOP_QUEUE_SIZE, sizeof(event_t));
+    if (event_queue == NULL || pdPASS != xTaskCreate(event_loop_task, "sys_evt", 0, NULL, 0, NULL))
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_event_post(esp_event_base_t event_base, int32_t event_id, const void *event_data, size_t event_data_size, TickType_t ticks_to_wait)
+{
+    if (event_queue == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    event_t event = {
+        .base = event_base,
+        .id = event_id,
+    };
+    if (event_data_size > 0)
+    {
+        event.data = malloc(event_data_size);
+        if (event.data == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+        memcpy(event.data, event_data, event_data_size);
+    }
+
+    if (pdTRUE != xQueueSend(event_queue, &event, ticks_to_wait))
+    {
+        free(event.data);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t event_base, int32_t event_id, esp_event_handler_t event_handler, void *event_handler_arg)
+{
+    esp_err_t ret = ESP_ERR_NO_MEM;
+
+    pthread_mutex_lock(&event_handlers_lock);
+    for (size_t i = 0; i < EVENT_HANDLER_COUNT; i++)
+    {
+        if (event_handlers[i].handler == NULL)
+        {
+            event_handlers[i] = (event_handler_entry_t){event_base, event_id, event_handler, event_handler_arg};
+            ret = ESP_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&event_handlers_lock);
+
+    return ret;
+}
+
+esp_err_t esp_event_handler_unregister(esp_event_base_t event_base, int32_t event_id, esp_event_handler_t event_handler)
+{
+    pthread_mutex_lock(&event_handlers_lock);
+    for (size_t i = 0; i < EVENT_HANDLER_COUNT; i++)
+    {
+        if (event_handlers[i].handler == event_handler && event_handlers[i].base == event_base && event_handlers[i].id == event_id)
+        {
+            event_handlers[i].handler = NULL;
+        }
+    }
+    pthread_mutex_unlock(&event_handlers_lock);
+
+    return ESP_OK;
+}
+
+// ------------- camera
+
+static camera_fb_t camera_frame;
+
+void host_camera_set_frame(const uint8_t *jpeg, size_t length)
+{
+    camera_frame.buf = (uint8_t *)jpeg;
+    camera_frame.len = length;
+    camera_frame.format = PIXFORMAT_JPEG;
+}
+
+camera_fb_t *esp_camera_fb_get()
+{
+    if (camera_frame.buf == NULL)
+    {
+        return NULL;
+    }
+    gettimeofday(&camera_frame.timestamp, NULL);
+
+    return &camera_frame;
+}
+
+void esp_camera_fb_return(camera_fb_t *fb)
+{
+}
+
+// ------------- no hardware
+
+esp_err_t gpio_pullup_en(gpio_num_t gpio_num)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_pull_mode(gpio_num_t gpio_num, gpio_pull_mode_t pull)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_initialize(int host_id, const spi_bus_config_t *bus_config, int dma_channel)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t spi_bus_free(int host_id)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_vfs_fat_sdspi_mount(const char *base_path, const sdmmc_host_t *host_config,
+                                  const sdspi_device_config_t *slot_config,
+                                  const esp_vfs_fat_mount_config_t *mount_config, sdmmc_card_t **out_card)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_vfs_fat_sdcard_unmount(const char *base_path, sdmmc_card_t *card)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void sdmmc_card_print_info(FILE *stream, const sdmmc_card_t *card)
+{
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    // bitwise, the same polynomial and conditioning as the rom function
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
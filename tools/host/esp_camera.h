@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "esp_err.h"
+
+typedef enum
+{
+    PIXFORMAT_RGB565,
+    PIXFORMAT_YUV422,
+    PIXFORMAT_YUV420,
+    PIXFORMAT_GRAYSCALE,
+    PIXFORMAT_JPEG,
+} pixformat_t;
+
+typedef struct camera_fb_t
+{
+    uint8_t *buf;
+    size_t len;
+    size_t width;
+    size_t height;
+    pixformat_t format;
+    struct timeval timestamp;
+} camera_fb_t;
+
+/**
+ * The fake camera hands out the frame set here, over and over. Without one `esp_camera_fb_get()` returns NULL,
+ * like a camera that failed to start.
+ */
+void host_camera_set_frame(const uint8_t *jpeg, size_t length);
+
+camera_fb_t *esp_camera_fb_get();
+void esp_camera_fb_return(camera_fb_t *fb);
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "esp_timer.h"
+
+// debug and verbose logs are left out, the same as a device built with the info log level
+#define HOST_LOG(letter, tag, format, ...) \
+    printf(letter " (%lld) %s: " format "\n", (long long)(esp_timer_get_time() / 1000), tag, ##__VA_ARGS__)
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG("E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG("W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG("I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ((void)(tag))
+#define ESP_LOGV(tag, format, ...) ((void)(tag))
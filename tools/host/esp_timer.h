@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Microseconds since the host booted, the monotonic clock.
+ */
+static inline int64_t esp_timer_get_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * FreeRTOS on top of pthreads, as much as the portable sources use. Tasks are threads, a tick is a millisecond.
+ * Priorities and core affinities are taken but ignored, the host scheduler decides.
+ */
+
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdFAIL pdFALSE
+#define pdPASS pdTRUE
+
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS ((TickType_t)1)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+typedef pthread_mutex_t portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED PTHREAD_MUTEX_INITIALIZER
+
+#define taskENTER_CRITICAL(mux) pthread_mutex_lock(mux)
+#define taskEXIT_CRITICAL(mux) pthread_mutex_unlock(mux)
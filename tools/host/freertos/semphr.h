@@ -0,0 +1,16 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+/*
+ * A mutex is a queue of one empty item, the same as in FreeRTOS itself, without the priority inheritance.
+ */
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+
+#define vSemaphoreDelete(semaphore) vQueueDelete(semaphore)
+#define xSemaphoreTake(semaphore, ticks_to_wait) xQueueReceive(semaphore, NULL, ticks_to_wait)
+#define xSemaphoreGive(semaphore) xQueueSend(semaphore, NULL, 0)
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/*
+ * Nothing is kept across runs on the host, every namespace is empty.
+ */
+
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+
+typedef uint32_t nvs_handle_t;
+
+typedef enum
+{
+    NVS_READONLY,
+    NVS_READWRITE,
+} nvs_open_mode_t;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle);
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value);
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value);
+esp_err_t nvs_commit(nvs_handle_t handle);
+void nvs_close(nvs_handle_t handle);
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * The types of the rc522 component the events carry, there is no reader on the host.
+ */
+
+typedef struct rc522 *rc522_handle_t;
+
+typedef struct rc522_tag_t
+{
+    uint64_t serial_number;
+} rc522_tag_t;
@@ -0,0 +1,257 @@
+/*
+ * Posts multipart bodies built by src/multipart.c to the mock server (or anything else speaking HTTP/1.1), the way
+ * the uploader sends a batch: one Content-Length request over a kept open connection, the segments written with
+ * writev() straight from where they are.
+ *
+ *     cc -O2 -I include -o multipart-check tools/multipart-check.c src/multipart.c
+ *     python mock_server/server.py &
+ *     ./multipart-check -n 100 -p 4 127.0.0.1:8000
+ *     ./multipart-check -j capture.jpg 127.0.0.1:8000      # the server shows the image until a key is pressed
+ *     ./multipart-check -b -p 4                            # only the encoding, no server
+ *     ./multipart-check -r -j capture.jpg 127.0.0.1:8000   # the raw image/jpeg upload mode instead
+ *
+ * Without -j the parts are attendance only records (no image), which the server counts without decoding them.
+ * Every body is checked for its length and framing before it is sent, every response has to be a 200 saying how many
+ * parts the server found. Prints the request rate, throughput and request latencies at the end, run once with and
+ * once without -r to compare the upload modes (UPLOAD_MODE in include/upload.h). The server logs its cpu time per
+ * request.
+ */
+
+#define _GNU_SOURCE // strcasestr
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "multipart.h"
+#include "upload-client.h"
+
+#define DEFAULT_REQUESTS 20
+#define DEFAULT_PARTS 1
+#define BENCH_ITERATIONS 20000
+#define BENCH_IMAGE_SIZE (40 * 1024) // about a VGA capture, when no jpeg is given
+#define FIRST_SERIAL 911101686122ULL
+#define DEVICE_ID "multipart-check"
+
+typedef struct sink_t
+{
+    uint8_t *buffer;
+    size_t used;
+    size_t capacity;
+} sink_t;
+
+static int sink_write(void *context, const char *data, size_t length)
+{
+    sink_t *sink = context;
+    if (sink->used + length > sink->capacity)
+    {
+        return -1;
+    }
+    memcpy(sink->buffer + sink->used, data, length);
+    sink->used += length;
+    return length;
+}
+
+static void build(multipart_body_t *body, int parts, int request, const uint8_t *jpeg, size_t jpeg_length)
+{
+    multipart_body_init(body);
+    for (int i = 0; i < parts; i++)
+    {
+        uint64_t serial = FIRST_SERIAL + (uint64_t)(request * parts + i) % 700;
+        if (0 != multipart_body_add_jpeg(body, serial, wall_ms(), jpeg, jpeg_length))
+        {
+            fprintf(stderr, "couldn't add part %d\n", i);
+            exit(1);
+        }
+    }
+    multipart_body_finish(body);
+}
+
+/**
+ * The body written out has to be exactly `content_length` long, open with the first boundary and end with the
+ * closing one.
+ */
+static void check_body(const multipart_body_t *body, sink_t *sink)
+{
+    static const char first[] = "\r\n--" MULTIPART_BOUNDARY "\r\n";
+    static const char last[] = "\r\n--" MULTIPART_BOUNDARY "--\r\n";
+
+    sink->used = 0;
+    if (0 != multipart_write_segments(body->segments, body->segment_count, sink_write, sink) ||
+        sink->used != body->content_length ||
+        0 != memcmp(sink->buffer, first, sizeof(first) - 1) ||
+        0 != memcmp(sink->buffer + sink->used - (sizeof(last) - 1), last, sizeof(last) - 1))
+    {
+        fprintf(stderr, "malformed body: %zu bytes written, content length %zu\n", sink->used, body->content_length);
+        exit(1);
+    }
+}
+
+static int bench(const uint8_t *jpeg, size_t jpeg_length, int parts, sink_t *sink)
+{
+    static multipart_body_t body;
+
+    int64_t start = now_us();
+    for (int i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        build(&body, parts, i, jpeg, jpeg_length);
+        sink->used = 0;
+        multipart_write_segments(body.segments, body.segment_count, sink_write, sink);
+    }
+    int64_t elapsed = now_us() - start;
+
+    printf("%d bodies of %d x %zu bytes: %.2f us each, %.1f MB/s (the copy into the sink included)\n", BENCH_ITERATIONS,
+           parts, jpeg_length, (double)elapsed / BENCH_ITERATIONS,
+           (double)BENCH_ITERATIONS * body.content_length / elapsed);
+
+    return 0;
+}
+
+/**
+ * Fills `iov` with request `r` the way the device sends it in either upload mode, returns the number of iovecs and
+ * the response expected.
+ */
+static int build_request(bool raw, int r, int parts, const uint8_t *jpeg, size_t jpeg_length, const char *digest,
+                         const char *address, multipart_body_t *body, sink_t *sink, char *header, struct iovec *iov,
+                         char *expected)
+{
+    if (raw)
+    {
+        uint64_t serial = FIRST_SERIAL + (uint64_t)r % 700;
+        snprintf(expected, 64, "Got image for rfid tag %" PRIu64, serial);
+        return upload_request_raw(header, iov, address, serial, wall_ms(), DEVICE_ID, digest, jpeg, jpeg_length);
+    }
+
+    build(body, parts, r, jpeg, jpeg_length);
+    check_body(body, sink);
+    snprintf(expected, 64, "Got %d image(s)", parts);
+
+    return upload_request_multipart(header, iov, address, FIRST_SERIAL, body);
+}
+
+static int post(const char *address, bool raw, int requests, int parts, const uint8_t *jpeg, size_t jpeg_length, sink_t *sink)
+{
+    static multipart_body_t body;
+    char header[REQUEST_HEADER_SIZE];
+    char response[RESPONSE_SIZE];
+    char expected[64];
+    struct iovec iov[REQUEST_IOV_COUNT];
+    char digest[65] = "";
+    int64_t *latencies = malloc(requests * sizeof(int64_t));
+    uint64_t bytes = 0;
+
+    int fd = connect_to(address);
+    if (fd < 0)
+    {
+        fprintf(stderr, "%s: %s\n", address, strerror(errno));
+        return 1;
+    }
+    if (raw)
+    {
+        sha256_hex(jpeg, jpeg_length, digest);
+    }
+
+    int64_t start = now_us();
+    for (int r = 0; r < requests; r++)
+    {
+        int64_t request_start = now_us();
+        int iov_count = build_request(raw, r, parts, jpeg, jpeg_length, digest, address, &body, sink, header, iov, expected);
+        for (int i = 1; i < iov_count; i++)
+        {
+            bytes += iov[i].iov_len;
+        }
+
+        if (!writev_all(fd, iov, iov_count))
+        {
+            fprintf(stderr, "request %d: %s\n", r, strerror(errno));
+            return 1;
+        }
+
+        int status = read_response(fd, response, sizeof(response));
+        if (status != 200 || 0 != strcmp(response, expected))
+        {
+            fprintf(stderr, "request %d: status %d, \"%s\", expected 200, \"%s\"\n", r, status, response, expected);
+            return 1;
+        }
+        latencies[r] = now_us() - request_start;
+    }
+    int64_t elapsed = now_us() - start;
+    close(fd);
+
+    qsort(latencies, requests, sizeof(int64_t), compare_i64);
+    printf("%d %s requests of %d image(s), %" PRIu64 " body bytes: all accepted, %.1f requests/s, %.2f MB/s, "
+           "latency p50 %.2f ms, p99 %.2f ms\n",
+           requests, raw ? "raw image/jpeg" : "multipart", parts, bytes / requests, requests * 1000000.0 / elapsed,
+           (double)bytes / elapsed, latencies[requests / 2] / 1000.0, latencies[requests * 99 / 100] / 1000.0);
+    free(latencies);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int requests = DEFAULT_REQUESTS;
+    int parts = DEFAULT_PARTS;
+    bool only_bench = false;
+    bool raw = false;
+    uint8_t *jpeg = NULL;
+    size_t jpeg_length = 0;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "brn:p:j:")))
+    {
+        switch (opt)
+        {
+        case 'b':
+            only_bench = true;
+            break;
+        case 'r':
+            raw = true;
+            break;
+        case 'n':
+            requests = atoi(optarg);
+            break;
+        case 'p':
+            parts = atoi(optarg);
+            break;
+        case 'j':
+            jpeg = read_file(optarg, &jpeg_length);
+            break;
+        default:
+            return 1;
+        }
+    }
+
+    if ((!only_bench && optind != argc - 1) || requests <= 0 || parts <= 0 || parts > MULTIPART_MAX_PARTS ||
+        (raw && (parts != 1 || jpeg == NULL)))
+    {
+        fprintf(stderr, "usage: %s [-n requests] [-p parts, up to %d] [-j jpeg] <host:port>\n"
+                        "       %s -r -j jpeg [-n requests] <host:port>\n"
+                        "       %s -b [-p parts] [-j jpeg]\n",
+                argv[0], MULTIPART_MAX_PARTS, argv[0], argv[0]);
+        return 1;
+    }
+
+    if (only_bench && jpeg == NULL)
+    {
+        jpeg_length = BENCH_IMAGE_SIZE;
+        jpeg = malloc(jpeg_length);
+        for (size_t i = 0; i < jpeg_length; i++)
+        {
+            jpeg[i] = (uint8_t)rand();
+        }
+    }
+
+    sink_t sink = {.capacity = MULTIPART_MAX_PARTS * (MULTIPART_PART_HEADER_SIZE + jpeg_length) + 64};
+    sink.buffer = malloc(sink.capacity);
+
+    int ret = only_bench ? bench(jpeg, jpeg_length, parts, &sink) : post(argv[optind], raw, requests, parts, jpeg, jpeg_length, &sink);
+
+    free(sink.buffer);
+    free(jpeg);
+
+    return ret;
+}
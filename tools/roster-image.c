@@ -0,0 +1,199 @@
+/*
+ * Builds a roster image (see include/roster-format.h) from the enrolled serial numbers, one per line in decimal, in
+ * any order, duplicates are dropped.
+ *
+ *     cc -O2 -I include -o roster-image tools/roster-image.c
+ *     ./roster-image serials.txt roster.bin 7   # roster version 7
+ *     parttool.py erase_partition --partition-name roster
+ *     parttool.py write_partition --partition-name roster --input roster.bin
+ *
+ * parttool writes it to the first slot of the partition. The device loads the slot it wrote last, which could be
+ * the second one, so the partition is erased first.
+ *
+ * With --bench instead of an output file, it times lookups in the image the same way the device does them.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "roster-format.h"
+
+#define MAX_SERIALS ROSTER_SLOT_CAPACITY
+#define BENCH_LOOKUPS 50000
+
+static uint32_t crc32_table[256];
+
+static void crc32_init()
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+        {
+            c = (c >> 1) ^ (0xedb88320 & -(c & 1));
+        }
+        crc32_table[i] = c;
+    }
+}
+
+/**
+ * The same as `esp_rom_crc32_le()` on the device.
+ */
+static uint32_t crc32_le(uint32_t crc, const uint8_t *data, size_t length)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc = crc32_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static int64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * `roster_contains()` of src/roster.c, keep them the same.
+ */
+static bool contains(const uint64_t *serials, uint32_t count, uint64_t serial_number)
+{
+    if (count == 0)
+    {
+        return false;
+    }
+
+    const uint64_t *base = serials;
+    while (count > 1)
+    {
+        uint32_t half = count / 2;
+        base = base[half] <= serial_number ? base + half : base;
+        count -= half;
+    }
+
+    return *base == serial_number;
+}
+
+static void bench(const uint64_t *serials, uint32_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    int found = 0;
+    uint32_t pick = 1;
+    int64_t start = now_us();
+    for (int i = 0; i < BENCH_LOOKUPS; i++)
+    {
+        pick = pick * 1664525 + 1013904223;
+        found += contains(serials, count, serials[pick % count] + (i & 1));
+    }
+    int64_t elapsed = now_us() - start;
+
+    // every other serial is off by one, unenrolled unless the serials are consecutive
+    printf("%d lookups in %" PRIu32 " serials: %.1f ns each, %d found\n", BENCH_LOOKUPS, count,
+           elapsed * 1000.0 / BENCH_LOOKUPS, found);
+}
+
+int main(int argc, char **argv)
+{
+    bool benchmark = argc == 3 && 0 == strcmp(argv[2], "--bench");
+    if (argc != 4 && !benchmark)
+    {
+        fprintf(stderr, "usage: %s <serials.txt> <roster.bin> <version>\n"
+                        "       %s <serials.txt> --bench\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+
+    crc32_init();
+
+    FILE *in = fopen(argv[1], "r");
+    if (in == NULL)
+    {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+
+    uint64_t *serials = malloc((MAX_SERIALS + 1) * sizeof(uint64_t));
+    size_t count = 0;
+    char line[64];
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        char *end;
+        uint64_t serial = strtoull(line, &end, 10);
+        if (end == line)
+        {
+            continue; // blank lines and comments
+        }
+        if (count > MAX_SERIALS)
+        {
+            fprintf(stderr, "more than the %zu serials the partition holds\n", (size_t)MAX_SERIALS);
+            return 1;
+        }
+        serials[count++] = serial;
+    }
+    fclose(in);
+
+    qsort(serials, count, sizeof(uint64_t), compare_u64);
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (unique == 0 || serials[unique - 1] != serials[i])
+        {
+            serials[unique++] = serials[i];
+        }
+    }
+    if (unique > MAX_SERIALS)
+    {
+        fprintf(stderr, "more than the %zu serials the partition holds\n", (size_t)MAX_SERIALS);
+        return 1;
+    }
+
+    if (benchmark)
+    {
+        bench(serials, unique);
+        return 0;
+    }
+
+    roster_image_header_t header = {
+        .magic = ROSTER_MAGIC,
+        .format_version = ROSTER_FORMAT_VERSION,
+        .version = (uint32_t)strtoul(argv[3], NULL, 10),
+        .count = (uint32_t)unique,
+        .serials_crc = crc32_le(0, (const uint8_t *)serials, unique * sizeof(uint64_t)),
+    };
+    header.crc = crc32_le(0, (const uint8_t *)&header, offsetof(roster_image_header_t, crc));
+
+    FILE *out = fopen(argv[2], "wb");
+    if (out == NULL || 1 != fwrite(&header, sizeof(header), 1, out) ||
+        unique != fwrite(serials, sizeof(uint64_t), unique, out) || 0 != fclose(out))
+    {
+        fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+        return 1;
+    }
+
+    printf("roster version %" PRIu32 ": %zu serials (%zu duplicates dropped) written to %s\n", header.version, unique,
+           count - unique, argv[2]);
+
+    free(serials);
+    return 0;
+}
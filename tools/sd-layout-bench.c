@@ -0,0 +1,236 @@
+/*
+ * Per-file create latency of the images layout on the sdcard, the old single /sdcard/images directory against the
+ * day (and hour) sharded one of src/sd-card.c, at 1k, 10k and 50k images.
+ *
+ * Runs on the host against any directory, the numbers only mean something on a FAT filesystem, e.g. the sdcard in a
+ * reader or an image file:
+ *
+ *     cc -O2 -o sd-layout-bench tools/sd-layout-bench.c
+ *     truncate -s 2G fat.img && mkfs.vfat -F 32 -s 32 fat.img   # 16KB clusters, like the device mounts it
+ *     sudo mount -o loop,uid=$(id -u) fat.img /mnt/fat
+ *     ./sd-layout-bench /mnt/fat [images per day]
+ *
+ * Every file is opened, written and closed, the same as `write_to_file_path()`. The files are removed after each
+ * run. The sharded layout is mirrored here, keep it in sync with `get_images_shard()`.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HOUR_SHARD_THRESHOLD 1000 // SD_IMAGES_HOUR_SHARD_THRESHOLD
+#define IMAGE_SIZE 1024           // the payload only matters for the data clusters, not for the directory
+#define DEFAULT_IMAGES_PER_DAY 1500
+#define PATH_LENGTH 256
+#define SCHOOL_DAY_START_S (8 * 3600)
+#define SCHOOL_DAY_LENGTH_S (8 * 3600)
+
+static const int runs[] = {1000, 10000, 50000};
+
+typedef struct shard_t
+{
+    int day;
+    int hour;
+    bool hourly;
+    uint32_t files;
+    char day_path[PATH_LENGTH];
+    char hour_path[PATH_LENGTH];
+} shard_t;
+
+static int64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void path_printf(char *out, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(out, PATH_LENGTH, format, args);
+    va_end(args);
+
+    if (length < 0 || length >= PATH_LENGTH)
+    {
+        fprintf(stderr, "path too long: %s\n", out);
+        exit(1);
+    }
+}
+
+static void create_directory(const char *path)
+{
+    if (0 != mkdir(path, 0775) && errno != EEXIST)
+    {
+        fprintf(stderr, "mkdir %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+}
+
+static void remove_tree(const char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+    {
+        unlink(path);
+        return;
+    }
+
+    struct dirent *ent;
+    char child[PATH_LENGTH];
+    while (NULL != (ent = readdir(dir)))
+    {
+        if (0 == strcmp(ent->d_name, ".") || 0 == strcmp(ent->d_name, ".."))
+        {
+            continue;
+        }
+        if (snprintf(child, sizeof(child), "%s/%s", path, ent->d_name) < (int)sizeof(child))
+        {
+            remove_tree(child);
+        }
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+/**
+ * `get_images_shard()` with the directory count kept from the start, as if the device never rebooted.
+ */
+static const char *sharded_folder(shard_t *shard, const char *root, const struct tm *t)
+{
+    int day = (t->tm_year + 1900) * 10000 + (t->tm_mon + 1) * 100 + t->tm_mday;
+    if (day != shard->day)
+    {
+        path_printf(shard->day_path, "%s/%08d", root, day);
+        create_directory(shard->day_path);
+        shard->day = day;
+        shard->hour = -1;
+        shard->files = 0;
+        shard->hourly = false;
+    }
+
+    if (!shard->hourly)
+    {
+        shard->files++;
+        shard->hourly = shard->files >= HOUR_SHARD_THRESHOLD;
+        return shard->day_path;
+    }
+
+    if (t->tm_hour != shard->hour)
+    {
+        path_printf(shard->hour_path, "%s/%02d", shard->day_path, t->tm_hour);
+        create_directory(shard->hour_path);
+        shard->hour = t->tm_hour;
+    }
+    return shard->hour_path;
+}
+
+static int compare_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void run(const char *base, bool sharded, int count, int images_per_day, const uint8_t *image)
+{
+    char root[PATH_LENGTH];
+    char path[PATH_LENGTH];
+    shard_t shard = {.hour = -1};
+    int64_t *latencies = malloc(count * sizeof(int64_t));
+    int64_t total = 0;
+
+    path_printf(root, "%s/images", base);
+    remove_tree(root);
+    create_directory(root);
+
+    // the scans of a day spread over school hours, starting on 2026-09-01
+    time_t first_day = 1788220800;
+    for (int i = 0; i < count; i++)
+    {
+        time_t seconds = first_day + (time_t)(i / images_per_day) * 86400 + SCHOOL_DAY_START_S +
+                         (time_t)(i % images_per_day) * SCHOOL_DAY_LENGTH_S / images_per_day;
+        int64_t time_us = (int64_t)seconds * 1000000 + i;
+        uint64_t serial = 911101686122ULL + (uint64_t)(i % 700);
+        struct tm t;
+        gmtime_r(&seconds, &t);
+
+        int64_t start = now_us();
+
+        const char *folder = sharded ? sharded_folder(&shard, root, &t) : root;
+        path_printf(path, "%s/%" PRIu64 "_%" PRId64 ".jpg", folder, serial, time_us);
+
+        // save_image_to_sdcard() checks for an existing file before writing
+        struct stat st;
+        if (0 == stat(path, &st))
+        {
+            fprintf(stderr, "%s exists\n", path);
+        }
+        FILE *f = fopen(path, "wb");
+        if (f == NULL || IMAGE_SIZE != fwrite(image, 1, IMAGE_SIZE, f) || 0 != fclose(f))
+        {
+            fprintf(stderr, "writing %s: %s\n", path, strerror(errno));
+            exit(1);
+        }
+
+        latencies[i] = now_us() - start;
+        total += latencies[i];
+    }
+
+    // the last 1000 show what a save costs once the directory is that big
+    int tail = count < 1000 ? count : 1000;
+    int64_t tail_total = 0;
+    for (int i = count - tail; i < count; i++)
+    {
+        tail_total += latencies[i];
+    }
+
+    qsort(latencies, count, sizeof(int64_t), compare_i64);
+    printf("%-8s %6d files: mean %8.1f us, p50 %6" PRId64 " us, p99 %7" PRId64 " us, max %8" PRId64 " us, last %d mean %8.1f us\n",
+           sharded ? "sharded" : "flat", count, (double)total / count, latencies[count / 2], latencies[count * 99 / 100],
+           latencies[count - 1], tail, (double)tail_total / tail);
+    fflush(stdout);
+
+    free(latencies);
+    remove_tree(root);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <directory> [images per day, default %d]\n", argv[0], DEFAULT_IMAGES_PER_DAY);
+        return 1;
+    }
+
+    int images_per_day = argc > 2 ? atoi(argv[2]) : DEFAULT_IMAGES_PER_DAY;
+    if (images_per_day <= 0)
+    {
+        fprintf(stderr, "images per day must be positive\n");
+        return 1;
+    }
+
+    uint8_t image[IMAGE_SIZE];
+    for (size_t i = 0; i < sizeof(image); i++)
+    {
+        image[i] = (uint8_t)rand();
+    }
+
+    printf("%d images per day, sharded by hour above %d per day\n", images_per_day, HOUR_SHARD_THRESHOLD);
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++)
+    {
+        run(argv[1], false, runs[i], images_per_day, image);
+        run(argv[1], true, runs[i], images_per_day, image);
+    }
+
+    return 0;
+}
@@ -0,0 +1,321 @@
+#pragma once
+
+/*
+ * The request side of the upload protocol for the host tools (multipart-check, upload-loadgen): connecting, sending a
+ * request as iovecs straight from where its pieces are, reading the response, the sha256 of raw uploads.
+ * Header only, the tools are built from a single file and src/multipart.c. Needs _GNU_SOURCE for strcasestr().
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "multipart.h"
+
+#define REQUEST_HEADER_SIZE 512
+#define RESPONSE_SIZE 4096
+#define REQUEST_IOV_COUNT (1 + MULTIPART_SEGMENT_COUNT(MULTIPART_MAX_PARTS))
+
+static int64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t wall_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(uint32_t state[8], const uint8_t block[64])
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a, state[1] += b, state[2] += c, state[3] += d, state[4] += e, state[5] += f, state[6] += g, state[7] += h;
+}
+
+/**
+ * The hex sha256 of `data`, what the device sends as `content-sha256` (with mbedtls).
+ */
+static void sha256_hex(const uint8_t *data, size_t length, char out[65])
+{
+    uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    uint8_t tail[128] = {0};
+    size_t full = length / 64 * 64;
+
+    for (size_t i = 0; i < full; i += 64)
+    {
+        sha256_block(state, data + i);
+    }
+
+    // the rest, a 1 bit and the length in bits fill one or two more blocks
+    size_t rest = length - full;
+    memcpy(tail, data + full, rest);
+    tail[rest] = 0x80;
+    size_t tail_length = rest < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t)length * 8;
+    for (int i = 0; i < 8; i++)
+    {
+        tail[tail_length - 1 - i] = (uint8_t)(bits >> (8 * i));
+    }
+    for (size_t i = 0; i < tail_length; i += 64)
+    {
+        sha256_block(state, tail + i);
+    }
+
+    for (int i = 0; i < 8; i++)
+    {
+        snprintf(&out[8 * i], 9, "%08x", state[i]);
+    }
+}
+
+static int compare_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint8_t *read_file(const char *path, size_t *out_length)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL || 0 != fseek(f, 0, SEEK_END))
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    long length = ftell(f);
+    rewind(f);
+
+    uint8_t *data = malloc(length > 0 ? length : 1);
+    if (data == NULL || (size_t)length != fread(data, 1, length, f))
+    {
+        fprintf(stderr, "%s: couldn't read it\n", path);
+        exit(1);
+    }
+    fclose(f);
+
+    *out_length = length;
+    return data;
+}
+
+/**
+ * A connection to `address` (host:port), -1 if there is none.
+ */
+static int connect_to(const char *address)
+{
+    char host[256];
+    const char *colon = strrchr(address, ':');
+    if (colon == NULL || (size_t)(colon - address) >= sizeof(host))
+    {
+        fprintf(stderr, "%s: expected host:port\n", address);
+        return -1;
+    }
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *info;
+    int err = getaddrinfo(host, colon + 1, &hints, &info);
+    if (err != 0)
+    {
+        fprintf(stderr, "%s: %s\n", address, gai_strerror(err));
+        return -1;
+    }
+
+    // a server which isn't up is left for the caller to report, with errno set
+    int fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+    if (fd < 0 || 0 != connect(fd, info->ai_addr, info->ai_addrlen))
+    {
+        int err = errno;
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        freeaddrinfo(info);
+        errno = err;
+        return -1;
+    }
+    freeaddrinfo(info);
+
+    // the device's lwip doesn't hold small writes back either
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    return fd;
+}
+
+/**
+ * writev() until all of `iov` is written.
+ */
+static bool writev_all(int fd, struct iovec *iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0)
+        {
+            return false;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+/**
+ * Reads one response, returns its status and its body in `out` (NUL terminated).
+ */
+static int read_response(int fd, char *out, size_t out_length)
+{
+    size_t used = 0;
+    char *end = NULL;
+
+    while (end == NULL)
+    {
+        ssize_t n = read(fd, out + used, out_length - 1 - used);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        used += n;
+        out[used] = '\0';
+        end = strstr(out, "\r\n\r\n");
+    }
+
+    int status;
+    const char *length_header = strcasestr(out, "\r\nContent-Length:");
+    if (1 != sscanf(out, "HTTP/1.%*d %d", &status) || length_header == NULL || length_header > end)
+    {
+        return -1;
+    }
+    size_t content_length = strtoul(length_header + strlen("\r\nContent-Length:"), NULL, 10);
+    size_t header_length = end + 4 - out;
+    if (header_length + content_length >= out_length)
+    {
+        return -1;
+    }
+
+    while (used < header_length + content_length)
+    {
+        ssize_t n = read(fd, out + used, header_length + content_length - used);
+        if (n <= 0)
+        {
+            return -1;
+        }
+        used += n;
+    }
+    memmove(out, out + header_length, content_length);
+    out[content_length] = '\0';
+
+    return status;
+}
+
+/**
+ * Fills `iov` with the request headers, written to `header` (REQUEST_HEADER_SIZE), and the segments of `body`, the
+ * way the device sends a multipart upload. Returns the number of iovecs.
+ */
+static int upload_request_multipart(char *header, struct iovec *iov, const char *address, uint64_t serial_number,
+                                    const multipart_body_t *body)
+{
+    int header_length = snprintf(header, REQUEST_HEADER_SIZE,
+                                 "POST /post HTTP/1.1\r\n"
+                                 "Host: %s\r\n"
+                                 "Content-Type: " MULTIPART_CONTENT_TYPE "\r\n"
+                                 "rfid-serial-number: %" PRIu64 "\r\n"
+                                 "Content-Length: %zu\r\n\r\n",
+                                 address, serial_number, body->content_length);
+
+    iov[0] = (struct iovec){.iov_base = header, .iov_len = header_length};
+    for (size_t i = 0; i < body->segment_count; i++)
+    {
+        iov[1 + i] = (struct iovec){.iov_base = (void *)body->segments[i].data, .iov_len = body->segments[i].length};
+    }
+
+    return 1 + body->segment_count;
+}
+
+/**
+ * Like `upload_request_multipart()` for the raw upload mode, the jpeg is the body and `sha256` its `sha256_hex()`.
+ */
+static int upload_request_raw(char *header, struct iovec *iov, const char *address, uint64_t serial_number,
+                              int64_t scan_time_ms, const char *device_id, const char *sha256, const uint8_t *jpeg,
+                              size_t length)
+{
+    int header_length = snprintf(header, REQUEST_HEADER_SIZE,
+                                 "POST /post HTTP/1.1\r\n"
+                                 "Host: %s\r\n"
+                                 "Content-Type: image/jpeg\r\n"
+                                 "rfid-serial-number: %" PRIu64 "\r\n"
+                                 "scan-time: %" PRId64 "\r\n"
+                                 "device-id: %s\r\n"
+                                 "content-sha256: %s\r\n"
+                                 "Content-Length: %zu\r\n\r\n",
+                                 address, serial_number, scan_time_ms, device_id, sha256, length);
+
+    iov[0] = (struct iovec){.iov_base = header, .iov_len = header_length};
+    iov[1] = (struct iovec){.iov_base = (void *)jpeg, .iov_len = length};
+
+    return 2;
+}
@@ -0,0 +1,391 @@
+/*
+ * Replays the upload wire format of src/upload.c from many virtual readers at once, to find out how many readers one
+ * ingestion server takes.
+ *
+ *     cc -O2 -pthread -I include -o upload-loadgen tools/upload-loadgen.c src/multipart.c -lm
+ *     python mock_server/server.py --headless --quiet &
+ *     ./upload-loadgen -d 50 -s 12 -t 60 127.0.0.1:8000 captures/scan-*.jpg
+ *
+ * Every device is a thread with its own kept open connection. Scans arrive at random (a poisson process) at -s scans
+ * per minute, and queue up on the device while a request is in flight, the way the uploader's queue does
+ * (UPLOAD_QUEUE_SIZE, full means the scan is dropped). In the multipart mode the next request takes whatever is queued,
+ * up to MULTIPART_MAX_PARTS images, -r sends every image as its own raw image/jpeg request instead. The images are
+ * the given jpegs in turn, every scan with its own serial and scan time.
+ *
+ * Reports throughput and the p50/p99 latencies from scan to response (queueing included) and of the requests alone.
+ * For capacity planning runs:
+ *
+ *     ./upload-loadgen -H > capacity.csv
+ *     for d in 10 20 50 100 200; do ./upload-loadgen -c -d $d -s 12 -t 60 127.0.0.1:8000 captures/scan-*.jpg >> capacity.csv; done
+ *
+ * Exits with 1 if any upload failed.
+ */
+
+#define _GNU_SOURCE // strcasestr
+
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "multipart.h"
+#include "upload-client.h"
+
+#define DEFAULT_DEVICES 10
+#define DEFAULT_SCANS_PER_MINUTE 6
+#define DEFAULT_DURATION_S 30
+#define DEFAULT_QUEUE_SIZE 8 // UPLOAD_QUEUE_SIZE
+#define MAX_QUEUE_SIZE 64
+#define MAX_SAMPLES 256
+#define RECONNECT_PAUSE_US 100000 // after a failed request, so a server that is down isn't hammered
+#define FIRST_SERIAL 911101686122ULL
+#define SERIALS_PER_DEVICE 1000000 // every device scans its own range of serials
+
+static const char *CSV_HEADER = "devices,scans_per_minute,duration_s,mode,scans,uploaded,failed,dropped,requests,"
+                                "images_per_s,mb_per_s,scan_p50_ms,scan_p99_ms,request_p50_ms,request_p99_ms";
+
+typedef struct sample_t
+{
+    uint8_t *jpeg;
+    size_t length;
+    char sha256[65];
+} sample_t;
+
+typedef struct samples_t
+{
+    int64_t *values;
+    size_t count;
+    size_t capacity;
+} samples_t;
+
+typedef struct device_t
+{
+    int index;
+    pthread_t thread;
+    unsigned int seed;
+    uint64_t scans;
+    uint64_t uploaded;
+    uint64_t failed;
+    uint64_t dropped;
+    uint64_t requests;
+    uint64_t bytes;
+    samples_t scan_latencies;    // from the scan to the response of the request it went out with
+    samples_t request_latencies; // from the first byte written to the response
+} device_t;
+
+static const char *address;
+static sample_t samples[MAX_SAMPLES];
+static int sample_count = 0;
+static bool raw = false;
+static double scans_per_minute = DEFAULT_SCANS_PER_MINUTE;
+static int queue_size = DEFAULT_QUEUE_SIZE;
+static int64_t start_us;
+static int64_t end_us;
+static int64_t start_wall_ms;
+
+static void push(samples_t *samples, int64_t value)
+{
+    if (samples->count == samples->capacity)
+    {
+        samples->capacity = samples->capacity ? 2 * samples->capacity : 1024;
+        samples->values = realloc(samples->values, samples->capacity * sizeof(int64_t));
+        if (samples->values == NULL)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    samples->values[samples->count++] = value;
+}
+
+static void append(samples_t *to, const samples_t *from)
+{
+    for (size_t i = 0; i < from->count; i++)
+    {
+        push(to, from->values[i]);
+    }
+}
+
+static double percentile_ms(samples_t *samples, int percent)
+{
+    if (samples->count == 0)
+    {
+        return 0;
+    }
+    qsort(samples->values, samples->count, sizeof(int64_t), compare_i64);
+    size_t i = samples->count * percent / 100;
+    return samples->values[i < samples->count ? i : samples->count - 1] / 1000.0;
+}
+
+/**
+ * The time to the next scan, exponentially distributed around the mean interval.
+ */
+static int64_t next_interval_us(device_t *device)
+{
+    double u = (rand_r(&device->seed) + 1.0) / ((double)RAND_MAX + 2.0);
+    return (int64_t)(-log(u) * 60000000.0 / scans_per_minute);
+}
+
+/**
+ * Sends the `count` oldest scans of the queue in one request, returns the time of the response or -1 on a failure.
+ */
+static int64_t upload(device_t *device, int *fd, const int64_t *scan_times, const uint64_t *serials, int count)
+{
+    static __thread multipart_body_t body;
+    char header[REQUEST_HEADER_SIZE];
+    char response[RESPONSE_SIZE];
+    char device_id[32];
+    struct iovec iov[REQUEST_IOV_COUNT];
+    int iov_count;
+
+    if (*fd < 0 && (*fd = connect_to(address)) < 0)
+    {
+        // once, not for every device and every retry
+        static int reported = 0;
+        if (0 == __atomic_exchange_n(&reported, 1, __ATOMIC_RELAXED))
+        {
+            fprintf(stderr, "%s: %s\n", address, strerror(errno));
+        }
+        return -1;
+    }
+
+    const sample_t *sample = &samples[serials[0] % sample_count];
+    int64_t scan_wall_ms = start_wall_ms + (scan_times[0] - start_us) / 1000;
+
+    if (raw)
+    {
+        snprintf(device_id, sizeof(device_id), "loadgen-%03d", device->index);
+        iov_count = upload_request_raw(header, iov, address, serials[0], scan_wall_ms, device_id, sample->sha256,
+                                       sample->jpeg, sample->length);
+    }
+    else
+    {
+        multipart_body_init(&body);
+        for (int i = 0; i < count; i++)
+        {
+            sample = &samples[serials[i] % sample_count];
+            multipart_body_add_jpeg(&body, serials[i], start_wall_ms + (scan_times[i] - start_us) / 1000, sample->jpeg,
+                                    sample->length);
+        }
+        multipart_body_finish(&body);
+        iov_count = upload_request_multipart(header, iov, address, serials[0], &body);
+    }
+
+    int64_t request_start = now_us();
+    if (!writev_all(*fd, iov, iov_count) || 200 != read_response(*fd, response, sizeof(response)))
+    {
+        close(*fd);
+        *fd = -1;
+        return -1;
+    }
+    int64_t responded = now_us();
+
+    for (int i = 1; i < iov_count; i++)
+    {
+        device->bytes += iov[i].iov_len;
+    }
+    push(&device->request_latencies, responded - request_start);
+
+    return responded;
+}
+
+static void *device_task(void *args)
+{
+    device_t *device = args;
+    int64_t scan_times[MAX_QUEUE_SIZE];
+    uint64_t serials[MAX_QUEUE_SIZE];
+    int queued = 0;
+    int fd = -1;
+
+    int64_t next_scan = start_us + next_interval_us(device);
+
+    while (1)
+    {
+        // the scans that happened while the last request was in flight
+        int64_t now = now_us();
+        while (next_scan <= now && next_scan < end_us)
+        {
+            if (queued < queue_size)
+            {
+                scan_times[queued] = next_scan;
+                serials[queued] = FIRST_SERIAL + (uint64_t)device->index * SERIALS_PER_DEVICE + device->scans;
+                queued++;
+            }
+            else
+            {
+                device->dropped++;
+            }
+            device->scans++;
+            next_scan += next_interval_us(device);
+        }
+
+        if (queued == 0)
+        {
+            if (next_scan >= end_us)
+            {
+                break;
+            }
+            usleep(next_scan - now);
+            continue;
+        }
+
+        int count = raw ? 1 : (queued < MULTIPART_MAX_PARTS ? queued : MULTIPART_MAX_PARTS);
+        int64_t responded = upload(device, &fd, scan_times, serials, count);
+        device->requests++;
+
+        if (responded < 0)
+        {
+            // the device falls back to the offline store, those scans are done here
+            device->failed += count;
+            usleep(RECONNECT_PAUSE_US);
+        }
+        else
+        {
+            device->uploaded += count;
+            for (int i = 0; i < count; i++)
+            {
+                push(&device->scan_latencies, responded - scan_times[i]);
+            }
+        }
+
+        queued -= count;
+        memmove(scan_times, scan_times + count, queued * sizeof(int64_t));
+        memmove(serials, serials + count, queued * sizeof(uint64_t));
+    }
+
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int device_count = DEFAULT_DEVICES;
+    int duration_s = DEFAULT_DURATION_S;
+    bool csv = false;
+    int opt;
+
+    while (-1 != (opt = getopt(argc, argv, "d:s:t:q:rcH")))
+    {
+        switch (opt)
+        {
+        case 'd':
+            device_count = atoi(optarg);
+            break;
+        case 's':
+            scans_per_minute = atof(optarg);
+            break;
+        case 't':
+            duration_s = atoi(optarg);
+            break;
+        case 'q':
+            queue_size = atoi(optarg);
+            break;
+        case 'r':
+            raw = true;
+            break;
+        case 'c':
+            csv = true;
+            break;
+        case 'H':
+            printf("%s\n", CSV_HEADER);
+            return 0;
+        default:
+            return 1;
+        }
+    }
+
+    if (argc - optind < 2 || argc - optind - 1 > MAX_SAMPLES || device_count <= 0 || scans_per_minute <= 0 ||
+        duration_s <= 0 || queue_size <= 0 || queue_size > MAX_QUEUE_SIZE)
+    {
+        fprintf(stderr, "usage: %s [-d devices] [-s scans per minute per device] [-t seconds] [-q queue size, up to %d]\n"
+                        "       [-r] [-c] <host:port> <jpeg>...\n"
+                        "       %s -H\n"
+                        "-r raw image/jpeg requests instead of multipart, -c one csv line (-H prints its header)\n",
+                argv[0], MAX_QUEUE_SIZE, argv[0]);
+        return 1;
+    }
+
+    address = argv[optind];
+    for (int i = optind + 1; i < argc; i++)
+    {
+        sample_t *sample = &samples[sample_count++];
+        sample->jpeg = read_file(argv[i], &sample->length);
+        sha256_hex(sample->jpeg, sample->length, sample->sha256);
+    }
+
+    // a server closing a connection shows up as a failed write, not as a signal
+    signal(SIGPIPE, SIG_IGN);
+
+    device_t *devices = calloc(device_count, sizeof(device_t));
+    start_us = now_us();
+    start_wall_ms = wall_ms();
+    end_us = start_us + (int64_t)duration_s * 1000000;
+
+    for (int i = 0; i < device_count; i++)
+    {
+        devices[i].index = i;
+        devices[i].seed = (unsigned int)(start_us + i * 7919);
+        if (0 != pthread_create(&devices[i].thread, NULL, device_task, &devices[i]))
+        {
+            fprintf(stderr, "couldn't start device %d\n", i);
+            return 1;
+        }
+    }
+
+    device_t total = {0};
+    for (int i = 0; i < device_count; i++)
+    {
+        pthread_join(devices[i].thread, NULL);
+        total.scans += devices[i].scans;
+        total.uploaded += devices[i].uploaded;
+        total.failed += devices[i].failed;
+        total.dropped += devices[i].dropped;
+        total.requests += devices[i].requests;
+        total.bytes += devices[i].bytes;
+        append(&total.scan_latencies, &devices[i].scan_latencies);
+        append(&total.request_latencies, &devices[i].request_latencies);
+        free(devices[i].scan_latencies.values);
+        free(devices[i].request_latencies.values);
+    }
+    double elapsed_s = (now_us() - start_us) / 1000000.0;
+
+    double images_per_s = total.uploaded / elapsed_s;
+    double mb_per_s = total.bytes / elapsed_s / (1024.0 * 1024.0);
+    double scan_p50 = percentile_ms(&total.scan_latencies, 50);
+    double scan_p99 = percentile_ms(&total.scan_latencies, 99);
+    double request_p50 = percentile_ms(&total.request_latencies, 50);
+    double request_p99 = percentile_ms(&total.request_latencies, 99);
+
+    if (csv)
+    {
+        printf("%d,%.2f,%d,%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.2f,%.3f,%.2f,%.2f,%.2f,%.2f\n",
+               device_count, scans_per_minute, duration_s, raw ? "raw" : "multipart", total.scans, total.uploaded,
+               total.failed, total.dropped, total.requests, images_per_s, mb_per_s, scan_p50, scan_p99, request_p50,
+               request_p99);
+    }
+    else
+    {
+        printf("%d devices at %.1f scans/min for %d s, %s uploads to %s\n", device_count, scans_per_minute, duration_s,
+               raw ? "raw image/jpeg" : "multipart", address);
+        printf("scans %" PRIu64 ", uploaded %" PRIu64 " (%.1f/s, %.2f MB/s) in %" PRIu64 " requests, failed %" PRIu64
+               ", dropped %" PRIu64 "\n",
+               total.scans, total.uploaded, images_per_s, mb_per_s, total.requests, total.failed, total.dropped);
+        printf("scan to response p50 %.2f ms, p99 %.2f ms; request p50 %.2f ms, p99 %.2f ms\n", scan_p50, scan_p99,
+               request_p50, request_p99);
+    }
+
+    free(total.scan_latencies.values);
+    free(total.request_latencies.values);
+    free(devices);
+
+    return total.failed > 0 ? 1 : 0;
+}